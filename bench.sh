@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Run the simulator over a fixed matrix of synthetic workloads, and report
+# the wall time, accesses per second, the average simulated cycles of the
+# accesses in the cost model (see cost.h) and the counters of each run. The
+# counters of the previous run are kept in bench.out/, and the ones changed
+# since then are printed as deltas.
+#
+# Usage: ./bench.sh [scale]	(scale multiplies the number of operations)
+
+SCALE=${1:-1}
+OUT=bench.out
+VM="./vm -q -t -p 3:6 -m 65536"
+
+mkdir -p $OUT
+
+# name:wlgen options[:simulator options]
+MATRIX="
+seq:-w seq -n 1000000 -f 4096 -P 4 -q 10000
+stride:-w stride -n 1000000 -f 4096 -P 4 -q 10000 -s 17
+random:-w random -n 1000000 -f 4096 -P 4 -q 10000
+random-huge:-w random -n 1000000 -f 4096 -P 4 -q 10000 -H
+zipf:-w zipf -n 1000000 -f 4096 -P 4 -q 10000
+forkstorm:-w forkstorm -n 20000 -f 256 -P 8
+cowstorm:-w cowstorm -n 1000000 -f 4096 -P 8
+smp2:-w random -n 1000000 -f 4096 -P 8 -q 1000 -C 2:-c 2
+smp4:-w random -n 1000000 -f 4096 -P 8 -q 1000 -C 4:-c 4
+smp8:-w random -n 1000000 -f 4096 -P 8 -q 1000 -C 8:-c 8
+tenants:-w tenants -n 1000000 -f 2048 -P 8 -q 10000:-K
+"
+
+now() {
+	date +%s.%N
+}
+
+printf "%-12s %10s %12s %14s %10s\n" workload seconds accesses accesses/sec amat
+
+echo "$MATRIX" | while IFS=: read name opts vmopts; do
+	[ -z "$name" ] && continue
+
+	n=$(echo "$opts" | sed 's/.*-n \([0-9]*\).*/\1/')
+	opts=$(echo "$opts" | sed "s/-n [0-9]*/-n $((n * SCALE))/")
+
+	./wlgen $opts > $OUT/$name.txt || exit 1
+	./tracecvt $OUT/$name.txt $OUT/$name.bin || exit 1
+	accesses=$(grep -c '^\(read\|write\)' $OUT/$name.txt)
+
+	[ -f $OUT/$name.stats ] && mv $OUT/$name.stats $OUT/$name.stats.prev
+
+	start=$(now)
+	$VM $vmopts -S $OUT/$name.stats $OUT/$name.bin > /dev/null 2>&1
+	end=$(now)
+
+	awk -v n="$name" -v s="$start" -v e="$end" -v a="$accesses" '
+	$1 == "all" && $2 == "accesses" { nr = $3 }
+	$1 == "all" && $2 == "cycles" { cycles = $3 }
+	END {
+		t = e - s;
+		printf "%-12s %10.3f %12d %14.0f %10.2f\n", n, t, a, (t > 0 ? a / t : 0),
+				(nr > 0 ? cycles / nr : 0);
+	}' $OUT/$name.stats
+
+	if [ -f $OUT/$name.stats.prev ]; then
+		awk '$1 == "all" {
+			if (FNR == NR) { prev[$2] = $3; next }
+			if ($2 in prev && prev[$2] != $3) {
+				printf "  %-20s %12d -> %12d (%+d)\n", $2, prev[$2], $3, $3 - prev[$2];
+			}
+		}' $OUT/$name.stats.prev $OUT/$name.stats
+	fi
+done
+
+echo
+echo "Counters of the system in each run:"
+for f in $OUT/*.stats; do
+	printf "%-12s" $(basename $f .stats)
+	awk '$1 == "all" { printf " %s=%s", $2, $3 } END { printf "\n" }' $f
+done
@@ -0,0 +1,142 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "types.h"
+#include "bitmap.h"
+
+static inline unsigned long __nr_words(unsigned long nr_bits)
+{
+	return (nr_bits + BITS_PER_LONG - 1) / BITS_PER_LONG;
+}
+
+/* Set the first @nr_bits bits of @words and clear the rest of the last word */
+static void __fill_words(unsigned long *words, unsigned long nr_bits)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr_bits / BITS_PER_LONG; i++) {
+		words[i] = ~0UL;
+	}
+	if (nr_bits % BITS_PER_LONG) {
+		words[i] = (1UL << (nr_bits % BITS_PER_LONG)) - 1;
+	}
+}
+
+void hbitmap_init(struct hbitmap *hb, unsigned long nr_bits, bool set)
+{
+	unsigned long nr = nr_bits;
+
+	hb->nr_bits = nr_bits;
+	hb->nr_levels = 0;
+
+	do {
+		unsigned long nr_words = __nr_words(nr);
+
+		assert(hb->nr_levels < HBITMAP_MAX_LEVELS);
+		hb->words[hb->nr_levels] = calloc(nr_words ? nr_words : 1, sizeof(unsigned long));
+		if (set) __fill_words(hb->words[hb->nr_levels], nr);
+
+		hb->nr_levels++;
+		nr = nr_words;
+	} while (nr > 1);
+}
+
+void hbitmap_exit(struct hbitmap *hb)
+{
+	for (unsigned int i = 0; i < hb->nr_levels; i++) {
+		free(hb->words[i]);
+		hb->words[i] = NULL;
+	}
+	hb->nr_levels = 0;
+}
+
+void hbitmap_set(struct hbitmap *hb, unsigned long bit)
+{
+	assert(bit < hb->nr_bits);
+
+	for (unsigned int level = 0; level < hb->nr_levels; level++) {
+		unsigned long *word = hb->words[level] + bit / BITS_PER_LONG;
+		unsigned long old = *word;
+
+		*word |= 1UL << (bit % BITS_PER_LONG);
+
+		/* The upper levels already know this word is non-empty */
+		if (old) break;
+		bit /= BITS_PER_LONG;
+	}
+}
+
+void hbitmap_clear(struct hbitmap *hb, unsigned long bit)
+{
+	assert(bit < hb->nr_bits);
+
+	for (unsigned int level = 0; level < hb->nr_levels; level++) {
+		unsigned long *word = hb->words[level] + bit / BITS_PER_LONG;
+
+		*word &= ~(1UL << (bit % BITS_PER_LONG));
+
+		/* Still has some bits set, so the upper levels stay the same */
+		if (*word) break;
+		bit /= BITS_PER_LONG;
+	}
+}
+
+unsigned long hbitmap_first(struct hbitmap *hb)
+{
+	unsigned long index = 0;
+
+	if (!hb->words[hb->nr_levels - 1][0]) return HBITMAP_NONE;
+
+	for (int level = hb->nr_levels - 1; level >= 0; level--) {
+		index = index * BITS_PER_LONG + __builtin_ctzl(hb->words[level][index]);
+	}
+	return index;
+}
+
+unsigned long hbitmap_first_block(struct hbitmap *hb, unsigned int order)
+{
+	unsigned long nr_words = __nr_words(hb->nr_bits);
+	unsigned long *words = hb->words[0];
+
+	if ((1UL << order) < BITS_PER_LONG) {
+		unsigned long width = 1UL << order;
+		unsigned long mask = (1UL << width) - 1;
+
+		for (unsigned long i = 0; i < nr_words; i++) {
+			if (!words[i]) continue;
+			for (unsigned long off = 0; off < BITS_PER_LONG; off += width) {
+				if (((words[i] >> off) & mask) == mask) {
+					return i * BITS_PER_LONG + off;
+				}
+			}
+		}
+		return HBITMAP_NONE;
+	}
+
+	/* The block spans whole words which all have to be full */
+	for (unsigned long i = 0; i + (1UL << order) / BITS_PER_LONG <= nr_words;
+			i += (1UL << order) / BITS_PER_LONG) {
+		unsigned long j;
+
+		for (j = 0; j < (1UL << order) / BITS_PER_LONG; j++) {
+			if (words[i + j] != ~0UL) break;
+		}
+		if (j == (1UL << order) / BITS_PER_LONG) return i * BITS_PER_LONG;
+	}
+	return HBITMAP_NONE;
+}
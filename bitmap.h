@@ -0,0 +1,56 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#include "types.h"
+
+#define BITS_PER_LONG		(sizeof(unsigned long) * 8)
+#define HBITMAP_MAX_LEVELS	8
+#define HBITMAP_NONE		(~0UL)
+
+/**
+ * Hierarchical bitmap. Level 0 holds one bit per item. A bit in level n+1
+ * is set iff the corresponding word in level n has any bit set, so the
+ * lowest set bit is found with one find-first-set per level.
+ */
+struct hbitmap {
+	unsigned long nr_bits;
+	unsigned int nr_levels;
+	unsigned long *words[HBITMAP_MAX_LEVELS];
+};
+
+void hbitmap_init(struct hbitmap *hb, unsigned long nr_bits, bool set);
+void hbitmap_exit(struct hbitmap *hb);
+
+void hbitmap_set(struct hbitmap *hb, unsigned long bit);
+void hbitmap_clear(struct hbitmap *hb, unsigned long bit);
+
+static inline bool hbitmap_test(struct hbitmap *hb, unsigned long bit)
+{
+	return (hb->words[0][bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1;
+}
+
+/* Return the lowest set bit, or HBITMAP_NONE if the bitmap is empty */
+unsigned long hbitmap_first(struct hbitmap *hb);
+
+/**
+ * Return the lowest bit of the first run of 1 << @order set bits that starts
+ * at a multiple of 1 << @order, or HBITMAP_NONE if there is no such run.
+ */
+unsigned long hbitmap_first_block(struct hbitmap *hb, unsigned int order);
+
+#endif
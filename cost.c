@@ -0,0 +1,75 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "stats.h"
+#include "cost.h"
+
+unsigned long cost_cycles[NR_COST_ITEMS] = {
+#define __COST_DEFAULT(name, cycles) [COST_##name] = cycles,
+	COST_ITEMS(__COST_DEFAULT)
+#undef __COST_DEFAULT
+};
+
+static const char * const cost_names[NR_COST_ITEMS] = {
+#define __COST_NAME(name, cycles) [COST_##name] = #name,
+	COST_ITEMS(__COST_NAME)
+#undef __COST_NAME
+};
+
+/**
+ * cost_parse_config()
+ *
+ * DESCRIPTION
+ *   Parse the cost model given as "item=cycles[,item=cycles...]". The items
+ *   not given keep their defaults. See cost.h
+ *
+ * RETURN
+ *   @true if @str is valid
+ *   @false otherwise
+ */
+bool cost_parse_config(const char *str)
+{
+	while (*str) {
+		const char *eq = strchr(str, '=');
+		unsigned int i;
+		char *end;
+
+		if (!eq) return false;
+
+		for (i = 0; i < NR_COST_ITEMS; i++) {
+			if (strlen(cost_names[i]) == eq - str &&
+					strncmp(str, cost_names[i], eq - str) == 0) break;
+		}
+		if (i == NR_COST_ITEMS) return false;
+
+		cost_cycles[i] = strtoul(eq + 1, &end, 0);
+		if (end == eq + 1 || (*end != ',' && *end != '\0')) return false;
+
+		str = *end ? end + 1 : end;
+	}
+	return true;
+}
+
+void cost_print_config(FILE *out)
+{
+	for (unsigned int i = 0; i < NR_COST_ITEMS; i++) {
+		fprintf(out, "%s%s=%lu", i ? "," : "", cost_names[i], cost_cycles[i]);
+	}
+}
@@ -0,0 +1,66 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __COST_H__
+#define __COST_H__
+
+#include <stdio.h>
+
+#include "types.h"
+#include "stats.h"
+
+/**
+ * Cost model of the address translation
+ *
+ * Each step of the translation and of the handling of its faults takes the
+ * cycles set for it below, which are charged to the cycles counter of the
+ * process and the system as the step is simulated, and the accesses are
+ * counted in accesses. So cycles / accesses is the average memory access
+ * time spent on the translation, which tells how much a change of the TLB
+ * or the page table saves.
+ *
+ *   tlb_hit:  Looking up the TLB, whether it hits or not
+ *   walk:     Reading a level of the page table on a TLB miss
+ *   fault:    Entering and leaving the fault handler
+ *   cow:      Copying a page for a copy-on-write fault, on top of the fault
+ *   swapin:   Reading a page back from the swap, on top of the fault
+ *   flush:    Flushing a TLB, or interrupting a CPU to shoot its entries down
+ */
+#define COST_ITEMS(X)		\
+	X(tlb_hit,	1)	\
+	X(walk,		30)	\
+	X(fault,	1000)	\
+	X(cow,		2000)	\
+	X(swapin,	100000)	\
+	X(flush,	500)
+
+enum cost_item {
+#define __COST_ENUM(name, cycles) COST_##name,
+	COST_ITEMS(__COST_ENUM)
+#undef __COST_ENUM
+	NR_COST_ITEMS,
+};
+
+extern unsigned long cost_cycles[NR_COST_ITEMS];
+
+static inline void charge_cycles(enum cost_item item, unsigned long nr)
+{
+	count_events(STAT_cycles, cost_cycles[item] * nr);
+}
+
+bool cost_parse_config(const char *str);
+void cost_print_config(FILE *out);
+
+#endif
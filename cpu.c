@@ -0,0 +1,123 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "tlb.h"
+#include "cpu.h"
+#include "cost.h"
+
+extern __sim struct asid_allocator asids;
+
+void switch_mm(struct cpu *cpu, struct process *proc)
+{
+	struct cpu *c;
+
+	if (!asid_switch(&asids, proc)) {
+		/* Start over, keeping the ASIDs that are in use on the CPUs */
+		asid_rollover(&asids);
+		for_each_cpu(c) {
+			tlb_flush(&c->tlb);
+			charge_cycles(COST_flush, 1);
+			if (!c->curr || c->curr == proc) continue;
+
+			asid_reserve(&asids, c->curr);
+			c->curr->cpumask = cpumask_of(c);
+		}
+		if (!asid_switch(&asids, proc)) {
+			assert(!"No ASID left for the CPUs");
+		}
+	}
+	proc->cpumask |= cpumask_of(cpu);
+}
+
+void mmu_gather_init(struct mmu_gather *g, struct process *proc)
+{
+	g->proc = proc;
+	g->nr_vpns = 0;
+	g->flush_asid = false;
+	g->wrprotect = false;
+}
+
+void mmu_gather_vpn(struct mmu_gather *g, vpn_t vpn)
+{
+	if (g->flush_asid) return;
+
+	if (g->nr_vpns == MMU_GATHER_BATCH) {
+		g->flush_asid = true;
+		return;
+	}
+	g->vpns[g->nr_vpns++] = vpn;
+}
+
+/**
+ * mmu_gather_finish()
+ *
+ * DESCRIPTION
+ *   Shoot down the gathered changes on the remote CPUs in the cpumask of the
+ *   process. Each of them takes one shootdown for the whole batch. A CPU
+ *   that had all entries of the process flushed, and does not run it, is
+ *   dropped from the cpumask.
+ */
+void mmu_gather_finish(struct mmu_gather *g)
+{
+	struct process *proc = g->proc;
+	struct cpu *cpu;
+	unsigned long mask = proc->cpumask & ~cpumask_of(this_cpu);
+
+	if (!g->nr_vpns && !g->flush_asid && !g->wrprotect) return;
+
+	/* Entries of a past generation are flushed already */
+	if (proc->asid_generation != asids.generation) return;
+
+	for_each_cpu_in(cpu, mask) {
+		unsigned int nr_flushed = 0;
+
+		count_event(STAT_tlb_shootdowns);
+		charge_cycles(COST_flush, 1);
+
+		if (g->flush_asid) {
+			nr_flushed = tlb_flush_asid(&cpu->tlb, proc->asid);
+			if (cpu->curr != proc) proc->cpumask &= ~cpumask_of(cpu);
+		} else {
+			for (unsigned int i = 0; i < g->nr_vpns; i++) {
+				nr_flushed += tlb_flush_vpn(&cpu->tlb, proc->asid, g->vpns[i]);
+			}
+		}
+		if (g->wrprotect) {
+			tlb_wrprotect_asid(&cpu->tlb, proc->asid);
+		}
+		count_events(STAT_shootdown_entries, nr_flushed);
+	}
+}
+
+void tlb_shootdown_vpn(struct process *proc, vpn_t vpn)
+{
+	struct mmu_gather gather;
+
+	/* Entries of a past generation are flushed already */
+	if (proc->asid_generation != asids.generation) return;
+
+	if (proc->cpumask & cpumask_of(this_cpu)) {
+		tlb_flush_vpn(&this_cpu->tlb, proc->asid, vpn);
+	}
+	mmu_gather_init(&gather, proc);
+	mmu_gather_vpn(&gather, vpn);
+	mmu_gather_finish(&gather);
+}
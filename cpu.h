@@ -0,0 +1,109 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include "types.h"
+#include "list_head.h"
+#include "bitmap.h"
+#include "vm.h"
+#include "tlb.h"
+
+/**
+ * Simulated CPUs. Each of them runs a process through its own PTBR and TLB,
+ * and the commands run on @this_cpu, which the cpu command switches. A CPU
+ * is idle with no @curr when there is no process left to run on it.
+ */
+#define MAX_CPUS	BITS_PER_LONG
+
+struct cpu {
+	unsigned int id;
+
+	struct process *curr;		/* Read through @current */
+	struct pagetable *pt_base;	/* Read through @ptbr */
+	struct tlb tlb;
+};
+
+extern __sim struct cpu cpus[MAX_CPUS];
+extern unsigned int nr_cpus;
+extern __sim struct cpu *this_cpu;
+
+/* The process running on, and the page table base register of, @this_cpu */
+#define current		(this_cpu->curr)
+#define ptbr		(this_cpu->pt_base)
+
+#define for_each_cpu(cpu) \
+	for ((cpu) = cpus; (cpu) < cpus + nr_cpus; (cpu)++)
+
+/* Iterate the CPUs in @mask, a bitmap of CPU ids */
+#define for_each_cpu_in(cpu, mask) \
+	for_each_cpu(cpu) if (!(((mask) >> (cpu)->id) & 1)) {} else
+
+static inline unsigned long cpumask_of(struct cpu *cpu)
+{
+	return 1UL << cpu->id;
+}
+
+/**
+ * Load the address space of @proc on @cpu. It gets an ASID of the current
+ * generation, and @cpu is added to the CPUs that may cache its entries.
+ */
+void switch_mm(struct cpu *cpu, struct process *proc);
+
+/**
+ * TLB shootdown batch
+ *
+ * As mmu_gather of Linux does, the changes to the page table of @proc are
+ * gathered while the page table is modified, and each remote CPU that may
+ * cache its entries is interrupted once at mmu_gather_finish() to flush
+ * them together. The local TLB is still invalidated by the caller.
+ * Too many VPNs for the batch turn it into a flush of the whole ASID.
+ */
+#define MMU_GATHER_BATCH	32
+
+struct mmu_gather {
+	struct process *proc;
+
+	unsigned int nr_vpns;
+	vpn_t vpns[MMU_GATHER_BATCH];
+	bool flush_asid;	/* Flush all entries of @proc */
+	bool wrprotect;		/* Drop the write permission of all of them */
+};
+
+void mmu_gather_init(struct mmu_gather *g, struct process *proc);
+
+/* @vpn got unmapped or remapped */
+void mmu_gather_vpn(struct mmu_gather *g, vpn_t vpn);
+
+static inline void mmu_gather_flush_asid(struct mmu_gather *g)
+{
+	g->flush_asid = true;
+}
+
+static inline void mmu_gather_wrprotect(struct mmu_gather *g)
+{
+	g->wrprotect = true;
+}
+
+void mmu_gather_finish(struct mmu_gather *g);
+
+/**
+ * Invalidate the entries of @vpn of @proc in all TLBs, the local one
+ * included. Only the CPUs in the cpumask of @proc are interrupted.
+ */
+void tlb_shootdown_vpn(struct process *proc, vpn_t vpn);
+
+#endif
@@ -0,0 +1,213 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <assert.h>
+
+#include "types.h"
+#include "bitmap.h"
+#include "numa.h"
+#include "frame.h"
+#include "ksm.h"
+
+extern __sim unsigned int *mapcounts;
+
+/**
+ * The frames of each node, where a bit is set for each frame with no mapping
+ */
+struct frame_node {
+	unsigned int base;
+	unsigned int nr_frames;
+	unsigned int nr_free;
+	struct hbitmap free_frames;
+};
+
+static __sim struct frame_node nodes[MAX_NUMA_NODES];
+static __sim unsigned int nr_frame_nodes;
+
+static __sim unsigned int nr_free;
+static __sim unsigned int nr_frames_total;
+static __sim unsigned int nr_peak;
+
+void frame_init(unsigned int nr_frames, unsigned int nr_nodes, unsigned int align)
+{
+	nr_frame_nodes = nr_nodes;
+	for (unsigned int i = 0; i < nr_nodes; i++) {
+		nodes[i].base = (unsigned long)nr_frames * i / nr_nodes / align * align;
+	}
+	for (unsigned int i = 0; i < nr_nodes; i++) {
+		struct frame_node *node = nodes + i;
+		unsigned int end = i + 1 < nr_nodes ? nodes[i + 1].base : nr_frames;
+
+		node->nr_frames = node->nr_free = end - node->base;
+		hbitmap_init(&node->free_frames, node->nr_frames, true);
+	}
+	nr_free = nr_frames_total = nr_frames;
+	nr_peak = 0;
+}
+
+void frame_exit(void)
+{
+	for (unsigned int i = 0; i < nr_frame_nodes; i++) {
+		hbitmap_exit(&nodes[i].free_frames);
+	}
+	nr_frame_nodes = 0;
+	nr_free = 0;
+}
+
+unsigned int frame_node(unsigned int pfn)
+{
+	unsigned int i = nr_frame_nodes - 1;
+
+	while (nodes[i].base > pfn) i--;
+	return i;
+}
+
+static void __take_frame(struct frame_node *node, unsigned long pfn)
+{
+	assert(!mapcounts[pfn]);
+	mapcounts[pfn] = 1;
+	hbitmap_clear(&node->free_frames, pfn - node->base);
+	node->nr_free--;
+	nr_free--;
+	if (nr_frames_total - nr_free > nr_peak) {
+		nr_peak = nr_frames_total - nr_free;
+	}
+}
+
+unsigned int frame_alloc_node(unsigned int nid)
+{
+	struct frame_node *node = nodes + nid;
+	unsigned long pfn = hbitmap_first(&node->free_frames);
+
+	if (pfn == HBITMAP_NONE) return -1;
+
+	__take_frame(node, node->base + pfn);
+	return node->base + pfn;
+}
+
+unsigned int frame_alloc_near(unsigned int nid)
+{
+	for (unsigned int i = 0; i < nr_frame_nodes; i++) {
+		unsigned int pfn = frame_alloc_node((nid + i) % nr_frame_nodes);
+
+		if (pfn != -1) return pfn;
+	}
+	return -1;
+}
+
+unsigned int frame_alloc(void)
+{
+	return frame_alloc_near(0);
+}
+
+unsigned int frame_alloc_block_near(unsigned int order, unsigned int nid)
+{
+	for (unsigned int i = 0; i < nr_frame_nodes; i++) {
+		struct frame_node *node = nodes + (nid + i) % nr_frame_nodes;
+		unsigned long base = hbitmap_first_block(&node->free_frames, order);
+
+		if (base == HBITMAP_NONE) continue;
+
+		base += node->base;
+		for (unsigned long pfn = base; pfn < base + (1UL << order); pfn++) {
+			__take_frame(node, pfn);
+		}
+		return base;
+	}
+	return -1;
+}
+
+unsigned int frame_alloc_block(unsigned int order)
+{
+	return frame_alloc_block_near(order, 0);
+}
+
+void frame_get(unsigned int pfn)
+{
+	assert(mapcounts[pfn]);
+	mapcounts[pfn]++;
+}
+
+void frame_put(unsigned int pfn)
+{
+	struct frame_node *node;
+
+	assert(mapcounts[pfn]);
+	if (--mapcounts[pfn] || frame_is_zero(pfn)) return;
+
+	/* The next one in the frame fills it anew */
+	page_tags[pfn] = 0;
+	node = nodes + frame_node(pfn);
+	hbitmap_set(&node->free_frames, pfn - node->base);
+	node->nr_free++;
+	nr_free++;
+}
+
+unsigned int frame_zero(void)
+{
+	mapcounts[nr_frames_total]++;
+	return nr_frames_total;
+}
+
+bool frame_is_zero(unsigned int pfn)
+{
+	return pfn == nr_frames_total;
+}
+
+unsigned int nr_free_frames(void)
+{
+	return nr_free;
+}
+
+unsigned int nr_free_frames_node(unsigned int nid)
+{
+	return nodes[nid].nr_free;
+}
+
+unsigned int nr_peak_frames(void)
+{
+	return nr_peak;
+}
+
+void frame_save(struct snap_writer *w)
+{
+	snap_put(w, nr_peak);
+	snap_write(w, mapcounts, sizeof(*mapcounts) * (nr_frames_total + 1));
+	snap_write(w, page_tags, sizeof(*page_tags) * (nr_frames_total + 1));
+}
+
+bool frame_load(struct snap_reader *r)
+{
+	if (!snap_get(r, nr_peak)) return false;
+	if (!snap_read_copy(r, mapcounts, sizeof(*mapcounts) * (nr_frames_total + 1))) {
+		return false;
+	}
+	if (!snap_read_copy(r, page_tags, sizeof(*page_tags) * (nr_frames_total + 1))) {
+		return false;
+	}
+
+	for (unsigned int pfn = 0; pfn < nr_frames_total; pfn++) {
+		struct frame_node *node;
+
+		/* Free frames have no content */
+		if (!mapcounts[pfn] && page_tags[pfn]) return false;
+		if (!mapcounts[pfn]) continue;
+		node = nodes + frame_node(pfn);
+		hbitmap_clear(&node->free_frames, pfn - node->base);
+		node->nr_free--;
+		nr_free--;
+	}
+	return nr_peak >= nr_frames_total - nr_free && nr_peak <= nr_frames_total;
+}
@@ -0,0 +1,86 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include "types.h"
+#include "snapshot.h"
+
+/**
+ * Physical page frame allocator.
+ *
+ * @mapcounts[] remains the source of truth for how many PTEs map a frame.
+ * The allocator only tracks which frames have no mapping at all.
+ *
+ * The frames are split into @nr_nodes nodes of contiguous frames, each
+ * starting at a multiple of @align so that the blocks of up to @align frames
+ * in a node are aligned in the whole memory as well. Each node has a pool of
+ * free frames of its own, and hands out its free frame with the smallest
+ * PFN. The nodes after a node are tried in turn when it runs out, so
+ * frame_alloc() from node 0 always hands out the smallest free PFN.
+ *
+ * The zero frame follows the @nr_frames frames, and has an entry at the end
+ * of @mapcounts[] too. It backs the pages that are read before they are
+ * written for the first time, and so is never written nor freed.
+ */
+void frame_init(unsigned int nr_frames, unsigned int nr_nodes, unsigned int align);
+void frame_exit(void);
+
+/**
+ * Allocate the free frame with the smallest PFN and account its first
+ * mapping. Return -1 if all frames are mapped.
+ */
+unsigned int frame_alloc(void);
+
+/* Allocate a frame on node @nid only, or on the nodes from @nid on */
+unsigned int frame_alloc_node(unsigned int nid);
+unsigned int frame_alloc_near(unsigned int nid);
+
+/* The node the frame @pfn, other than the zero frame, is on */
+unsigned int frame_node(unsigned int pfn);
+
+/**
+ * Allocate 1 << @order free frames that are contiguous and naturally aligned,
+ * picking the block with the smallest PFN, and account the first mapping of
+ * each. Return the first PFN, or -1 if no such block is free.
+ */
+unsigned int frame_alloc_block(unsigned int order);
+unsigned int frame_alloc_block_near(unsigned int order, unsigned int nid);
+
+/* Add a mapping to @pfn that is already in use */
+void frame_get(unsigned int pfn);
+
+/* Drop a mapping from @pfn. The frame becomes free on the last one */
+void frame_put(unsigned int pfn);
+
+/* Add a mapping to the zero frame, and return its pfn */
+unsigned int frame_zero(void);
+bool frame_is_zero(unsigned int pfn);
+
+unsigned int nr_free_frames(void);
+unsigned int nr_free_frames_node(unsigned int nid);
+
+/* The largest number of frames in use at the same time so far */
+unsigned int nr_peak_frames(void);
+
+/**
+ * Write @mapcounts[] and @page_tags[], including the zero frame, and the peak to a snapshot, and
+ * read them back into the allocator just set up. The free frames follow from the mapcounts.
+ */
+void frame_save(struct snap_writer *w);
+bool frame_load(struct snap_reader *r);
+
+#endif
@@ -0,0 +1,208 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "cpu.h"
+#include "rmap.h"
+#include "ksm.h"
+
+extern unsigned int nr_pageframes;
+extern __sim unsigned int *mapcounts;
+
+/**
+ * Index of the contents seen in a pass, from the digest to the first frame
+ * with it. Open addressing with linear probing, at most half full.
+ */
+struct ksm_slot {
+	unsigned long tag;
+	unsigned int pfn;
+};
+
+static struct ksm_slot *__index_find(struct ksm_slot *index, unsigned long mask,
+		unsigned long tag)
+{
+	unsigned long i = (tag >> 1) & mask;
+
+	while (index[i].tag && index[i].tag != tag) {
+		i = (i + 1) & mask;
+	}
+	return index + i;
+}
+
+static int __compare_items(const void *a, const void *b)
+{
+	const struct rmap_item *x = a, *y = b;
+
+	if (x->proc->pid != y->proc->pid) return x->proc->pid < y->proc->pid ? -1 : 1;
+	if (x->vpn != y->vpn) return x->vpn < y->vpn ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Copy the mappings of @pfn in the order of the pids and the VPNs. The
+ * order of the rmap follows the history of the mappings, and a snapshot
+ * does not keep it, whereas the walks to them fill the paging-structure
+ * caches of the processes and count for the current one.
+ */
+static struct rmap_item *__sorted_items(unsigned int pfn, unsigned int *nr)
+{
+	const struct rmap_item *items = rmap_items(pfn, nr);
+	struct rmap_item *sorted = malloc(sizeof(*sorted) * (*nr ? : 1));
+
+	for (unsigned int i = 0; i < *nr; i++) {
+		sorted[i] = items[i];
+	}
+	qsort(sorted, *nr, sizeof(*sorted), __compare_items);
+	return sorted;
+}
+
+/* The PTE of @item, which the rmap tells is there */
+static struct pte *__item_pte(const struct rmap_item *item)
+{
+	struct pt_cursor cursor;
+	struct pte *pte;
+
+	pt_cursor_init(&cursor, &item->proc->pagetable);
+	pte = pt_cursor_lookup(&cursor, item->vpn);
+	assert(pte);
+	return pte;
+}
+
+/**
+ * Take away the write permissions of the mappings of @pfn, which begins to
+ * be shared. The private rw is left as it is, so a writable page gets
+ * copied on the next write fault. A directory shared by a lazy fork has it
+ * done through the first process sharing it.
+ */
+static void __wrprotect_frame(unsigned int pfn)
+{
+	struct rmap_item *items;
+	unsigned int nr;
+
+	items = __sorted_items(pfn, &nr);
+	for (unsigned int i = 0; i < nr; i++) {
+		struct pte *pte = __item_pte(items + i);
+
+		if (!pte_valid(pte) || pte_pfn(pte) != pfn) continue;
+		if (!(pte_rw(pte) & ACCESS_WRITE)) continue;
+
+		pte_set_rw(pte, ACCESS_READ);
+		tlb_shootdown_vpn(items[i].proc, items[i].vpn);
+	}
+	free(items);
+}
+
+/**
+ * Move all mappings of @pfn to @stable, which has the same content, as
+ * read-only ones. @pfn becomes free. The TLB entries translating to @pfn
+ * are shot down, so the CPUs agree on @stable.
+ */
+static void __merge_frame(unsigned int pfn, unsigned int stable)
+{
+	struct rmap_item *items;
+	unsigned int nr;
+
+	items = __sorted_items(pfn, &nr);
+	for (unsigned int i = 0; i < nr; i++) {
+		struct pte *pte = __item_pte(items + i);
+
+		if (pte_valid(pte) && pte_pfn(pte) == pfn) {
+			pte_set_pfn(pte, stable);
+			if (pte_rw(pte) & ACCESS_WRITE) pte_set_rw(pte, ACCESS_READ);
+			frame_get(stable);
+			frame_put(pfn);
+		}
+		rmap_add(stable, items[i].proc, items[i].vpn);
+		tlb_shootdown_vpn(items[i].proc, items[i].vpn);
+	}
+	free(items);
+
+	rmap_clear(pfn);
+	assert(!mapcounts[pfn]);
+}
+
+/**
+ * ksm_merge()
+ *
+ * DESCRIPTION
+ *   Scan the frames in use in the order of their PFNs, indexing the first
+ *   frame of each digest, and merge each frame with a digest already in the
+ *   index into that frame. The frames merged into lose the write
+ *   permission to their mappings on the first merge, and are marked with
+ *   PAGE_TAG_MERGED.
+ *
+ * RETURN
+ *   The number of frames merged and freed
+ */
+unsigned int ksm_merge(void)
+{
+	struct ksm_slot *index;
+	unsigned long nr_slots = 2;
+	unsigned int nr_tagged = 0, nr_merged = 0;
+
+	count_event(STAT_ksm_scans);
+
+	for (unsigned int pfn = 0; pfn < nr_pageframes; pfn++) {
+		if (page_tags[pfn]) nr_tagged++;
+	}
+	if (nr_tagged < 2) return 0;
+
+	while (nr_slots < (unsigned long)nr_tagged * 2) nr_slots <<= 1;
+	index = calloc(nr_slots, sizeof(*index));
+
+	for (unsigned int pfn = 0; pfn < nr_pageframes; pfn++) {
+		unsigned long tag = page_tags[pfn] & ~PAGE_TAG_MERGED;
+		struct ksm_slot *slot;
+
+		if (!tag) continue;
+		assert(mapcounts[pfn]);
+
+		slot = __index_find(index, nr_slots - 1, tag);
+		if (!slot->tag) {
+			*slot = (struct ksm_slot) { .tag = tag, .pfn = pfn };
+			continue;
+		}
+
+		if (!page_merged(slot->pfn)) {
+			__wrprotect_frame(slot->pfn);
+			page_tags[slot->pfn] |= PAGE_TAG_MERGED;
+		}
+		__merge_frame(pfn, slot->pfn);
+		nr_merged++;
+	}
+	free(index);
+
+	count_events(STAT_ksm_merges, nr_merged);
+	return nr_merged;
+}
+
+void ksm_count(unsigned int *nr_shared, unsigned int *nr_sharing)
+{
+	*nr_shared = *nr_sharing = 0;
+
+	for (unsigned int pfn = 0; pfn < nr_pageframes; pfn++) {
+		/* Left alone with a mapping, it saves no frame any longer */
+		if (!page_merged(pfn) || mapcounts[pfn] < 2) continue;
+		(*nr_shared)++;
+		*nr_sharing += mapcounts[pfn];
+	}
+}
@@ -0,0 +1,70 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __KSM_H__
+#define __KSM_H__
+
+#include "types.h"
+
+/**
+ * Deduplication of the frames of identical content, as KSM of Linux does.
+ *
+ * A page allocated with a content tag, as in "alloc 10 r tag=libc", holds
+ * the content the tag names, and each page of a tagged range holds the page
+ * of the content at its offset from the start of the range. So the pages
+ * at the same offset of the ranges of a tag are identical, whichever
+ * process allocates them.
+ *
+ * @page_tags[] keeps the digest of the content of each frame in use, which
+ * ksm_merge() compares instead of the contents, or 0 for a content of its
+ * own. A frame loses its tag on the first write to it, or when it is freed.
+ *
+ * ksm_merge() collapses the frames with the same digest into the one with
+ * the smallest PFN, marked by PAGE_TAG_MERGED, and frees the rest. All of
+ * their mappings become read-only mappings of it, which are copied on write
+ * as the pages shared by fork are.
+ */
+#define PAGE_TAG_MERGED		1UL
+
+/* Accesses between the merge passes of -K by default */
+#define KSM_INTERVAL		1000
+
+extern __sim unsigned long *page_tags;
+
+/* The digest of the page at @offset into the content of @tag */
+static inline unsigned long page_tag(unsigned long tag, unsigned long offset)
+{
+	unsigned long x = tag + offset * 0x9e3779b97f4a7c15UL;
+
+	/* splitmix64 finalizer, leaving the low bit for PAGE_TAG_MERGED */
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+	x ^= x >> 31;
+	return (x | 2) & ~PAGE_TAG_MERGED;
+}
+
+/* Whether other frames have been merged into @pfn */
+static inline bool page_merged(unsigned int pfn)
+{
+	return page_tags[pfn] & PAGE_TAG_MERGED;
+}
+
+/* Merge the frames in use of identical content. Return the frames freed */
+unsigned int ksm_merge(void);
+
+/* The frames merged into that are still shared, and the mappings of them */
+void ksm_count(unsigned int *nr_shared, unsigned int *nr_sharing);
+
+#endif
@@ -0,0 +1,316 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "output.h"
+#include "mrc.h"
+
+#define MRC_INITIAL_PAGES	64	/* A power of two */
+
+struct mrc_process {
+	unsigned int pid;
+	struct mrc_tracker tracker;
+};
+
+static __sim struct mrc_tracker sys_tracker;
+
+static __sim struct mrc_process *procs;
+static __sim unsigned int nr_procs;
+static __sim struct mrc_process *last_proc;
+
+/* Working set sizes of the windows of the system so far */
+static __sim unsigned long window;
+static __sim unsigned long window_start;
+static __sim unsigned long window_pages;
+static __sim unsigned long *wss;
+static __sim unsigned long nr_wss;
+
+static inline unsigned long __hash(unsigned int pid, uint64_t key, unsigned long max_pages)
+{
+	key ^= (uint64_t)pid * 0xC2B2AE3D27D4EB4FULL;
+	return (unsigned long)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (max_pages - 1);
+}
+
+static void __tracker_init(struct mrc_tracker *mt)
+{
+	*mt = (struct mrc_tracker) {
+		.pages = calloc(MRC_INITIAL_PAGES, sizeof(*mt->pages)),
+		.max_pages = MRC_INITIAL_PAGES,
+		.tree = calloc(MRC_INITIAL_PAGES * 2 + 1, sizeof(*mt->tree)),
+		.nr_slots = MRC_INITIAL_PAGES * 2,
+		.next_slot = 1,
+		.hist = calloc(MRC_INITIAL_PAGES, sizeof(*mt->hist)),
+		.max_distance = MRC_INITIAL_PAGES,
+	};
+}
+
+static void __tracker_exit(struct mrc_tracker *mt)
+{
+	free(mt->pages);
+	free(mt->tree);
+	free(mt->hist);
+	memset(mt, 0, sizeof(*mt));
+}
+
+static void __tree_add(struct mrc_tracker *mt, unsigned long slot, long delta)
+{
+	for (; slot <= mt->nr_slots; slot += slot & -slot) {
+		mt->tree[slot] += delta;
+	}
+}
+
+/* Number of the latest accesses in the slots up to @slot */
+static unsigned long __tree_sum(struct mrc_tracker *mt, unsigned long slot)
+{
+	unsigned long sum = 0;
+
+	for (; slot; slot -= slot & -slot) {
+		sum += mt->tree[slot];
+	}
+	return sum;
+}
+
+static struct mrc_page *__lookup(struct mrc_tracker *mt, unsigned int pid, uint64_t key)
+{
+	unsigned long i = __hash(pid, key, mt->max_pages);
+
+	while (mt->pages[i].key && (mt->pages[i].key != key || mt->pages[i].pid != pid)) {
+		i = (i + 1) & (mt->max_pages - 1);
+	}
+	return mt->pages + i;
+}
+
+static void __grow_pages(struct mrc_tracker *mt)
+{
+	struct mrc_page *pages = mt->pages;
+	unsigned long max_pages = mt->max_pages;
+
+	mt->max_pages *= 2;
+	mt->pages = calloc(mt->max_pages, sizeof(*mt->pages));
+	for (unsigned long i = 0; i < max_pages; i++) {
+		if (pages[i].key) *__lookup(mt, pages[i].pid, pages[i].key) = pages[i];
+	}
+	free(pages);
+}
+
+static int __compare_slot(const void *a, const void *b)
+{
+	const struct mrc_page *pa = *(const struct mrc_page * const *)a;
+	const struct mrc_page *pb = *(const struct mrc_page * const *)b;
+
+	return (pa->slot > pb->slot) - (pa->slot < pb->slot);
+}
+
+/**
+ * __compact()
+ *
+ * DESCRIPTION
+ *   Renumber the slots of the pages from 1 in the order of their last
+ *   accesses when the slots run out, so that the distances stay the same.
+ *   The tree is made twice as large as the pages so that the slots run out
+ *   after as many accesses as there are pages at least.
+ */
+static void __compact(struct mrc_tracker *mt)
+{
+	struct mrc_page **live = malloc(sizeof(*live) * (mt->nr_pages + 1));
+	unsigned long nr = 0;
+
+	for (unsigned long i = 0; i < mt->max_pages; i++) {
+		if (mt->pages[i].key) live[nr++] = mt->pages + i;
+	}
+	qsort(live, nr, sizeof(*live), __compare_slot);
+
+	if (mt->nr_slots < mt->max_pages * 2) {
+		mt->nr_slots = mt->max_pages * 2;
+		free(mt->tree);
+		mt->tree = malloc(sizeof(*mt->tree) * (mt->nr_slots + 1));
+	}
+	memset(mt->tree, 0, sizeof(*mt->tree) * (mt->nr_slots + 1));
+
+	for (unsigned long i = 0; i < nr; i++) {
+		live[i]->slot = i + 1;
+		__tree_add(mt, i + 1, 1);
+	}
+	mt->next_slot = nr + 1;
+	free(live);
+}
+
+static void __count_distance(struct mrc_tracker *mt, unsigned long distance)
+{
+	if (distance >= mt->max_distance) {
+		unsigned long max_distance = mt->max_distance;
+
+		while (distance >= mt->max_distance) mt->max_distance *= 2;
+		mt->hist = realloc(mt->hist, sizeof(*mt->hist) * mt->max_distance);
+		memset(mt->hist + max_distance, 0,
+				sizeof(*mt->hist) * (mt->max_distance - max_distance));
+	}
+	mt->hist[distance]++;
+}
+
+/**
+ * __track()
+ *
+ * DESCRIPTION
+ *   Account an access to the page of @key in @pid. Its reuse distance is the number
+ *   of the pages whose latest accesses follow the last access to it.
+ *
+ * RETURN
+ *   The access number of the last access to the page
+ *   0 if the page is accessed for the first time
+ */
+static unsigned long __track(struct mrc_tracker *mt, unsigned int pid, uint64_t key)
+{
+	struct mrc_page *page;
+	unsigned long last;
+
+	if (mt->next_slot > mt->nr_slots) __compact(mt);
+
+	mt->nr_accesses++;
+	page = __lookup(mt, pid, key);
+	last = page->last;
+
+	if (page->key) {
+		__count_distance(mt, __tree_sum(mt, mt->next_slot - 1) - __tree_sum(mt, page->slot));
+		__tree_add(mt, page->slot, -1);
+	} else {
+		mt->nr_cold++;
+		page->key = key;
+		page->pid = pid;
+		mt->nr_pages++;
+	}
+	page->slot = mt->next_slot++;
+	page->last = mt->nr_accesses;
+	__tree_add(mt, page->slot, 1);
+
+	if (mt->nr_pages * 2 > mt->max_pages) __grow_pages(mt);
+
+	return last;
+}
+
+static struct mrc_tracker *__process_tracker(unsigned int pid)
+{
+	if (last_proc && last_proc->pid == pid) return &last_proc->tracker;
+
+	for (unsigned int i = 0; i < nr_procs; i++) {
+		if (procs[i].pid == pid) {
+			last_proc = procs + i;
+			return &last_proc->tracker;
+		}
+	}
+
+	/* The processes are few, so they are kept in the order of creation */
+	procs = realloc(procs, sizeof(*procs) * (nr_procs + 1));
+	last_proc = procs + nr_procs++;
+	last_proc->pid = pid;
+	__tracker_init(&last_proc->tracker);
+
+	return &last_proc->tracker;
+}
+
+void mrc_init(unsigned long nr_window)
+{
+	__tracker_init(&sys_tracker);
+	window = nr_window;
+	window_start = 1;
+	window_pages = 0;
+}
+
+void mrc_exit(void)
+{
+	__tracker_exit(&sys_tracker);
+	for (unsigned int i = 0; i < nr_procs; i++) {
+		__tracker_exit(&procs[i].tracker);
+	}
+	free(procs);
+	procs = last_proc = NULL;
+	nr_procs = 0;
+
+	free(wss);
+	wss = NULL;
+	nr_wss = 0;
+}
+
+void mrc_access(unsigned int pid, vpn_t vpn)
+{
+	/* Keys are non-zero as 0 tells an unused page */
+	uint64_t key = (uint64_t)vpn + 1;
+
+	/* A VPN can take up to MAX_VPN_BITS bits, so the pid is kept apart */
+	if (__track(&sys_tracker, pid, key) < window_start) window_pages++;
+	__track(__process_tracker(pid), 0, key);
+
+	if (sys_tracker.nr_accesses - window_start + 1 == window) {
+		wss = realloc(wss, sizeof(*wss) * (nr_wss + 1));
+		wss[nr_wss++] = window_pages;
+		window_start = sys_tracker.nr_accesses + 1;
+		window_pages = 0;
+	}
+}
+
+/**
+ * __report()
+ *
+ * DESCRIPTION
+ *   Print the misses of TLBs of the powers of two entries up to the one
+ *   which takes the cold misses only.
+ */
+static void __report(struct mrc_tracker *mt)
+{
+	unsigned long misses = mt->nr_accesses;
+	unsigned long entries = 1;
+
+	out_text("  %10s %12s %8s\n", "entries", "misses", "ratio");
+	for (unsigned long d = 0; ; d++) {
+		if (d == entries) {
+			out_text("  %10lu %12lu %7.2f%%\n", entries, misses,
+					100.0 * misses / mt->nr_accesses);
+			if (misses == mt->nr_cold) break;
+			entries *= 2;
+		}
+		/* The accesses at the distance hit a TLB of more entries */
+		if (d < mt->max_distance) misses -= mt->hist[d];
+	}
+}
+
+void mrc_report(void)
+{
+	if (!sys_tracker.nr_accesses) return;
+
+	out_text("TLB miss ratio curve of %lu accesses to %lu pages\n",
+			sys_tracker.nr_accesses, sys_tracker.nr_pages);
+	__report(&sys_tracker);
+
+	for (unsigned int i = 0; i < nr_procs; i++) {
+		struct mrc_tracker *mt = &procs[i].tracker;
+
+		out_text("pid %u: %lu accesses to %lu pages\n",
+				procs[i].pid, mt->nr_accesses, mt->nr_pages);
+		__report(mt);
+	}
+
+	if (!nr_wss) return;
+	out_text("Working set sizes in windows of %lu accesses:", window);
+	for (unsigned long i = 0; i < nr_wss; i++) {
+		out_text("%s%lu", i % 16 ? " " : "\n  ", wss[i]);
+	}
+	out_text("\n");
+}
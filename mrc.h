@@ -0,0 +1,74 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __MRC_H__
+#define __MRC_H__
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * Miss-ratio curve profiler
+ *
+ * The translations of the accesses are profiled in a single pass for the
+ * misses a fully-associative LRU TLB of any size would take, as Mattson's
+ * stack algorithm does. An access hits in a TLB of N entries if fewer than
+ * N other pages are accessed since the last access to its page, which is
+ * the reuse distance of the access. The distances are counted with a Fenwick
+ * tree over the times of the last access to each page, where only the
+ * latest access to each page is set, so that a distance is the number of
+ * bits set after the last access in O(log n).
+ *
+ * Pages are told apart by the process and the VPN for the whole system, as
+ * the ASIDs do in the TLB, and by the VPN for each process. The TLB flushes
+ * and the set conflicts are not modeled.
+ *
+ * The working set size, the number of distinct pages accessed, is also
+ * sampled in each window of @window accesses to the system. A process forked
+ * with the pid of an exited one takes over its profile.
+ */
+struct mrc_page {
+	uint64_t key;		/* VPN + 1, 0 if unused */
+	unsigned int pid;	/* Of the system tracker, 0 in the others */
+	unsigned long slot;	/* Time in the tree of the last access */
+	unsigned long last;	/* Access number of the last access */
+};
+
+struct mrc_tracker {
+	struct mrc_page *pages;	/* Open-addressed by the key */
+	unsigned long nr_pages;
+	unsigned long max_pages;
+
+	unsigned long *tree;	/* Fenwick tree over [1, @nr_slots] */
+	unsigned long nr_slots;
+	unsigned long next_slot;
+
+	unsigned long *hist;	/* Accesses at each reuse distance */
+	unsigned long max_distance;
+
+	unsigned long nr_accesses;
+	unsigned long nr_cold;	/* First accesses, which miss at any size */
+};
+
+void mrc_init(unsigned long window);
+void mrc_exit(void);
+
+/* Profile an access to @vpn of the process @pid */
+void mrc_access(unsigned int pid, vpn_t vpn);
+
+/* Print the curves of the system and each process, and the working sets */
+void mrc_report(void);
+
+#endif
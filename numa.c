@@ -0,0 +1,116 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "cpu.h"
+#include "numa.h"
+
+unsigned int nr_nodes = 1;
+bool numa_migrate = false;
+struct mempolicy default_mempolicy = { .mode = MPOL_LOCAL, };
+
+static const char * const mode_names[NR_MPOL_MODES] = {
+	[MPOL_LOCAL]		= "local",
+	[MPOL_INTERLEAVE]	= "interleave",
+	[MPOL_PREFERRED]	= "preferred",
+};
+
+unsigned int cpu_node(unsigned int cpu)
+{
+	return cpu * nr_nodes / nr_cpus;
+}
+
+unsigned int mempolicy_node(struct mempolicy *pol, unsigned int local)
+{
+	unsigned int node;
+
+	switch (pol->mode) {
+	case MPOL_INTERLEAVE:
+		node = pol->next;
+		pol->next = (node + 1) % nr_nodes;
+		return node;
+	case MPOL_PREFERRED:
+		return pol->node;
+	default:
+		return local;
+	}
+}
+
+/* Parse @str as "local", "interleave", or "preferred=N" for a node N of @nodes */
+static bool __parse_policy(const char *str, struct mempolicy *pol, unsigned int nodes)
+{
+	for (unsigned int i = 0; i < NR_MPOL_MODES; i++) {
+		size_t len = strlen(mode_names[i]);
+		char *end;
+
+		if (strncmp(str, mode_names[i], len)) continue;
+
+		*pol = (struct mempolicy) { .mode = i, };
+		if (i != MPOL_PREFERRED) return str[len] == '\0';
+
+		if (str[len] != '=') return false;
+		pol->node = strtoul(str + len + 1, &end, 0);
+		return end != str + len + 1 && *end == '\0' && pol->node < nodes;
+	}
+	return false;
+}
+
+const char *mempolicy_name(const struct mempolicy *pol)
+{
+	return mode_names[pol->mode];
+}
+
+/**
+ * numa_parse_config()
+ *
+ * DESCRIPTION
+ *   Parse the NUMA configuration given as "nodes[:policy][:migrate]", where
+ *   the policy is the default one of the processes as "local", "interleave",
+ *   or "preferred=N". It defaults to local.
+ *
+ * RETURN
+ *   @true if @str is valid
+ *   @false otherwise
+ */
+bool numa_parse_config(const char *str, unsigned int *nodes, struct mempolicy *pol,
+		bool *migrate)
+{
+	char buf[32];
+	char *end;
+
+	*nodes = strtoul(str, &end, 0);
+	if (!*nodes || *nodes > MAX_NUMA_NODES) return false;
+
+	*pol = (struct mempolicy) { .mode = MPOL_LOCAL, };
+	*migrate = false;
+	if (*end == '\0') return true;
+	if (*end != ':' || strlen(end + 1) >= sizeof(buf)) return false;
+	strcpy(buf, end + 1);
+
+	end = strchr(buf, ':');
+	if (end) {
+		*end = '\0';
+		if (strcmp(end + 1, "migrate")) return false;
+		*migrate = true;
+	} else if (strcmp(buf, "migrate") == 0) {
+		*migrate = true;
+		return true;
+	}
+	return __parse_policy(buf, pol, *nodes);
+}
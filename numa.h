@@ -0,0 +1,73 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include "types.h"
+
+/**
+ * Non-uniform memory access
+ *
+ * The frames are split into @nr_nodes nodes of about the same number of
+ * contiguous frames, each with a free pool of its own (see frame.h). The
+ * CPUs are spread over the nodes in the order of their ids, as the sockets
+ * are, and the frames on the node of a CPU are local to it.
+ *
+ * Each process allocates its frames following its memory policy, which a
+ * fork inherits. The frames come from the node the policy picks, or from
+ * the nodes following it when the node runs out:
+ *
+ *   local:       The node of the CPU allocating the frame
+ *   interleave:  The nodes in turn from an allocation to another
+ *   preferred=N: Node N
+ *
+ * With @numa_migrate, a page of a single mapping is moved to the node of the
+ * CPU that misses in the TLB for it, as the hinting faults of the automatic
+ * balancing would do.
+ */
+#define MAX_NUMA_NODES		8
+
+enum mempolicy_mode {
+	MPOL_LOCAL = 0,
+	MPOL_INTERLEAVE,
+	MPOL_PREFERRED,
+	NR_MPOL_MODES,
+};
+
+struct mempolicy {
+	unsigned char mode;
+	unsigned char node;	/* Preferred node */
+	unsigned char next;	/* Node to interleave next */
+};
+
+extern unsigned int nr_nodes;
+extern bool numa_migrate;
+
+/* The policy of the init process, which the others inherit */
+extern struct mempolicy default_mempolicy;
+
+/* The node of the CPU @cpu */
+unsigned int cpu_node(unsigned int cpu);
+
+/* The node to allocate a frame from with @pol on a CPU on @local */
+unsigned int mempolicy_node(struct mempolicy *pol, unsigned int local);
+
+const char *mempolicy_name(const struct mempolicy *pol);
+
+bool numa_parse_config(const char *str, unsigned int *nodes, struct mempolicy *pol,
+		bool *migrate);
+
+#endif
@@ -0,0 +1,200 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "output.h"
+
+#define OUTPUT_BUFFER_SIZE	(64 * 1024)
+
+enum output_mode output_mode = OUTPUT_TEXT;
+bool output_tlb = false;
+
+static const char * const output_mode_names[NR_OUTPUT_MODES] = {
+	[OUTPUT_TEXT] = "text",
+	[OUTPUT_CSV] = "csv",
+	[OUTPUT_COUNTS] = "counts",
+};
+
+static __sim FILE *out;
+static __sim FILE *msg;
+
+/* Whether the CSV stream is at the start of a line, to comment out the text */
+static __sim bool line_start;
+
+bool output_parse_mode(const char *str, enum output_mode *mode)
+{
+	for (unsigned int i = 0; i < NR_OUTPUT_MODES; i++) {
+		if (!strcmp(str, output_mode_names[i])) {
+			*mode = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * output_init()
+ *
+ * DESCRIPTION
+ *   Set up the streams of this simulation. The CSV stream starts with the
+ *   header of the records.
+ */
+void output_init(FILE *out_stream, FILE *msg_stream)
+{
+	out = out_stream;
+	msg = msg_stream;
+	line_start = true;
+
+	if (out == stderr) setvbuf(out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+	if (output_mode == OUTPUT_CSV) fputs("op,vpn,pfn,flag\n", out);
+}
+
+void output_flush(void)
+{
+	fflush(out);
+}
+
+void out_access(vpn_t vpn, unsigned int pfn, bool from_tlb)
+{
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		if (output_tlb) fprintf(out, "%c |", from_tlb ? 'o' : 'x');
+		fprintf(out, " %3lu --> %-3u\n", vpn, pfn);
+		break;
+	case OUTPUT_CSV:
+		fprintf(out, "access,%lu,%u,%s\n", vpn, pfn,
+				output_tlb ? (from_tlb ? "o" : "x") : "");
+		break;
+	default:
+		break;
+	}
+}
+
+/* @nr_pages is 0 for a small page */
+void out_alloc(vpn_t vpn, unsigned int pfn, unsigned int nr_pages)
+{
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		if (nr_pages) {
+			fprintf(out, "alloc %3lu --> %-3u (huge %u)\n", vpn, pfn, nr_pages);
+		} else {
+			fprintf(out, "alloc %3lu --> %-3u\n", vpn, pfn);
+		}
+		break;
+	case OUTPUT_CSV:
+		fprintf(out, "alloc,%lu,%u,%s\n", vpn, pfn, nr_pages ? "huge" : "");
+		break;
+	default:
+		break;
+	}
+}
+
+/* @pfn is the swap slot if @swapped */
+void out_free(vpn_t vpn, unsigned int pfn, bool swapped)
+{
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		fprintf(out, "free %lu (%s %u)\n", vpn, swapped ? "swap" : "pfn", pfn);
+		break;
+	case OUTPUT_CSV:
+		fprintf(out, "free,%lu,%u,%s\n", vpn, pfn, swapped ? "swap" : "");
+		break;
+	default:
+		break;
+	}
+}
+
+void out_reserve(vpn_t vpn)
+{
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		fprintf(out, "alloc %3lu (lazy)\n", vpn);
+		break;
+	case OUTPUT_CSV:
+		fprintf(out, "alloc,%lu,,lazy\n", vpn);
+		break;
+	default:
+		break;
+	}
+}
+
+void out_unreserve(vpn_t vpn)
+{
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		fprintf(out, "free %lu (lazy)\n", vpn);
+		break;
+	case OUTPUT_CSV:
+		fprintf(out, "free,%lu,,lazy\n", vpn);
+		break;
+	default:
+		break;
+	}
+}
+
+static void __comment(const char *str)
+{
+	for (; *str; str++) {
+		if (line_start) fputs(*str == '\n' ? "#" : "# ", out);
+		fputc(*str, out);
+		line_start = *str == '\n';
+	}
+}
+
+void out_text(const char *fmt, ...)
+{
+	va_list args;
+	char buf[256], *str = buf;
+	int len;
+
+	va_start(args, fmt);
+	if (output_mode != OUTPUT_CSV) {
+		vfprintf(out, fmt, args);
+		va_end(args);
+		return;
+	}
+	len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (len < 0) return;
+
+	/* Format again into a buffer large enough */
+	if (len >= sizeof(buf)) {
+		str = malloc(len + 1);
+		va_start(args, fmt);
+		vsnprintf(str, len + 1, fmt, args);
+		va_end(args);
+	}
+	__comment(str);
+	if (str != buf) free(str);
+}
+
+void out_msg(const char *fmt, ...)
+{
+	va_list args;
+
+	fflush(out);
+
+	va_start(args, fmt);
+	vfprintf(msg, fmt, args);
+	va_end(args);
+}
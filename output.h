@@ -0,0 +1,63 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdio.h>
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * Results of the simulation. Each access, allocation and deallocation
+ * makes a record, and the rest (the snapshots of show, frames, tlb and
+ * stats, and the errors) is text. They go to the result stream, whereas the
+ * prompts and messages for the user go to the message stream.
+ *
+ * The result stream is fully buffered, and flushed before anything goes to
+ * the message stream. Since the message stream is flushed only when written
+ * to, the two get to their files in the same order as if the results were
+ * not buffered at all.
+ */
+enum output_mode {
+	OUTPUT_TEXT = 0,	/* Records as text lines. The default */
+	OUTPUT_CSV,		/* Records as CSV rows, and the text as # comments */
+	OUTPUT_COUNTS,		/* No records but the text */
+	NR_OUTPUT_MODES,
+};
+
+/* Mode shared by all simulations, and whether accesses tell TLB hits */
+extern enum output_mode output_mode;
+extern bool output_tlb;
+
+bool output_parse_mode(const char *str, enum output_mode *mode);
+
+/* Print the results of this simulation to @out, and the messages to @msg */
+void output_init(FILE *out, FILE *msg);
+void output_flush(void);
+
+void out_access(vpn_t vpn, unsigned int pfn, bool from_tlb);
+void out_alloc(vpn_t vpn, unsigned int pfn, unsigned int nr_pages);
+void out_free(vpn_t vpn, unsigned int pfn, bool swapped);
+
+/* Lazy allocations with no frame yet */
+void out_reserve(vpn_t vpn);
+void out_unreserve(vpn_t vpn);
+
+void out_text(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void out_msg(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -15,47 +15,79 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 
 #include "types.h"
 #include "list_head.h"
 #include "vm.h"
+#include "frame.h"
+#include "tlb.h"
+#include "pagetable.h"
+#include "process.h"
+#include "swap.h"
+#include "cpu.h"
+#include "rmap.h"
+#include "simd.h"
+#include "numa.h"
+#include "cost.h"
+#include "ksm.h"
 
 /**
  * Ready queue of the system
  */
-extern struct list_head processes;
+extern __sim struct list_head processes;
 
 /**
- * Currently running process
+ * Processes on the system indexed by pid. @current is also in here
  */
-extern struct process *current;
+extern __sim struct pid_table pids;
 
 /**
- * Page Table Base Register that MMU will walk through for address translation
+ * Share page directories on fork and copy them on the first modification
  */
-extern struct pagetable *ptbr;
+extern bool lazy_fork;
 
 /**
- * TLB of the system.
+ * Resolve the pages in the aligned block of @fault_around VPNs around a fault
+ * together. 1 resolves the faulting page only
  */
-extern struct tlb_entry tlb[1UL << (PTES_PER_PAGE_SHIFT * 2)];
+extern unsigned int fault_around;
+
+/**
+ * Make the last mapping of a copy-on-write page writable as soon as the
+ * others go away, instead of on its next write fault
+ */
+extern bool cow_reuse;
+
+/**
+ * Currently running process (@current), the Page Table Base Register that
+ * MMU will walk through for address translation (@ptbr), and the TLB are
+ * those of @this_cpu. See cpu.h
+ */
+
+/**
+ * Address space IDs of processes. Entries of different processes co-exist
+ * in the TLB, tagged with their ASIDs.
+ */
+extern __sim struct asid_allocator asids;
 
 
 /**
  * The number of mappings for each page frame. Can be used to determine how
  * many processes are using the page frames.
  */
-extern unsigned int mapcounts[];
+extern __sim unsigned int *mapcounts;
 
 
 /**
  * lookup_tlb(@vpn, @rw, @pfn)
  *
  * DESCRIPTION
- *   Translate @vpn of the current process through TLB. DO NOT make your own
- *   data structure for TLB, but should use the defined @tlb data structure
- *   to translate. If the requested VPN exists in the TLB and it has the same
- *   rw flag, return true with @pfn is set to its PFN. Otherwise, return false.
+ *   Translate @vpn of the current process through TLB. Only the set that @vpn
+ *   maps to is searched, and only entries tagged with the ASID of @current
+ *   match. If the requested VPN exists in the TLB and its rw
+ *   flag allows @rw, return true with @pfn is set to its PFN. Otherwise,
+ *   return false.
  *   The framework calls this function when needed, so do not call
  *   this function manually.
  *
@@ -63,15 +95,27 @@ extern unsigned int mapcounts[];
  *   Return true if the translation is cached in the TLB.
  *   Return false otherwise
  */
-bool lookup_tlb(unsigned int vpn, unsigned int rw, unsigned int *pfn)
+bool lookup_tlb(vpn_t vpn, unsigned int rw, unsigned int *pfn)
 {
-	for(unsigned int i=0;i<1UL << (PTES_PER_PAGE_SHIFT * 2);i++){
-		if(tlb[i].valid&&tlb[i].vpn==vpn&&tlb[i].rw==(rw==2?3:rw)){
-			*pfn=tlb[i].pfn;
-			return true;
-		}
+	struct tlb_entry *entry = tlb_lookup(&this_cpu->tlb, current->asid, vpn);
+
+	if (!entry || (tlb_entry_rw(entry) & rw) != rw) {
+		this_cpu->tlb.nr_misses++;
+		count_event(rw & ACCESS_WRITE ? STAT_tlb_write_misses : STAT_tlb_read_misses);
+		return false;
 	}
-	return false;
+
+	this_cpu->tlb.nr_hits++;
+	count_event(rw & ACCESS_WRITE ? STAT_tlb_write_hits : STAT_tlb_read_hits);
+	if (tlb_entry_huge(entry)) count_event(STAT_tlb_huge_hits);
+	if (tlb_entry_prefetched(entry)) {
+		tlb_entry_set_prefetched(entry, false);
+		this_cpu->tlb.nr_prefetch_hits++;
+		count_event(STAT_tlb_prefetch_hits);
+	}
+	tlb_touch(&this_cpu->tlb, entry);
+	*pfn = tlb_entry_pfn(entry) + (vpn - entry->vpn);
+	return true;
 }
 
 
@@ -83,27 +127,255 @@ bool lookup_tlb(unsigned int vpn, unsigned int rw, unsigned int *pfn)
  *   call this function when required, so no need to call this function manually.
  *   Note that if there exists an entry for @vpn already, just update it accordingly
  *   rather than removing it or creating a new entry.
- *   Also, in the current simulator, TLB is big enough to cache all the entries of
- *   the current page table, so don't worry about TLB entry eviction. ;-)
+ *   The TLB is set-associative, so inserting a new VPN may evict another entry
+ *   in the same set according to the replacement policy.
+ */
+void insert_tlb(vpn_t vpn, unsigned int rw, unsigned int pfn)
+{
+	struct tlb_entry *entry = tlb_fill(&this_cpu->tlb, current->asid, vpn);
+
+	tlb_entry_set(entry, pfn, rw);
+}
+
+/**
+ * Fill the mapping from @vpn to @pfn ahead of the use, where the prefetcher
+ * predicts. The entry already there for @vpn, if any, is left alone.
+ */
+void prefetch_tlb(vpn_t vpn, unsigned int rw, unsigned int pfn)
+{
+	struct tlb *tlb = &this_cpu->tlb;
+	struct tlb_entry *entry;
+
+	if (tlb_lookup(tlb, current->asid, vpn)) return;
+
+	entry = tlb_fill(tlb, current->asid, vpn);
+	tlb_entry_set(entry, pfn, rw);
+	tlb_entry_set_prefetched(entry, true);
+	tlb->nr_prefetches++;
+	count_event(STAT_tlb_prefetches);
+}
+
+/**
+ * Insert the mapping of the huge page containing @vpn, which is translated
+ * to @pfn, as one entry covering all of its VPNs
  */
-void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn)
+void insert_huge_tlb(vpn_t vpn, unsigned int rw, unsigned int pfn)
 {
-	for(unsigned int i=0;i<1UL << (PTES_PER_PAGE_SHIFT * 2);i++){
-		if(tlb[i].vpn==vpn && tlb[i].valid){
-			tlb[i].rw=rw;
-			tlb[i].pfn=pfn;
-			return;
+	struct tlb_entry *entry = tlb_fill_huge(&this_cpu->tlb, current->asid, vpn);
+
+	tlb_entry_set(entry, pfn - (vpn - entry->vpn), rw);
+}
+
+
+/**
+ * Huge pages
+ *
+ * A huge page is a last-level directory with @huge set. Its PTEs map the
+ * naturally aligned block of frames allocated with frame_alloc_block() in
+ * order, and have the same permission, so the page table can be walked as
+ * usual while the TLB caches the whole block in a single entry.
+ * The block is split into small pages by clearing @huge before one of its
+ * PTEs changes on its own.
+ */
+static void __split_huge(struct pt_cursor *cursor, vpn_t vpn)
+{
+	struct tlb_entry *entry;
+
+	if (!cursor->pd->huge) return;
+
+	cursor->pd->huge = false;
+	entry = tlb_find_huge(&this_cpu->tlb, current->asid, vpn);
+	if (entry) {
+		tlb_invalidate(&this_cpu->tlb, entry);
+	}
+	count_event(STAT_huge_splits);
+}
+
+
+/**
+ * Share the pages of a directory with a forked child. Writable pages become
+ * read-only in both processes so that the first write to them breaks the
+ * sharing. The PTEs are copied by the vector kernel a word of them at a time,
+ * and the pages mapped by them get one more reference each.
+ */
+static void __fork_ptes(struct pte *parent, struct pte *child, unsigned int nr)
+{
+	for (unsigned int i = 0; i < nr; i += BITS_PER_LONG) {
+		unsigned int n = nr - i < BITS_PER_LONG ? nr - i : BITS_PER_LONG;
+		unsigned long present = simd->fork_copy(child + i, parent + i, n);
+		unsigned int bit;
+
+		for_each_set_bit(bit, present) {
+			struct pte *pte = parent + i + bit;
+
+			/* Swapped-out pages are shared through their swap slots */
+			if (pte_swapped(pte)) {
+				swap_slot_get(pte_pfn(pte));
+			} else {
+				frame_get(pte_pfn(pte));
+			}
 		}
 	}
-	for(unsigned int i=0;i<1UL << (PTES_PER_PAGE_SHIFT * 2);i++){
-		if(!tlb[i].valid){
-			tlb[i].valid=true;
-			tlb[i].rw=rw;
-			tlb[i].vpn=vpn;
-			tlb[i].pfn=pfn;
-			return;
+}
+
+
+/**
+ * Turn the PTE of @vpn of @proc into a swap entry to @slot, if it still maps
+ * @pfn. A directory shared by a lazy fork has it done through the first
+ * process sharing it, but the TLB entries of each process still go away.
+ */
+static void __evict_mapping(struct process *proc, vpn_t vpn,
+		unsigned int pfn, unsigned int slot)
+{
+	struct pt_cursor cursor;
+	struct pte *pte;
+
+	pt_cursor_init(&cursor, &proc->pagetable);
+	pte = pt_cursor_lookup(&cursor, vpn);
+	assert(pte);
+
+	if (pte_valid(pte) && pte_pfn(pte) == pfn) {
+		if (cursor.pd->huge) {
+			cursor.pd->huge = false;
+			count_event(STAT_huge_splits);
 		}
+		pte_mkswap(pte, slot);
+		swap_slot_get(slot);
+		frame_put(pfn);
+	}
+	tlb_shootdown_vpn(proc, vpn);
+}
+
+/**
+ * __swap_out()
+ *
+ * DESCRIPTION
+ *   Reclaim a frame by writing the page in it to the swap device. The victim
+ *   is chosen by the replacement policy, but @keep is never chosen.
+ *
+ * RETURN
+ *   @true if a frame is freed
+ *   @false if there is no swap space or no frame to evict
+ */
+static bool __swap_out(unsigned int keep)
+{
+	const struct rmap_item *items;
+	unsigned int pfn, slot, nr;
+
+	if (!swap_enabled() || !nr_free_swap_slots()) return false;
+
+	pfn = swap_select_victim(keep);
+	if (pfn == -1) return false;
+	slot = swap_slot_alloc();
+
+	/* The mappings are found through the rmap, no page table is scanned */
+	items = rmap_items(pfn, &nr);
+	for (unsigned int i = 0; i < nr; i++) {
+		__evict_mapping(items[i].proc, items[i].vpn, pfn, slot);
+	}
+	rmap_clear(pfn);
+	assert(!mapcounts[pfn]);
+
+	/* Drop the reference of the allocation. The swap entries hold the slot */
+	swap_slot_put(slot);
+	count_event(STAT_swap_outs);
+
+	return true;
+}
+
+/* The node to allocate the frames of @current from, following its policy */
+static unsigned int __policy_node(void)
+{
+	return mempolicy_node(&current->mempolicy, cpu_node(this_cpu->id));
+}
+
+/* Count the frame at @pfn allocated for @nid on another node */
+static void __count_node_miss(unsigned int pfn, unsigned int nid)
+{
+	if (pfn != -1 && frame_node(pfn) != nid) count_event(STAT_numa_misses);
+}
+
+/**
+ * Allocate a frame on node @nid, or on the nodes next to it, evicting a
+ * page other than the one in @keep to the swap if all frames are in use
+ */
+static unsigned int __alloc_frame(unsigned int keep, unsigned int nid)
+{
+	unsigned int pfn = frame_alloc_near(nid);
+
+	if (pfn == -1 && __swap_out(keep)) {
+		pfn = frame_alloc_near(nid);
 	}
+	if (pfn != -1) {
+		swap_track_frame(pfn);
+	}
+	__count_node_miss(pfn, nid);
+	return pfn;
+}
+
+
+/**
+ * After a page loses a mapping, the process left alone with it would only
+ * find it is the last one on its next write fault. The rmap tells who that
+ * is, so its copy-on-write mapping is made writable again right away with
+ * @cow_reuse. The
+ * mappings in huge pages and directories still shared by a lazy fork are
+ * left to the fault, which keeps them consistent with the rest of the
+ * directory.
+ */
+static void __reuse_last_mapping(unsigned int pfn)
+{
+	const struct rmap_item *item;
+	struct pt_cursor cursor;
+	struct pte *pte;
+	unsigned int nr;
+
+	if (!cow_reuse || frame_is_zero(pfn) || mapcounts[pfn] != 1) return;
+
+	item = rmap_items(pfn, &nr);
+	if (nr != 1) return;
+
+	pt_cursor_init(&cursor, &item->proc->pagetable);
+	pte = pt_cursor_lookup(&cursor, item->vpn);
+	if (cursor.pd->huge || pd_shared(cursor.pd)) return;
+	if (pte_private(pte) != (ACCESS_READ | ACCESS_WRITE)) return;
+	if (pte_rw(pte) != ACCESS_READ) return;
+
+	/* Upgrading the permission leaves the TLB entries as they are */
+	pte_set_rw(pte, ACCESS_READ | ACCESS_WRITE);
+	count_event(STAT_cow_reuses);
+}
+
+/* Drop a mapping of @pfn, which should be out of the rmap already */
+static void __put_mapping(unsigned int pfn)
+{
+	frame_put(pfn);
+	__reuse_last_mapping(pfn);
+}
+
+/* Move @vpn of @current mapped by @pte to its own copy of the page in @pfn */
+static void __remap(struct pte *pte, unsigned int pfn, vpn_t vpn)
+{
+	unsigned int old = pte_pfn(pte);
+
+	pte_set_pfn(pte, pfn);
+	pte_set_rw(pte, ACCESS_READ | ACCESS_WRITE);
+	rmap_add(pfn, current, vpn);
+
+	rmap_remove(old, current, vpn);
+	__put_mapping(old);
+}
+
+
+/**
+ * Get the PTE for @vpn ready to be modified. The directory shared by a lazy
+ * fork is copied for the current process with its pages shared as an eager
+ * fork does.
+ */
+static struct pte *__unshare_pte(struct pt_cursor *cursor, vpn_t vpn, struct pte *pte)
+{
+	if (!pte || !pd_shared(cursor->pd)) return pte;
+	return pt_cursor_unshare(cursor, vpn, __fork_ptes);
 }
 
 
@@ -119,37 +391,95 @@ void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn)
  *   However, the pages populated with ACCESS_READ should not be accessible with
  *   ACCESS_WRITE accesses.
  *
+ *   alloc_page_at() does the same through @cursor, so that allocating a range
+ *   of VPNs walks down to each directory only once.
+ *
  * RETURN
  *   Return allocated page frame number.
  *   Return -1 if all page frames are allocated.
  */
-unsigned int alloc_page(unsigned int vpn, unsigned int rw)
+unsigned int alloc_page_at(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw)
 {
-	int outer_pte_index=vpn/NR_PTES_PER_PAGE;
-	int pte_index=vpn%NR_PTES_PER_PAGE;
-	struct pte_directory *cur_outer_pte=ptbr->outer_ptes[outer_pte_index];
-	int pfn;
+	struct pte *pte;
+	unsigned int pfn;
 
+	pfn = __alloc_frame(-1, __policy_node());
+	if (pfn == -1) {
+		return -1;
+	}
 
-	for(int i=0;i<NR_PAGEFRAMES;i++){
-		if(!mapcounts[i]){
-			pfn=i;
-			if(cur_outer_pte==NULL){
-				cur_outer_pte=(struct pte_directory *)malloc(sizeof(struct pte_directory));
-				ptbr->outer_ptes[outer_pte_index]=cur_outer_pte;	
-			}
-			struct pte*cur_pte = &(cur_outer_pte->ptes[pte_index]);
-			cur_pte->valid=true;
-			cur_pte->rw=rw;
-			cur_pte->private=rw;
-			cur_pte->pfn=pfn;
-			mapcounts[i]++;
-			return pfn;
-		}
+	/* Directories on the way are allocated on demand */
+	pte = pt_cursor_populate(cursor, vpn);
+	pte = __unshare_pte(cursor, vpn, pte);
+	pte_map(pte, pfn, rw);
+	rmap_add(pfn, current, vpn);
+
+	return pfn;
+}
+
+/**
+ * reserve_page_at()
+ *
+ * DESCRIPTION
+ *   Reserve @vpn for @rw without a frame. The PTE is left not present, and
+ *   handle_page_fault() maps the page on the first access; the zero frame
+ *   for a read, and a frame of its own for a write.
+ */
+void reserve_page_at(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw)
+{
+	struct pte *pte = pt_cursor_populate(cursor, vpn);
+
+	pte = __unshare_pte(cursor, vpn, pte);
+	pte_mkreserved(pte, rw);
+}
+
+unsigned int alloc_page(vpn_t vpn, unsigned int rw)
+{
+	struct pt_cursor cursor;
+
+	pt_cursor_init(&cursor, ptbr);
+	return alloc_page_at(&cursor, vpn, rw);
+}
+
+/**
+ * alloc_huge_page_at()
+ *
+ * DESCRIPTION
+ *   Map a huge page at @vpn, which is the first VPN of a last-level
+ *   directory with no page in it. The frames come from the free block with
+ *   the smallest pfn. They are not reclaimed to make room for the block.
+ *
+ * RETURN
+ *   The first pfn of the block
+ *   -1 if no block of free frames is available
+ */
+unsigned int alloc_huge_page_at(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw)
+{
+	struct pte *pte;
+	unsigned int pfn, nid;
+
+	assert(!(vpn & (NR_PD_ENTRIES - 1)));
+
+	nid = __policy_node();
+	pfn = frame_alloc_block_near(pt_shift, nid);
+	__count_node_miss(pfn, nid);
+	if (pfn == -1) {
+		return -1;
 	}
 
+	pte = pt_cursor_populate(cursor, vpn);
+	__unshare_pte(cursor, vpn, pte);
+	pte = cursor->pd->ptes;
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++, pte++) {
+		assert(!pte_present(pte));
+		pte_map(pte, pfn + i, rw);
+		rmap_add(pfn + i, current, vpn + i);
+		swap_track_frame(pfn + i);
+	}
+	cursor->pd->huge = true;
+	count_event(STAT_huge_allocs);
 
-	return -1;
+	return pfn;
 }
 
 
@@ -161,38 +491,233 @@ unsigned int alloc_page(unsigned int vpn, unsigned int rw)
  *   for the corresponding PTE (valid, rw, pfn) is set @false or 0.
  *   Also, consider the case when a page is shared by two processes,
  *   and one process is about to free the page. Also, think about TLB as well ;-)
+ *
+ *   free_page_at() walks through @cursor, and leaves the TLB to the caller.
+ *   The local one is flushed with flush_tlb_range() afterwards, and the
+ *   remote ones by finishing @gather, where the unmapped VPNs are gathered.
  */
-void free_page(unsigned int vpn)
+void free_page_at(struct pt_cursor *cursor, vpn_t vpn, struct mmu_gather *gather)
 {
-	int outer_pte_index=vpn/NR_PTES_PER_PAGE;
-	int pte_index=vpn%NR_PTES_PER_PAGE;
-	struct pte_directory *cur_outer_pte=ptbr->outer_ptes[outer_pte_index];
-	struct pte*cur_pte = &(cur_outer_pte->ptes[pte_index]);
-	if(!cur_outer_pte||!cur_pte){
+	struct pte *pte = pt_cursor_lookup(cursor, vpn);
+
+	if (!pte || !(pte_present(pte) || pte_reserved(pte))) {
 		return;
 	}
-	int pfn=cur_pte->pfn;
-	cur_pte->valid=false;
-	cur_pte->rw=0;
-	cur_pte->pfn=0;
-	cur_pte->private=0;
-	mapcounts[pfn]--;
-	///////////////////////////////
-	/*Also, think about TLB as well ;-)*/
-	for(unsigned int i=0;i<1UL << (PTES_PER_PAGE_SHIFT * 2);i++){
-		if(tlb[i].vpn==vpn&&tlb[i].valid){
-			tlb[i].valid=false;
-			tlb[i].rw=-1;
-			tlb[i].vpn=-1;
-			tlb[i].pfn=-1;
+	pte = __unshare_pte(cursor, vpn, pte);
+
+	/* Never mapped, so nothing to drop */
+	if (pte_reserved(pte)) {
+		pte_clear(pte);
+		return;
+	}
+	__split_huge(cursor, vpn);
+
+	if (pte_swapped(pte)) {
+		swap_slot_put(pte_pfn(pte));
+	} else {
+		rmap_remove(pte_pfn(pte), current, vpn);
+		__put_mapping(pte_pfn(pte));
+		mmu_gather_vpn(gather, vpn);
+	}
+	pte_clear(pte);
+}
+
+void free_page(vpn_t vpn)
+{
+	struct pt_cursor cursor;
+	struct mmu_gather gather;
+	struct tlb_entry *entry;
+
+	pt_cursor_init(&cursor, ptbr);
+	mmu_gather_init(&gather, current);
+	free_page_at(&cursor, vpn, &gather);
+
+	/* Also, think about TLB as well ;-) */
+	entry = tlb_find(&this_cpu->tlb, current->asid, vpn);
+	if (entry) {
+		tlb_invalidate(&this_cpu->tlb, entry);
+	}
+	mmu_gather_finish(&gather);
+}
+
+/**
+ * Invalidate the TLB entries of the current process for the VPNs in
+ * [@start, @last] every @stride, after unmapping them with free_page_at().
+ */
+void flush_tlb_range(vpn_t start, vpn_t last, unsigned long stride)
+{
+	unsigned long nr_pages = (last - start) / stride + 1;
+
+	/* Cheaper to sweep the valid entries than to look up each VPN */
+	if (nr_pages > this_cpu->tlb.nr_entries) {
+		tlb_flush_range(&this_cpu->tlb, current->asid, start, last, stride);
+		charge_cycles(COST_flush, 1);
+		return;
+	}
+
+	for (vpn_t vpn = start; ; vpn += stride) {
+		struct tlb_entry *entry = tlb_find(&this_cpu->tlb, current->asid, vpn);
+
+		if (entry) {
+			tlb_invalidate(&this_cpu->tlb, entry);
 		}
+		if (last - vpn < stride) break;
 	}
-	return;
+}
 
 
+/* Make all pages of the huge page at @pd writable if they are not shared */
+static bool __promote_huge(struct pte_directory *pd)
+{
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (mapcounts[pte_pfn(pd->ptes + i)] != 1) return false;
+	}
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		pte_set_rw(pd->ptes + i, ACCESS_READ | ACCESS_WRITE);
+	}
+	return true;
 }
 
 
+/**
+ * Allocate a free frame for a page that is not accessed yet. Unlike
+ * __alloc_frame(), no page is evicted to the swap for it. Without the swap,
+ * the frame could never be taken back for the pages accessed later, so none
+ * is given out then.
+ */
+static unsigned int __alloc_free_frame(unsigned int nid)
+{
+	unsigned int pfn;
+
+	if (!swap_enabled()) return -1;
+
+	pfn = frame_alloc_near(nid);
+
+	if (pfn != -1) {
+		swap_track_frame(pfn);
+	}
+	__count_node_miss(pfn, nid);
+	return pfn;
+}
+
+/**
+ * Resolve @pte for @vpn in the private directory of @cursor as a demand or
+ * copy-on-write fault for @rw would, without the fault. Return false if it
+ * would not fault that way, or there is no free frame for it.
+ */
+static bool __fault_ahead(struct pt_cursor *cursor, vpn_t vpn, struct pte *pte,
+		unsigned int rw, struct mmu_gather *gather)
+{
+	struct tlb_entry *entry;
+	unsigned int pfn;
+
+	if (pte_reserved(pte)) {
+		if (!(rw & ACCESS_WRITE)) {
+			pte_map(pte, frame_zero(), pte_private(pte));
+			pte_set_rw(pte, ACCESS_READ);
+			return true;
+		}
+		if (!(pte_private(pte) & ACCESS_WRITE)) return false;
+
+		pfn = __alloc_free_frame(__policy_node());
+		if (pfn == -1) return false;
+		pte_map(pte, pfn, pte_private(pte));
+		rmap_add(pfn, current, vpn);
+		return true;
+	}
+
+	if (!(rw & ACCESS_WRITE) || !pte_valid(pte)) return false;
+	if (pte_private(pte) != (ACCESS_READ | ACCESS_WRITE)) return false;
+	if (pte_rw(pte) != ACCESS_READ) return false;
+
+	/* Upgrading the permission leaves the TLB entries as they are */
+	if (mapcounts[pte_pfn(pte)] == 1 && !frame_is_zero(pte_pfn(pte))) {
+		pte_set_rw(pte, ACCESS_READ | ACCESS_WRITE);
+		return true;
+	}
+
+	pfn = __alloc_free_frame(cpu_node(this_cpu->id));
+	if (pfn == -1) return false;
+	__remap(pte, pfn, vpn);
+	charge_cycles(COST_cow, 1);
+
+	/* It is not retried as the faulting one is, so drop the local entry too */
+	entry = tlb_find(&this_cpu->tlb, current->asid, vpn);
+	if (entry) tlb_invalidate(&this_cpu->tlb, entry);
+	mmu_gather_vpn(gather, vpn);
+
+	return true;
+}
+
+/**
+ * __fault_around()
+ *
+ * DESCRIPTION
+ *   After a demand or copy-on-write fault on @vpn for @rw, resolve the other
+ *   pages in the aligned block of @fault_around VPNs around it that would
+ *   fault the same way, as the fault-around of Linux does, so that the
+ *   accesses to them do not fault one by one. The block is clipped to the
+ *   directory of @cursor, which should be private and not huge. Pages only
+ *   get free frames here, and only when the swap is enabled; nothing is
+ *   swapped out for them.
+ */
+static void __fault_around(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw)
+{
+	struct mmu_gather gather;
+	unsigned int nr_pages = fault_around < NR_PD_ENTRIES ? fault_around : NR_PD_ENTRIES;
+	vpn_t start = vpn & ~((vpn_t)nr_pages - 1);
+
+	if (nr_pages <= 1 || cursor->pd->huge) return;
+
+	mmu_gather_init(&gather, current);
+	for (vpn_t i = start; i < start + nr_pages; i++) {
+		struct pte *pte = cursor->pd->ptes + pt_index(i, nr_pt_levels - 1);
+
+		if (i == vpn) continue;
+		if (__fault_ahead(cursor, i, pte, rw, &gather)) {
+			count_event(STAT_faults_around);
+		}
+	}
+	mmu_gather_finish(&gather);
+}
+
+/**
+ * migrate_page_at()
+ *
+ * DESCRIPTION
+ *   Move the page mapped by @pte at @vpn of @current to a frame on the node
+ *   of @this_cpu, which misses in the TLB for it, with @numa_migrate. Only
+ *   the pages of a single mapping in a private directory are moved, and
+ *   only to a free frame of the node. The entries of the old frame are shot
+ *   down, so the CPUs agree on the new one.
+ *
+ * RETURN
+ *   @true if the page is moved, and @pte maps the new frame
+ *   @false otherwise
+ */
+bool migrate_page_at(struct pt_cursor *cursor, vpn_t vpn, struct pte *pte)
+{
+	unsigned int pfn = pte_pfn(pte);
+	unsigned int nid = cpu_node(this_cpu->id);
+	unsigned int new;
+
+	if (!numa_migrate || frame_is_zero(pfn) || frame_node(pfn) == nid) return false;
+	if (mapcounts[pfn] != 1 || cursor->pd->huge || pd_shared(cursor->pd)) return false;
+
+	new = frame_alloc_node(nid);
+	if (new == -1) return false;
+	swap_track_frame(new);
+
+	pte_set_pfn(pte, new);
+	rmap_add(new, current, vpn);
+	rmap_remove(pfn, current, vpn);
+	frame_put(pfn);
+	tlb_shootdown_vpn(current, vpn);
+	count_event(STAT_numa_migrations);
+
+	return true;
+}
+
 /**
  * handle_page_fault()
  *
@@ -204,44 +729,172 @@ void free_page(unsigned int vpn)
  *   2. pte is not writable but @rw is for write
  *   This function should identify the situation, and do the copy-on-write if
  *   necessary.
+ *   The PTE may also be a swap entry, and the page is brought back from the
+ *   swap then. It becomes a private copy of the process, so it gets the
+ *   original permission regardless of the sharing before swapped out.
+ *   A page reserved by a lazy allocation is mapped on the first access. A
+ *   read maps the zero frame read-only, which is copied on the first write
+ *   as the pages shared by fork are. So are the frames of identical content
+ *   merged by ksm_merge().
  *
  * RETURN
  *   @true on successful fault handling
  *   @false otherwise
  */
-bool handle_page_fault(unsigned int vpn, unsigned int rw)
+bool handle_page_fault(vpn_t vpn, unsigned int rw)
 {
-	int outer_pte_index=vpn/NR_PTES_PER_PAGE;
-	int pte_index=vpn%NR_PTES_PER_PAGE;
-	struct pte_directory *cur_outer_pte=ptbr->outer_ptes[outer_pte_index];
-	if(!cur_outer_pte)
-	{
-		return false;
+	struct pt_cursor cursor;
+	struct mmu_gather gather;
+	struct pte *pte;
+	unsigned int pfn;
+
+	charge_cycles(COST_fault, 1);
+
+	pt_cursor_init(&cursor, ptbr);
+	pte = pt_cursor_lookup(&cursor, vpn);
+
+	/* Page directory does not exist */
+	if (!pte) {
+		goto fail;
 	}
-	struct pte*cur_pte = &cur_outer_pte->ptes[pte_index];
-	if(!cur_pte){
-		return false;
+
+	/* Swapped out. Bring it back to a new frame */
+	if (pte_swapped(pte)) {
+		pte = __unshare_pte(&cursor, vpn, pte);
+		pfn = __alloc_frame(-1, __policy_node());
+		if (pfn == -1) {
+			goto fail;
+		}
+		swap_slot_put(pte_pfn(pte));
+		pte_mkvalid(pte, pfn);
+		rmap_add(pfn, current, vpn);
+		count_event(STAT_faults_swapin);
+		charge_cycles(COST_swapin, 1);
+		return true;
 	}
-	if(cur_pte->valid&&rw==ACCESS_WRITE&&cur_pte->private==ACCESS_WRITE+ACCESS_READ&&cur_pte->rw==ACCESS_READ){
-		if(mapcounts[cur_pte->pfn]==1){
-			cur_pte->rw=ACCESS_READ+ACCESS_WRITE;
-			return true;
+
+	if (pte_reserved(pte)) {
+		if ((rw & ACCESS_WRITE) && !(pte_private(pte) & ACCESS_WRITE)) {
+			goto fail;
 		}
-			for(int i=0;i<NR_PAGEFRAMES;i++){
-				if(!mapcounts[i]){
-					int pfn=i;
-					mapcounts[cur_pte->pfn]--;
-					cur_pte->pfn=pfn;
-					cur_pte->rw=ACCESS_READ+ACCESS_WRITE;
-					mapcounts[pfn]++;
-					return true;
-				}
+		pte = __unshare_pte(&cursor, vpn, pte);
+		if (rw & ACCESS_WRITE) {
+			pfn = __alloc_frame(-1, __policy_node());
+			if (pfn == -1) {
+				goto fail;
 			}
+			pte_map(pte, pfn, pte_private(pte));
+			rmap_add(pfn, current, vpn);
+		} else {
+			pte_map(pte, frame_zero(), pte_private(pte));
+			pte_set_rw(pte, ACCESS_READ);
+		}
+		count_event(STAT_faults_demand);
+		__fault_around(&cursor, vpn, rw);
+		return true;
+	}
+
+	/* Only writes to copy-on-write pages are recoverable */
+	if (!pte_valid(pte) || rw != ACCESS_WRITE) {
+		goto fail;
+	}
+	if (pte_private(pte) != (ACCESS_READ | ACCESS_WRITE)) {
+		goto fail;
 	}
+	pte = __unshare_pte(&cursor, vpn, pte);
+	if (pte_rw(pte) != ACCESS_READ) {
+		goto fail;
+	}
+	if (page_merged(pte_pfn(pte))) {
+		count_event(STAT_ksm_cow_faults);
+	}
+
+	/**
+	 * Remote TLBs may still have the entries of the process from where it
+	 * ran before. They are fine with the upgrades of the permission, which
+	 * just fault again, but not with the changes of the mapping.
+	 */
+	mmu_gather_init(&gather, current);
+
+	/* Keep the huge page if no one else maps any part of it */
+	if (cursor.pd->huge) {
+		if (__promote_huge(cursor.pd)) {
+			count_event(STAT_faults_cow_promote);
+			return true;
+		}
+		__split_huge(&cursor, vpn);
+		mmu_gather_vpn(&gather, vpn);
+	}
+
+	/* The last one sharing the page. Just make it writable again */
+	if (mapcounts[pte_pfn(pte)] == 1 && !frame_is_zero(pte_pfn(pte))) {
+		pte_set_rw(pte, ACCESS_READ | ACCESS_WRITE);
+		count_event(STAT_faults_cow_promote);
+		mmu_gather_finish(&gather);
+		__fault_around(&cursor, vpn, rw);
+		return true;
+	}
+
+	/* The copy is for the faulting CPU, whatever the policy is */
+	pfn = __alloc_frame(pte_pfn(pte), cpu_node(this_cpu->id));
+	if (pfn == -1) {
+		mmu_gather_finish(&gather);
+		goto fail;
+	}
+	__remap(pte, pfn, vpn);
+	mmu_gather_vpn(&gather, vpn);
+	mmu_gather_finish(&gather);
+	count_event(STAT_faults_cow_copy);
+	charge_cycles(COST_cow, 1);
+	__fault_around(&cursor, vpn, rw);
+
+	return true;
+
+fail:
+	count_event(STAT_faults_failed);
 	return false;
 }
 
 
+/**
+ * Put @current of @this_cpu back to the ready queue, leaving the CPU idle
+ */
+static void __put_prev(void)
+{
+	if (!current) return;
+
+	current->cpu = NULL;
+	list_add_tail(&current->list, &processes);
+	current = NULL;
+	ptbr = NULL;
+}
+
+/* Take the process at the head of the ready queue, if any */
+static struct process *__pick_next(void)
+{
+	struct process *next;
+
+	if (list_empty(&processes)) return NULL;
+
+	next = list_first_entry(&processes, struct process, list);
+	list_del(&next->list);
+	return next;
+}
+
+/* Run @proc on @cpu in place of its current process. NULL idles @cpu */
+static void __run_on(struct cpu *cpu, struct process *proc)
+{
+	if (cpu->curr) cpu->curr->cpu = NULL;
+
+	cpu->curr = proc;
+	cpu->pt_base = proc ? &proc->pagetable : NULL;
+	if (!proc) return;
+
+	proc->cpu = cpu;
+	switch_mm(cpu, proc);
+}
+
+
 /**
  * switch_process()
  *
@@ -257,51 +910,139 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw)
  *   the identical page table entry 'values' to its parent's (i.e., @current)
  *   page table. 
  *   To implement the copy-on-write feature, you should manipulate the writable
- *   bit in PTE and mapcounts for shared pages. You may use pte->private for 
+ *   bit in PTE and mapcounts for shared pages. You may use pte_private() for 
  *   storing some useful information :-)
+ *
+ *   With @lazy_fork, the child shares the last-level directories of the
+ *   parent instead. The shared directories are write-protected, and the
+ *   PTEs and mapcounts are copied when either process modifies one of them.
+ *   So the fork does not touch the pages, and is proportional to the number
+ *   of upper-level directories.
+ *
+ *   Processes are looked up in @pids by their pids rather than by scanning
+ *   @processes, which only keeps the order of the ready queue.
+ *
+ *   TLB entries are tagged with the ASID of their process, so the TLB is not
+ *   flushed on the switch. Entries of other processes stay resident until
+ *   their ASID gets recycled or they are explicitly invalidated.
+ *
+ *   The switch happens on @this_cpu. A process running on another CPU is
+ *   migrated here, and that CPU runs the next ready process instead. An idle
+ *   CPU has no process to fork from.
+ *
+ * RETURN
+ *   @true if @pid runs on @this_cpu now
+ *   @false otherwise
  */
-void switch_process(unsigned int pid)
-{
-	for(unsigned int i=0;i<1UL << (PTES_PER_PAGE_SHIFT * 2);i++){
-			tlb[i].valid=false;
-			tlb[i].rw=-1;
-			tlb[i].vpn=-1;
-			tlb[i].pfn=-1;
-			
-	}
-	struct process * proc=NULL;
-	list_for_each_entry(proc,&processes,list){
-		if(proc->pid==pid){
-			list_add_tail(&current->list,&processes);
-			current=proc;
-			ptbr=&current->pagetable;
-			break;
+bool switch_process(unsigned int pid)
+{
+	struct process *proc = pid_table_find(&pids, pid);
+	struct process *child;
+	struct mmu_gather gather;
+
+	if (proc && proc == current) return true;
+
+	if (proc) {
+		if (proc->cpu) {
+			/* Running on another CPU. Pull it over here */
+			__run_on(proc->cpu, __pick_next());
+		} else {
+			list_del(&proc->list);
 		}
+		__put_prev();
+		__run_on(this_cpu, proc);
+		return true;
 	}
-	if(current->pid==pid){
-		list_del(&current->list);
-		return;
+
+	/* Nothing to fork from */
+	if (!current) return false;
+
+	count_event(STAT_forks);
+
+	child = process_alloc();
+	child->pid = pid;
+	child->mempolicy = current->mempolicy;
+	pid_table_insert(&pids, child);
+	if (lazy_fork) {
+		pt_share(&child->pagetable, ptbr);
+	} else {
+		pt_clone(&child->pagetable, ptbr, __fork_ptes);
 	}
-	struct process *child=(struct process *)malloc(sizeof(struct process));
-	child->pid=pid;
-	for(int i=0;i<NR_PTES_PER_PAGE;i++)
-	{
-		if(ptbr->outer_ptes[i]){
-			child->pagetable.outer_ptes[i]=(struct pte_directory *)malloc(sizeof(struct pte_directory));
-			for(int j=0;j<NR_PTES_PER_PAGE;j++){
-				if(ptbr->outer_ptes[i]->ptes[j].rw==ACCESS_READ+ACCESS_WRITE)
-				{
-					ptbr->outer_ptes[i]->ptes[j].rw=ACCESS_READ;
-				}
-				child->pagetable.outer_ptes[i]->ptes[j]=ptbr->outer_ptes[i]->ptes[j];
-				if(ptbr->outer_ptes[i]->ptes[j].valid){
-					mapcounts[ptbr->outer_ptes[i]->ptes[j].pfn]++;	
-				}
-		}
+	rmap_add_pagetable(child);
+
+	/**
+	 * The parent lost the write permission, and so should its TLB entries,
+	 * including those on the CPUs it ran before
+	 */
+	tlb_wrprotect_asid(&this_cpu->tlb, current->asid);
+	mmu_gather_init(&gather, current);
+	mmu_gather_wrprotect(&gather);
+	mmu_gather_finish(&gather);
+
+	__put_prev();
+	__run_on(this_cpu, child);
+	return true;
+}
+
+
+/* The rmap of the process is gone already */
+static void __exit_pte(struct pte *pte)
+{
+	if (pte_swapped(pte)) {
+		swap_slot_put(pte_pfn(pte));
+	} else {
+		__put_mapping(pte_pfn(pte));
+	}
+}
+
+
+/**
+ * exit_process()
+ *
+ * DESCRIPTION
+ *   Tear down the process with @pid. Its page table is freed in one pass
+ *   dropping the mapping of each page, and its TLB entries are invalidated
+ *   by releasing its ASID. If it is running on a CPU, the process at the head
+ *   of the ready queue runs there next. The CPU becomes idle if there is no
+ *   process ready. The initial process cannot exit.
+ *   The pages that were shared copy-on-write with the process may be left
+ *   with a single mapping. Such a page becomes writable again on the next
+ *   write fault without being copied.
+ *
+ * RETURN
+ *   @true if the process is gone
+ *   @false if there is no such process or it is the initial process
+ */
+bool exit_process(unsigned int pid)
+{
+	struct process *proc = pid_table_find(&pids, pid);
+	struct cpu *cpu;
+
+	if (!proc || proc->pid == 0) return false;
+
+	count_event(STAT_exits);
+
+	if (proc->cpu) {
+		__run_on(proc->cpu, __pick_next());
+	} else {
+		list_del(&proc->list);
+	}
+	pid_table_remove(&pids, proc);
+
+	/* The TLB entries of the ASID go away on every CPU that may have them */
+	if (asid_release(&asids, proc)) {
+		for_each_cpu_in(cpu, proc->cpumask) {
+			unsigned int nr_flushed = tlb_flush_asid(&cpu->tlb, proc->asid);
+
+			charge_cycles(COST_flush, 1);
+			if (cpu == this_cpu) continue;
+			count_event(STAT_tlb_shootdowns);
+			count_events(STAT_shootdown_entries, nr_flushed);
 		}
 	}
-	list_add_tail(&current->list,&processes);
-	current=child;
-	ptbr=&current->pagetable;
-	return;
+	rmap_remove_pagetable(proc);
+	pt_destroy(&proc->pagetable, __exit_pte);
+	process_free(proc);
+
+	return true;
 }
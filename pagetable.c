@@ -0,0 +1,360 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "pagetable.h"
+#include "slab.h"
+
+unsigned int nr_pt_levels = NR_PT_LEVELS;
+unsigned int pt_shift = PTES_PER_PAGE_SHIFT;
+
+/**
+ * Directories of all levels come from one cache sized for the larger of the
+ * two, so that a page table can keep all its directories in the same slabs.
+ */
+static __sim struct kmem_cache pd_cache;
+
+/**
+ * pt_parse_config()
+ *
+ * DESCRIPTION
+ *   Parse the page table geometry given as "levels:bits", where each
+ *   directory has 2^bits entries. A VPN may have up to MAX_VPN_BITS bits.
+ *
+ * RETURN
+ *   @true if @str describes a valid geometry
+ *   @false otherwise
+ */
+bool pt_parse_config(const char *str, unsigned int *nr_levels, unsigned int *shift)
+{
+	char *end;
+
+	*nr_levels = strtoul(str, &end, 0);
+	if (*end != ':') return false;
+	*shift = strtoul(end + 1, &end, 0);
+	if (*end != '\0') return false;
+
+	if (*nr_levels < 1 || *nr_levels > MAX_PT_LEVELS) return false;
+	if (*shift < 1 || *nr_levels * *shift > MAX_VPN_BITS) return false;
+
+	return true;
+}
+
+void pt_init(void)
+{
+	size_t entry_size = sizeof(struct pte) > sizeof(struct pte_directory *) ?
+			sizeof(struct pte) : sizeof(struct pte_directory *);
+
+	kmem_cache_init(&pd_cache, "pte_directory",
+			sizeof(struct pte_directory) + NR_PD_ENTRIES * entry_size);
+}
+
+void pt_exit(void)
+{
+	kmem_cache_exit(&pd_cache);
+}
+
+struct pte_directory *pd_alloc(struct pte_directory *near)
+{
+	struct pte_directory *pd = kmem_cache_alloc(&pd_cache, near);
+
+	pd->refs = 1;
+	count_event(STAT_pd_allocs);
+
+	return pd;
+}
+
+void pd_free(struct pte_directory *pd)
+{
+	kmem_cache_free(&pd_cache, pd);
+}
+
+/* Upper indices of @vpn down to @level, which tag the cached slots of @level */
+static inline vpn_t __cache_tag(vpn_t vpn, unsigned int level)
+{
+	return vpn >> ((nr_pt_levels - level) * pt_shift);
+}
+
+static inline struct pt_cache_entry *__cache_entry(struct pagetable *pt,
+		unsigned int level, vpn_t tag)
+{
+	return &pt->cache[level - 1][tag & (PT_CACHE_ENTRIES - 1)];
+}
+
+static inline void __cache_fill(struct pagetable *pt, unsigned int level,
+		vpn_t vpn, struct pte_directory **slot)
+{
+	struct pt_cache_entry *e;
+	vpn_t tag = __cache_tag(vpn, level);
+
+	e = __cache_entry(pt, level, tag);
+	e->tag = tag;
+	e->slot = slot;
+}
+
+/**
+ * __walk_slot()
+ *
+ * DESCRIPTION
+ *   Walk @pt down to the slot pointing to the last-level directory for @vpn.
+ *   The walk starts from the deepest level whose slot is in the cache of
+ *   @pt, as the paging-structure caches of x86 let the MMU skip the upper
+ *   levels, and caches the slots it goes through on the way down.
+ *
+ * RETURN
+ *   The slot, which points to NULL if the directory is missing
+ *   NULL if a directory above it is missing, unless @populate is set
+ */
+static struct pte_directory **__walk_slot(struct pagetable *pt, vpn_t vpn, bool populate)
+{
+	struct pte_directory **slot = &pt->root;
+	unsigned int level;
+
+	count_event(STAT_pt_walks);
+
+	for (level = nr_pt_levels - 1; level > 0; level--) {
+		vpn_t tag = __cache_tag(vpn, level);
+		struct pt_cache_entry *e = __cache_entry(pt, level, tag);
+
+		if (!e->slot || e->tag != tag) continue;
+
+		slot = e->slot;
+		count_event(STAT_pt_cache_hits);
+		count_events(STAT_pt_cache_skips, level);
+		break;
+	}
+
+	for (; ; level++) {
+		if (!*slot) {
+			if (!populate) return NULL;
+			*slot = pd_alloc(pt->root);
+		}
+		if (pt_leaf_level(level)) break;
+
+		slot = &(*slot)->dirs[pt_index(vpn, level)];
+		count_event(STAT_pt_walk_reads);
+		__cache_fill(pt, level + 1, vpn, slot);
+	}
+	return slot;
+}
+
+void pt_cache_flush(struct pagetable *pt)
+{
+	memset(pt->cache, 0x00, sizeof(pt->cache));
+}
+
+/**
+ * pt_cache_insert()
+ *
+ * DESCRIPTION
+ *   Cache the slot of @level tagged with @tag as a walk to it would do,
+ *   without counting the walk.
+ *
+ * RETURN
+ *   @true if the slot is cached
+ *   @false if @level or @tag does not fit in @pt or a directory to the slot
+ *   is missing
+ */
+bool pt_cache_insert(struct pagetable *pt, unsigned int level, vpn_t tag)
+{
+	struct pte_directory **slot = &pt->root;
+	vpn_t vpn;
+
+	if (level < 1 || level >= nr_pt_levels) return false;
+	if (tag >> (level * pt_shift)) return false;
+
+	vpn = tag << ((nr_pt_levels - level) * pt_shift);
+	for (unsigned int i = 0; i < level; i++) {
+		if (!*slot) return false;
+		slot = &(*slot)->dirs[pt_index(vpn, i)];
+	}
+	__cache_fill(pt, level, vpn, slot);
+
+	return true;
+}
+
+static inline struct pte_directory *__walk_leaf(struct pagetable *pt, vpn_t vpn, bool populate)
+{
+	struct pte_directory **slot = __walk_slot(pt, vpn, populate);
+
+	return slot ? *slot : NULL;
+}
+
+struct pte *pt_lookup(struct pagetable *pt, vpn_t vpn)
+{
+	struct pte_directory *pd = __walk_leaf(pt, vpn, false);
+
+	if (!pd) return NULL;
+	return &pd->ptes[pt_index(vpn, nr_pt_levels - 1)];
+}
+
+struct pte *pt_populate(struct pagetable *pt, vpn_t vpn)
+{
+	struct pte_directory *pd = __walk_leaf(pt, vpn, true);
+
+	return &pd->ptes[pt_index(vpn, nr_pt_levels - 1)];
+}
+
+static inline struct pte *__cursor_walk(struct pt_cursor *c, vpn_t vpn, bool populate)
+{
+	if (!c->pd || c->base != vpn >> pt_shift) {
+		c->pd = __walk_leaf(c->pt, vpn, populate);
+		c->base = vpn >> pt_shift;
+		if (!c->pd) return NULL;
+	}
+	return &c->pd->ptes[pt_index(vpn, nr_pt_levels - 1)];
+}
+
+struct pte *pt_cursor_lookup(struct pt_cursor *c, vpn_t vpn)
+{
+	return __cursor_walk(c, vpn, false);
+}
+
+struct pte *pt_cursor_populate(struct pt_cursor *c, vpn_t vpn)
+{
+	return __cursor_walk(c, vpn, true);
+}
+
+static struct pte_directory *__copy_leaf(struct pte_directory *src,
+		struct pte_directory *near, pt_clone_fn fn)
+{
+	struct pte_directory *dst = pd_alloc(near);
+
+	dst->huge = src->huge;
+	fn(src->ptes, dst->ptes, NR_PD_ENTRIES);
+
+	return dst;
+}
+
+/**
+ * pt_cursor_unshare()
+ *
+ * DESCRIPTION
+ *   Make the last-level directory of @vpn private to the page table of @c.
+ *   If it is shared with other page tables, the page table gets its own copy
+ *   of the directory, where @fn copies the PTEs as pt_clone() does.
+ *
+ * RETURN
+ *   The PTE for @vpn in the private directory
+ *   NULL if the directory does not exist
+ */
+struct pte *pt_cursor_unshare(struct pt_cursor *c, vpn_t vpn, pt_clone_fn fn)
+{
+	struct pte_directory **slot = __walk_slot(c->pt, vpn, false);
+
+	if (!slot) return NULL;
+
+	if (pd_shared(*slot)) {
+		struct pte_directory *pd = __copy_leaf(*slot, c->pt->root, fn);
+
+		(*slot)->refs--;
+		*slot = pd;
+		count_event(STAT_pd_unshares);
+	}
+	c->pd = *slot;
+	c->base = vpn >> pt_shift;
+
+	return &c->pd->ptes[pt_index(vpn, nr_pt_levels - 1)];
+}
+
+static void __for_each_leaf(struct pte_directory *pd, unsigned int level,
+		vpn_t base, pt_leaf_fn fn, void *data)
+{
+	if (pt_leaf_level(level)) {
+		fn(pd, base, data);
+		return;
+	}
+
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (!pd->dirs[i]) continue;
+		__for_each_leaf(pd->dirs[i], level + 1,
+				(base << pt_shift) | i, fn, data);
+	}
+}
+
+void pt_for_each_leaf(struct pagetable *pt, pt_leaf_fn fn, void *data)
+{
+	if (!pt->root) return;
+	__for_each_leaf(pt->root, 0, 0, fn, data);
+}
+
+/* Directories are allocated next to @root, the root of the new page table */
+static struct pte_directory *__clone(struct pte_directory *src,
+		unsigned int level, struct pte_directory *root, pt_clone_fn fn)
+{
+	struct pte_directory *dst;
+
+	if (pt_leaf_level(level)) {
+		if (!fn) {
+			src->refs++;
+			return src;
+		}
+		return __copy_leaf(src, root, fn);
+	}
+
+	dst = pd_alloc(root);
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (!src->dirs[i]) continue;
+		dst->dirs[i] = __clone(src->dirs[i], level + 1, root ? : dst, fn);
+	}
+	return dst;
+}
+
+void pt_clone(struct pagetable *dst, struct pagetable *src, pt_clone_fn fn)
+{
+	pt_cache_flush(dst);
+	if (!src->root) return;
+	dst->root = __clone(src->root, 0, NULL, fn);
+}
+
+void pt_share(struct pagetable *dst, struct pagetable *src)
+{
+	pt_cache_flush(dst);
+	if (!src->root) return;
+	dst->root = __clone(src->root, 0, NULL, NULL);
+}
+
+static void __destroy(struct pte_directory *pd, unsigned int level, pt_pte_fn fn)
+{
+	if (pt_leaf_level(level)) {
+		if (pd_shared(pd)) {
+			pd->refs--;
+			return;
+		}
+		for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+			if (pte_present(pd->ptes + i)) fn(pd->ptes + i);
+		}
+		pd_free(pd);
+		return;
+	}
+
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (pd->dirs[i]) __destroy(pd->dirs[i], level + 1, fn);
+	}
+	pd_free(pd);
+}
+
+void pt_destroy(struct pagetable *pt, pt_pte_fn fn)
+{
+	pt_cache_flush(pt);
+	if (!pt->root) return;
+	__destroy(pt->root, 0, fn);
+	pt->root = NULL;
+}
@@ -0,0 +1,135 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __PAGETABLE_H__
+#define __PAGETABLE_H__
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * Geometry of the radix page tables, chosen at startup. Every directory has
+ * (1 << @pt_shift) entries, and a VPN is split into @nr_pt_levels indices
+ * of @pt_shift bits from the most significant one.
+ */
+extern unsigned int nr_pt_levels;
+extern unsigned int pt_shift;
+
+#define NR_PD_ENTRIES	(1U << pt_shift)
+
+bool pt_parse_config(const char *str, unsigned int *nr_levels, unsigned int *shift);
+
+/* Index of @vpn in the directory at @level. The root is at level 0 */
+static inline unsigned int pt_index(vpn_t vpn, unsigned int level)
+{
+	return (vpn >> ((nr_pt_levels - 1 - level) * pt_shift)) & (NR_PD_ENTRIES - 1);
+}
+
+static inline bool pt_vpn_valid(vpn_t vpn)
+{
+	return (vpn >> (nr_pt_levels * pt_shift)) == 0;
+}
+
+static inline bool pt_leaf_level(unsigned int level)
+{
+	return level == nr_pt_levels - 1;
+}
+
+void pt_init(void);
+void pt_exit(void);
+
+/**
+ * Allocate a zeroed directory for any level. It is placed next to @near
+ * if possible, so pass a directory of the same page table.
+ */
+struct pte_directory *pd_alloc(struct pte_directory *near);
+void pd_free(struct pte_directory *pd);
+
+/**
+ * Last-level directories may be shared by page tables after pt_share().
+ * A shared directory is write-protected as a whole; none of its PTEs is
+ * writable regardless of their rw until it is unshared.
+ */
+static inline bool pd_shared(struct pte_directory *pd)
+{
+	return pd->refs > 1;
+}
+
+/**
+ * Walk @pt down to the PTE for @vpn. pt_lookup() returns NULL if any
+ * directory on the way is missing, whereas pt_populate() allocates the
+ * missing directories.
+ */
+struct pte *pt_lookup(struct pagetable *pt, vpn_t vpn);
+struct pte *pt_populate(struct pagetable *pt, vpn_t vpn);
+
+/**
+ * Walks go through the paging-structure cache in struct pagetable. Flush it
+ * when the upper directories of the page table are freed or replaced.
+ */
+void pt_cache_flush(struct pagetable *pt);
+bool pt_cache_insert(struct pagetable *pt, unsigned int level, vpn_t tag);
+
+/**
+ * Cursor to walk a page table. It remembers the last-level directory of the
+ * previous walk, so walks to VPNs in the same directory skip the upper
+ * levels. Reset it when the directories may have changed under it.
+ */
+struct pt_cursor {
+	struct pagetable *pt;
+	vpn_t base;			/* VPN >> pt_shift covered by @pd */
+	struct pte_directory *pd;
+};
+
+static inline void pt_cursor_init(struct pt_cursor *c, struct pagetable *pt)
+{
+	c->pt = pt;
+	c->pd = NULL;
+}
+
+static inline void pt_cursor_reset(struct pt_cursor *c)
+{
+	c->pd = NULL;
+}
+
+struct pte *pt_cursor_lookup(struct pt_cursor *c, vpn_t vpn);
+struct pte *pt_cursor_populate(struct pt_cursor *c, vpn_t vpn);
+
+typedef void (*pt_clone_fn)(struct pte *src, struct pte *dst, unsigned int nr);
+struct pte *pt_cursor_unshare(struct pt_cursor *c, vpn_t vpn, pt_clone_fn fn);
+
+/* Call @fn for each last-level directory of @pt in the ascending VPN order */
+typedef void (*pt_leaf_fn)(struct pte_directory *pd, vpn_t base, void *data);
+void pt_for_each_leaf(struct pagetable *pt, pt_leaf_fn fn, void *data);
+
+/**
+ * Duplicate the directories of @src into an empty @dst. @fn copies the @nr
+ * PTEs of each last-level directory from @src to @dst, updating both as it
+ * needs to.
+ * pt_share() duplicates the upper levels only, and the last-level directories
+ * are shared until they get unshared with pt_cursor_unshare().
+ */
+void pt_clone(struct pagetable *dst, struct pagetable *src, pt_clone_fn fn);
+void pt_share(struct pagetable *dst, struct pagetable *src);
+
+/**
+ * Free all directories of @pt in one pass, calling @fn for each valid or
+ * swapped PTE on the way. The PTEs in directories still shared with other page tables
+ * are left to them.
+ */
+typedef void (*pt_pte_fn)(struct pte *pte);
+void pt_destroy(struct pagetable *pt, pt_pte_fn fn);
+
+#endif
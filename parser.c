@@ -29,24 +29,18 @@ int parse_command(char *command, int *nr_tokens, char *tokens[])
 		if (isspace(*curr)) {
 			*curr = '\0';
 			token_started = false;
-		} else {
-			if (!token_started) {
-				tokens[*nr_tokens] = curr;
-				*nr_tokens += 1;
-				token_started = true;
-			}
+		} else if (!token_started) {
+			/* The rest of the line is a comment */
+			if (*curr == '#') break;
+
+			/* The tokens that do not fit are counted but not kept */
+			if (*nr_tokens < MAX_NR_TOKENS) tokens[*nr_tokens] = curr;
+			*nr_tokens += 1;
+			token_started = true;
 		}
 
 		curr++;
 	}
 
-	for (int i = 0; i < *nr_tokens; i++) {
-		if (strncmp(tokens[i], "#", strlen("#")) == 0) {
-			*nr_tokens = i;
-			tokens[i] = NULL;
-			break;
-		}
-	}
-
 	return (*nr_tokens > 0);
 }
@@ -39,6 +39,9 @@
  *    tokens[3] = "/path/to/dest"
  *    tokens[>=4] = NULL
  *
+ *  A token starting with # begins a comment, which runs to the end of the
+ *  line. Tokens past MAX_NR_TOKENS count in @nr_tokens, but are not stored.
+ *
  *
  * RETURN VALUE
  *  Return 1 if @nr_tokens > 0
@@ -0,0 +1,237 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "parser.h"
+#include "list_head.h"
+#include "vm.h"
+#include "trace.h"
+#include "pipeline.h"
+
+/* Times to look again at the other side before sleeping */
+#define PIPELINE_SPINS		64
+
+static inline unsigned long __load(unsigned long *index)
+{
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * The indices and the flags are published in the sequential order so that
+ * either the sleeper sees them moved, or the waker sees the sleeper
+ */
+static inline void __wake(struct trace_pipeline *p)
+{
+	if (__atomic_load_n(&p->nr_sleepers, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&p->lock);
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+static inline void __publish(struct trace_pipeline *p, unsigned long *index, unsigned long val)
+{
+	__atomic_store_n(index, val, __ATOMIC_SEQ_CST);
+	__wake(p);
+}
+
+static inline void __set_flag(struct trace_pipeline *p, bool *flag)
+{
+	__atomic_store_n(flag, true, __ATOMIC_SEQ_CST);
+	__wake(p);
+}
+
+static void __wait(struct trace_pipeline *p, bool (*ready)(struct trace_pipeline *))
+{
+	for (unsigned int i = 0; i < PIPELINE_SPINS; i++) {
+		if (ready(p)) return;
+		sched_yield();
+	}
+
+	pthread_mutex_lock(&p->lock);
+	__atomic_add_fetch(&p->nr_sleepers, 1, __ATOMIC_SEQ_CST);
+	while (!ready(p)) {
+		pthread_cond_wait(&p->cond, &p->lock);
+	}
+	__atomic_sub_fetch(&p->nr_sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static bool __has_room(struct trace_pipeline *p)
+{
+	return __atomic_load_n(&p->stop, __ATOMIC_SEQ_CST) ||
+		p->tail - __atomic_load_n(&p->head, __ATOMIC_SEQ_CST) < p->nr_records;
+}
+
+static bool __has_records(struct trace_pipeline *p)
+{
+	return __atomic_load_n(&p->eof, __ATOMIC_SEQ_CST) ||
+		__atomic_load_n(&p->tail, __ATOMIC_SEQ_CST) != p->head;
+}
+
+/* Fill the record at @tail with the line parsed, which is given back soon */
+static void __fill_record(struct pipeline_record *rec, int result,
+		struct trace_cmd *cmd, const char *name)
+{
+	free(rec->text);
+	rec->text = NULL;
+	rec->result = result;
+	rec->cmd = *cmd;
+
+	if (result == TRACE_PARSE_UNKNOWN || result == TRACE_PARSE_BAD_ARGS) {
+		rec->text = strdup(name);
+	} else if (result == TRACE_PARSE_OK && cmd->path) {
+		rec->text = strdup(cmd->path);
+		rec->cmd.path = rec->text;
+	}
+}
+
+static void *__producer_main(void *arg)
+{
+	struct trace_pipeline *p = arg;
+	char line[MAX_COMMAND_LEN] = { 0 };
+	unsigned long tail = p->tail;
+
+	while (!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE) &&
+			fgets(line, sizeof(line), p->input)) {
+		struct trace_cmd cmd;
+		char *name;
+		int result = trace_parse_line(line, &cmd, &name);
+
+		if (result == TRACE_PARSE_EMPTY) continue;
+
+		if (tail - __load(&p->head) == p->nr_records) {
+			/* Hand over what is there before waiting for the room */
+			__publish(p, &p->tail, tail);
+			__wait(p, __has_room);
+			if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) break;
+		}
+
+		__fill_record(p->records + (tail & (p->nr_records - 1)), result, &cmd, name);
+		if (++tail % p->batch == 0) __publish(p, &p->tail, tail);
+	}
+
+	__publish(p, &p->tail, tail);
+	__set_flag(p, &p->eof);
+
+	return NULL;
+}
+
+/**
+ * pipeline_parse_config()
+ *
+ * DESCRIPTION
+ *   Parse the pipeline configuration given as "records[:batch]". The ring
+ *   holds at least @records records, rounded up to a power of two, and the
+ *   batch is up to the ring. Either defaults when it is 0 or not given.
+ *
+ * RETURN
+ *   @true if @str is valid
+ *   @false otherwise
+ */
+bool pipeline_parse_config(const char *str, unsigned long *nr_records, unsigned long *batch)
+{
+	char *end;
+
+	*nr_records = PIPELINE_RECORDS;
+	*batch = PIPELINE_BATCH;
+	if (!str) return true;
+
+	*nr_records = strtoul(str, &end, 0);
+	if (!*nr_records) *nr_records = PIPELINE_RECORDS;
+	if (*end == ':') {
+		*batch = strtoul(end + 1, &end, 0);
+		if (!*batch) *batch = PIPELINE_BATCH;
+	}
+	if (*end != '\0') return false;
+
+	/* A record is in the ring until its batch is done */
+	if (*batch > *nr_records) *batch = *nr_records;
+
+	return true;
+}
+
+bool pipeline_start(struct trace_pipeline *p, FILE *input,
+		unsigned long nr_records, unsigned long batch)
+{
+	unsigned long size = 1;
+
+	while (size < nr_records) size <<= 1;
+
+	*p = (struct trace_pipeline) {
+		.input = input,
+		.records = calloc(size, sizeof(*p->records)),
+		.nr_records = size,
+		.batch = batch < size ? batch : size,
+	};
+	if (!p->records) return false;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	if (pthread_create(&p->thread, NULL, __producer_main, p)) {
+		pthread_cond_destroy(&p->cond);
+		pthread_mutex_destroy(&p->lock);
+		free(p->records);
+		return false;
+	}
+	return true;
+}
+
+unsigned long pipeline_next(struct trace_pipeline *p, struct pipeline_record **records)
+{
+	unsigned long head = p->head;
+	unsigned long tail = __load(&p->tail);
+	unsigned long nr;
+
+	if (tail == head) {
+		__wait(p, __has_records);
+		tail = __load(&p->tail);
+		if (tail == head) return 0;
+	}
+
+	/* Up to a batch, and not across the end of the ring */
+	nr = tail - head;
+	if (nr > p->batch) nr = p->batch;
+	if (nr > p->nr_records - (head & (p->nr_records - 1))) {
+		nr = p->nr_records - (head & (p->nr_records - 1));
+	}
+
+	*records = p->records + (head & (p->nr_records - 1));
+	return nr;
+}
+
+void pipeline_consume(struct trace_pipeline *p, unsigned long nr)
+{
+	__publish(p, &p->head, p->head + nr);
+}
+
+void pipeline_finish(struct trace_pipeline *p)
+{
+	__set_flag(p, &p->stop);
+	pthread_join(p->thread, NULL);
+
+	for (unsigned long i = 0; i < p->nr_records; i++) {
+		free(p->records[i].text);
+	}
+	free(p->records);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,92 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "trace.h"
+
+/**
+ * Pipelined reader of the text traces
+ *
+ * A producer thread reads and parses the lines of the trace into a ring of
+ * decoded records, and the simulation consumes them on its own thread. The
+ * ring has a single producer and a single consumer, so each side only
+ * writes its own index, and the records are handed over with release and
+ * acquire on the indices without any lock. A side only takes the lock to
+ * sleep after spinning for a while on a full or an empty ring, and the
+ * other side wakes it up after moving its index.
+ *
+ * The producer publishes its records every @batch of them, and the consumer
+ * runs up to @batch of them before giving the slots back, so the indices
+ * bounce between the caches once in a batch. When the ring of @nr_records
+ * fills up, the producer waits for the simulation to catch up, so the
+ * trace read ahead takes a fixed amount of memory however long it is.
+ *
+ * Blank lines are dropped by the producer. The names of unknown commands,
+ * and the paths of snapshots, are copied out of the line into @text, which
+ * belongs to the ring.
+ */
+#define PIPELINE_RECORDS	4096
+#define PIPELINE_BATCH		64
+
+struct pipeline_record {
+	struct trace_cmd cmd;
+	int result;		/* enum trace_parse_result */
+	char *text;		/* Command name or path of @cmd, or NULL */
+};
+
+struct trace_pipeline {
+	FILE *input;
+	struct pipeline_record *records;
+	unsigned long nr_records;	/* A power of two */
+	unsigned long batch;
+
+	unsigned long head;		/* Next record to consume */
+	unsigned long tail;		/* Next record to produce */
+	bool eof;			/* No more records after @tail */
+	bool stop;			/* The consumer went away */
+
+	pthread_t thread;
+	pthread_mutex_t lock;		/* Taken only to sleep and wake up */
+	pthread_cond_t cond;
+	unsigned int nr_sleepers;
+};
+
+bool pipeline_parse_config(const char *str, unsigned long *nr_records, unsigned long *batch);
+
+/* Start reading @input on a new thread */
+bool pipeline_start(struct trace_pipeline *p, FILE *input,
+		unsigned long nr_records, unsigned long batch);
+
+/**
+ * Wait for records and return the number of them at @*records in order,
+ * which is up to @batch. Return 0 at the end of the trace.
+ */
+unsigned long pipeline_next(struct trace_pipeline *p, struct pipeline_record **records);
+
+/* Give back the @nr records returned by pipeline_next() */
+void pipeline_consume(struct trace_pipeline *p, unsigned long nr);
+
+/* Stop reading, even if the trace is not over, and free the ring */
+void pipeline_finish(struct trace_pipeline *p);
+
+#endif
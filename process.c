@@ -0,0 +1,127 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "process.h"
+#include "slab.h"
+
+static __sim struct kmem_cache process_cache;
+
+void proc_cache_init(void)
+{
+	kmem_cache_init(&process_cache, "process", sizeof(struct process));
+}
+
+/* Release all processes at once with their slabs */
+void proc_cache_exit(void)
+{
+	kmem_cache_exit(&process_cache);
+}
+
+struct process *process_alloc(void)
+{
+	return kmem_cache_alloc(&process_cache, NULL);
+}
+
+void process_free(struct process *proc)
+{
+	kmem_cache_free(&process_cache, proc);
+}
+
+/* Multiplicative hashing with the golden ratio, as hash_32() of Linux */
+static inline unsigned int __hash_pid(struct pid_table *pt, unsigned int pid)
+{
+	return (unsigned int)(pid * 0x61C88647U) >> (32 - pt->hash_bits);
+}
+
+static struct hlist_head *__alloc_buckets(unsigned int nr_buckets)
+{
+	struct hlist_head *buckets = malloc(sizeof(*buckets) * nr_buckets);
+
+	for (unsigned int i = 0; i < nr_buckets; i++) {
+		INIT_HLIST_HEAD(buckets + i);
+	}
+	return buckets;
+}
+
+void pid_table_init(struct pid_table *pt)
+{
+	pt->hash_bits = PID_TABLE_MIN_BITS;
+	pt->nr_buckets = 1U << pt->hash_bits;
+	pt->nr_processes = 0;
+	pt->buckets = __alloc_buckets(pt->nr_buckets);
+}
+
+void pid_table_exit(struct pid_table *pt)
+{
+	free(pt->buckets);
+	pt->buckets = NULL;
+	pt->nr_buckets = pt->hash_bits = pt->nr_processes = 0;
+}
+
+static void __grow(struct pid_table *pt)
+{
+	struct hlist_head *old = pt->buckets;
+	unsigned int nr_old = pt->nr_buckets;
+
+	pt->hash_bits++;
+	pt->nr_buckets = 1U << pt->hash_bits;
+	pt->buckets = __alloc_buckets(pt->nr_buckets);
+
+	for (unsigned int i = 0; i < nr_old; i++) {
+		struct process *proc;
+		struct hlist_node *n;
+
+		hlist_for_each_entry_safe(proc, n, old + i, hash) {
+			hlist_add_head(&proc->hash, pt->buckets + __hash_pid(pt, proc->pid));
+		}
+	}
+	free(old);
+}
+
+/**
+ * pid_table_find()
+ *
+ * RETURN
+ *   The process with @pid
+ *   NULL if there is no such process
+ */
+struct process *pid_table_find(struct pid_table *pt, unsigned int pid)
+{
+	struct process *proc;
+
+	hlist_for_each_entry(proc, pt->buckets + __hash_pid(pt, pid), hash) {
+		if (proc->pid == pid) return proc;
+	}
+	return NULL;
+}
+
+void pid_table_insert(struct pid_table *pt, struct process *proc)
+{
+	if (++pt->nr_processes > pt->nr_buckets) {
+		__grow(pt);
+	}
+	hlist_add_head(&proc->hash, pt->buckets + __hash_pid(pt, proc->pid));
+}
+
+void pid_table_remove(struct pid_table *pt, struct process *proc)
+{
+	hlist_del_init(&proc->hash);
+	pt->nr_processes--;
+}
@@ -0,0 +1,53 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __PROCESS_H__
+#define __PROCESS_H__
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+
+/**
+ * Processes indexed by pid, including the running one. The ready-queue
+ * order is kept by @processes as before; this only replaces the scan of
+ * the queue to find a process by its pid.
+ *
+ * The number of buckets is doubled when the processes outnumber them, so
+ * that each bucket holds about one process on average.
+ */
+struct pid_table {
+	unsigned int nr_buckets;
+	unsigned int hash_bits;		/* nr_buckets == 1 << hash_bits */
+	unsigned int nr_processes;
+	struct hlist_head *buckets;
+};
+
+#define PID_TABLE_MIN_BITS	6
+
+/* Processes are allocated from their own slab cache */
+void proc_cache_init(void);
+void proc_cache_exit(void);
+struct process *process_alloc(void);
+void process_free(struct process *proc);
+
+void pid_table_init(struct pid_table *pt);
+void pid_table_exit(struct pid_table *pt);
+
+struct process *pid_table_find(struct pid_table *pt, unsigned int pid);
+void pid_table_insert(struct pid_table *pt, struct process *proc);
+void pid_table_remove(struct pid_table *pt, struct process *proc);
+
+#endif
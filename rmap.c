@@ -0,0 +1,139 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "pagetable.h"
+#include "rmap.h"
+
+static __sim struct rmap *rmaps;
+static __sim unsigned int nr_rmaps;
+
+void rmap_init(unsigned int nr_frames)
+{
+	rmaps = calloc(nr_frames, sizeof(*rmaps));
+	nr_rmaps = nr_frames;
+}
+
+void rmap_exit(void)
+{
+	for (unsigned int pfn = 0; pfn < nr_rmaps; pfn++) {
+		if (rmaps[pfn].capacity) free(rmaps[pfn].items);
+	}
+	free(rmaps);
+	rmaps = NULL;
+	nr_rmaps = 0;
+}
+
+static inline struct rmap_item *__items(struct rmap *r)
+{
+	return r->capacity ? r->items : &r->item;
+}
+
+void rmap_add(unsigned int pfn, struct process *proc, vpn_t vpn)
+{
+	struct rmap *r;
+
+	/* The zero frame follows the frames */
+	if (pfn >= nr_rmaps) return;
+	r = rmaps + pfn;
+
+	if (r->nr == 1 && !r->capacity) {
+		struct rmap_item item = r->item;
+
+		r->items = malloc(sizeof(*r->items) * 4);
+		r->items[0] = item;
+		r->capacity = 4;
+	} else if (r->capacity && r->nr == r->capacity) {
+		r->capacity *= 2;
+		r->items = realloc(r->items, sizeof(*r->items) * r->capacity);
+	}
+	__items(r)[r->nr++] = (struct rmap_item) { .proc = proc, .vpn = vpn };
+}
+
+void rmap_remove(unsigned int pfn, struct process *proc, vpn_t vpn)
+{
+	struct rmap *r;
+	struct rmap_item *items;
+	unsigned int i;
+
+	if (pfn >= nr_rmaps) return;
+	r = rmaps + pfn;
+	items = __items(r);
+
+	for (i = 0; i < r->nr; i++) {
+		if (items[i].proc == proc && items[i].vpn == vpn) break;
+	}
+	assert(i < r->nr);
+	items[i] = items[--r->nr];
+
+	/* Back in place when no longer shared */
+	if (r->capacity && r->nr <= 1) {
+		struct rmap_item item = items[0];
+
+		free(r->items);
+		r->capacity = 0;
+		r->item = item;
+	}
+}
+
+void rmap_clear(unsigned int pfn)
+{
+	struct rmap *r = rmaps + pfn;
+
+	if (r->capacity) free(r->items);
+	memset(r, 0x00, sizeof(*r));
+}
+
+const struct rmap_item *rmap_items(unsigned int pfn, unsigned int *nr)
+{
+	if (pfn >= nr_rmaps) {
+		*nr = 0;
+		return NULL;
+	}
+	*nr = rmaps[pfn].nr;
+	return __items(rmaps + pfn);
+}
+
+static void __add_leaf(struct pte_directory *pd, vpn_t base, void *data)
+{
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (!pte_valid(pd->ptes + i)) continue;
+		rmap_add(pte_pfn(pd->ptes + i), data, (base << pt_shift) | i);
+	}
+}
+
+static void __remove_leaf(struct pte_directory *pd, vpn_t base, void *data)
+{
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (!pte_valid(pd->ptes + i)) continue;
+		rmap_remove(pte_pfn(pd->ptes + i), data, (base << pt_shift) | i);
+	}
+}
+
+void rmap_add_pagetable(struct process *proc)
+{
+	pt_for_each_leaf(&proc->pagetable, __add_leaf, proc);
+}
+
+void rmap_remove_pagetable(struct process *proc)
+{
+	pt_for_each_leaf(&proc->pagetable, __remove_leaf, proc);
+}
@@ -0,0 +1,66 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __RMAP_H__
+#define __RMAP_H__
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * Reverse mapping from frames to the (process, VPN) pairs mapping them.
+ *
+ * Each frame in use keeps the list of the processes and VPNs whose page
+ * tables translate to it, so that the mappings of a frame are found in
+ * O(sharers) instead of scanning every page table. A directory shared by a
+ * lazy fork maps a frame with a single PTE for all processes sharing it,
+ * so a frame may have more pairs than @mapcounts[] tells. The zero frame is
+ * mapped by every lazy page and never reclaimed, so it is not tracked.
+ *
+ * The list of a frame stays in place while it has a single pair, which is
+ * the common case, and moves out to an array when shared.
+ */
+struct rmap_item {
+	struct process *proc;
+	vpn_t vpn;
+};
+
+struct rmap {
+	unsigned int nr;
+	unsigned int capacity;		/* Of @items, or 0 while in @item */
+	union {
+		struct rmap_item item;
+		struct rmap_item *items;
+	};
+};
+
+void rmap_init(unsigned int nr_frames);
+void rmap_exit(void);
+
+/* @vpn of @proc is mapped to, or unmapped from, @pfn */
+void rmap_add(unsigned int pfn, struct process *proc, vpn_t vpn);
+void rmap_remove(unsigned int pfn, struct process *proc, vpn_t vpn);
+
+/* Forget all pairs of @pfn, whose mappings are all gone */
+void rmap_clear(unsigned int pfn);
+
+/* Return the pairs mapping @pfn, and the number of them in @nr */
+const struct rmap_item *rmap_items(unsigned int pfn, unsigned int *nr);
+
+/* Add or remove the pairs for all frames the page table of @proc maps */
+void rmap_add_pagetable(struct process *proc);
+void rmap_remove_pagetable(struct process *proc);
+
+#endif
@@ -0,0 +1,172 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "runner.h"
+
+static unsigned int __job_of(struct runner_worker *w, unsigned int pos)
+{
+	return w->id + pos * w->runner->nr_threads;
+}
+
+/* Take the next job of @w, or -1 if its queue is empty */
+static unsigned int __pop_job(struct runner_worker *w)
+{
+	unsigned int job = -1;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail) job = __job_of(w, w->head++);
+	pthread_mutex_unlock(&w->lock);
+
+	return job;
+}
+
+/* Steal the last job of @victim, which is the farthest from being run */
+static unsigned int __steal_job(struct runner_worker *victim)
+{
+	unsigned int job = -1;
+
+	pthread_mutex_lock(&victim->lock);
+	if (victim->head < victim->tail) job = __job_of(victim, --victim->tail);
+	pthread_mutex_unlock(&victim->lock);
+
+	return job;
+}
+
+static unsigned int __next_job(struct runner_worker *w)
+{
+	struct runner *r = w->runner;
+	unsigned int job = __pop_job(w);
+
+	for (unsigned int i = 1; job == -1 && i < r->nr_threads; i++) {
+		job = __steal_job(r->workers + (w->id + i) % r->nr_threads);
+		if (job != -1) {
+			pthread_mutex_lock(&r->lock);
+			r->nr_steals++;
+			pthread_mutex_unlock(&r->lock);
+		}
+	}
+	return job;
+}
+
+static void *__worker_main(void *arg)
+{
+	struct runner_worker *w = arg;
+	struct runner *r = w->runner;
+	unsigned int job;
+
+	while ((job = __next_job(w)) != -1) {
+		r->fn(job, r->data);
+
+		pthread_mutex_lock(&r->lock);
+		r->done[job] = true;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return NULL;
+}
+
+static void __release(struct runner *r)
+{
+	for (unsigned int i = 0; i < r->nr_threads; i++) {
+		pthread_mutex_destroy(&r->workers[i].lock);
+	}
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	free(r->workers);
+	free(r->done);
+}
+
+/**
+ * runner_start()
+ *
+ * DESCRIPTION
+ *   Start @nr_threads workers running fn(job, @data) for each of @nr_jobs
+ *   jobs. There are no more workers than the jobs.
+ *
+ * RETURN
+ *   @false if unable to start the workers. The jobs already taken by the
+ *   started ones are finished, and the rest are not run
+ */
+bool runner_start(struct runner *r, unsigned int nr_jobs, unsigned int nr_threads,
+		runner_fn fn, void *data)
+{
+	unsigned int i;
+
+	if (nr_threads > nr_jobs) nr_threads = nr_jobs;
+	if (!nr_threads) nr_threads = 1;
+
+	r->fn = fn;
+	r->data = data;
+	r->nr_jobs = nr_jobs;
+	r->nr_threads = nr_threads;
+	r->nr_steals = 0;
+	r->done = calloc(nr_jobs ? nr_jobs : 1, sizeof(*r->done));
+	r->workers = calloc(nr_threads, sizeof(*r->workers));
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		struct runner_worker *w = r->workers + i;
+
+		w->runner = r;
+		w->id = i;
+		w->head = 0;
+		w->tail = (nr_jobs - i + nr_threads - 1) / nr_threads;
+		pthread_mutex_init(&w->lock, NULL);
+	}
+
+	/* The workers may steal from each other only after all are set up */
+	for (i = 0; i < nr_threads; i++) {
+		struct runner_worker *w = r->workers + i;
+
+		if (pthread_create(&w->thread, NULL, __worker_main, w)) break;
+	}
+	if (i == nr_threads) return true;
+
+	/* Drain the queues so that the started ones run out of jobs */
+	for (unsigned int j = 0; j < nr_threads; j++) {
+		pthread_mutex_lock(&r->workers[j].lock);
+		r->workers[j].tail = r->workers[j].head;
+		pthread_mutex_unlock(&r->workers[j].lock);
+	}
+	while (i--) {
+		pthread_join(r->workers[i].thread, NULL);
+	}
+	__release(r);
+	return false;
+}
+
+/* Wait until @job is done */
+void runner_wait(struct runner *r, unsigned int job)
+{
+	pthread_mutex_lock(&r->lock);
+	while (!r->done[job]) {
+		pthread_cond_wait(&r->cond, &r->lock);
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Wait for all the jobs, and release the workers */
+void runner_finish(struct runner *r)
+{
+	for (unsigned int i = 0; i < r->nr_threads; i++) {
+		pthread_join(r->workers[i].thread, NULL);
+	}
+	__release(r);
+}
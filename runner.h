@@ -0,0 +1,59 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __RUNNER_H__
+#define __RUNNER_H__
+
+#include <pthread.h>
+
+#include "types.h"
+
+/**
+ * Pool of threads running independent jobs, numbered from 0 to @nr_jobs - 1.
+ * Job i is queued to worker i % @nr_threads, so the workers go through the
+ * jobs roughly in order. A worker takes jobs from the head of its queue, and
+ * steals from the tail of the others' once it runs out of its own, so a few
+ * long jobs do not leave the rest of the workers idle.
+ */
+typedef void (*runner_fn)(unsigned int job, void *data);
+
+struct runner_worker {
+	struct runner *runner;
+	unsigned int id;
+	pthread_t thread;
+
+	pthread_mutex_t lock;		/* Protects @head and @tail */
+	unsigned int head, tail;	/* Jobs id + [head, tail) * nr_threads */
+};
+
+struct runner {
+	runner_fn fn;
+	void *data;
+	unsigned int nr_jobs;
+	unsigned int nr_threads;
+	struct runner_worker *workers;
+
+	pthread_mutex_t lock;		/* Protects @done and @nr_steals */
+	pthread_cond_t cond;		/* Signaled when a job is done */
+	bool *done;
+	unsigned long nr_steals;
+};
+
+bool runner_start(struct runner *r, unsigned int nr_jobs, unsigned int nr_threads,
+		runner_fn fn, void *data);
+void runner_wait(struct runner *r, unsigned int job);
+void runner_finish(struct runner *r);
+
+#endif
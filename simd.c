@@ -0,0 +1,219 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+/**
+ * Scalar kernels. They go through the PTE accessors, so they work for both
+ * layouts of PTEs.
+ */
+static bool __scalar_supported(void)
+{
+	return true;
+}
+
+static unsigned long __fork_copy_scalar(struct pte *dst, struct pte *src, unsigned int nr)
+{
+	unsigned long present = 0;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		if (pte_valid(src + i)) pte_set_rw(src + i, pte_rw(src + i) & ~ACCESS_WRITE);
+		dst[i] = src[i];
+		if (pte_present(src + i)) present |= 1UL << i;
+	}
+	return present;
+}
+
+static unsigned long __match_keys_scalar(const uint64_t *keys, unsigned int nr, uint64_t key)
+{
+	unsigned long match = 0;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		if (keys[i] == key) match |= 1UL << i;
+	}
+	return match;
+}
+
+#ifdef HAVE_X86_SIMD
+#ifndef CONFIG_UNPACKED_ENTRIES
+/**
+ * The PTE kernels work on the packed words directly, clearing the write bit
+ * of the lanes with the valid bit set.
+ */
+#define PTE_WRITE	(ACCESS_WRITE << PTE_RW_SHIFT)
+
+__attribute__((target("sse2")))
+static unsigned long __fork_copy_sse2(struct pte *dst, struct pte *src, unsigned int nr)
+{
+	const __m128i valid = _mm_set1_epi32(PTE_VALID);
+	const __m128i write = _mm_set1_epi32(PTE_WRITE);
+	const __m128i present = _mm_set1_epi32(PTE_VALID | PTE_SWAPPED);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long mask = 0;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= nr; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *)(src + i));
+		__m128i wp = _mm_cmpeq_epi32(_mm_and_si128(v, valid), valid);
+		__m128i absent = _mm_cmpeq_epi32(_mm_and_si128(v, present), zero);
+
+		v = _mm_andnot_si128(_mm_and_si128(wp, write), v);
+		_mm_storeu_si128((__m128i *)(src + i), v);
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+		mask |= (unsigned long)(~_mm_movemask_ps(_mm_castsi128_ps(absent)) & 0xf) << i;
+	}
+	if (i < nr) mask |= __fork_copy_scalar(dst + i, src + i, nr - i) << i;
+
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static unsigned long __fork_copy_avx2(struct pte *dst, struct pte *src, unsigned int nr)
+{
+	const __m256i valid = _mm256_set1_epi32(PTE_VALID);
+	const __m256i write = _mm256_set1_epi32(PTE_WRITE);
+	const __m256i present = _mm256_set1_epi32(PTE_VALID | PTE_SWAPPED);
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned long mask = 0;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= nr; i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(src + i));
+		__m256i wp = _mm256_cmpeq_epi32(_mm256_and_si256(v, valid), valid);
+		__m256i absent = _mm256_cmpeq_epi32(_mm256_and_si256(v, present), zero);
+
+		v = _mm256_andnot_si256(_mm256_and_si256(wp, write), v);
+		_mm256_storeu_si256((__m256i *)(src + i), v);
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+		mask |= (unsigned long)(~_mm256_movemask_ps(_mm256_castsi256_ps(absent)) & 0xff) << i;
+	}
+	if (i < nr) mask |= __fork_copy_sse2(dst + i, src + i, nr - i) << i;
+
+	return mask;
+}
+#else
+/* The unpacked PTEs have no words to work on in vectors */
+#define __fork_copy_sse2	__fork_copy_scalar
+#define __fork_copy_avx2	__fork_copy_scalar
+#endif
+
+/**
+ * SSE2 has no 64-bit compare. Compare the 32-bit halves, and take the lanes
+ * of which both halves match.
+ */
+__attribute__((target("sse2")))
+static unsigned long __match_keys_sse2(const uint64_t *keys, unsigned int nr, uint64_t key)
+{
+	const __m128i k = _mm_set1_epi64x(key);
+	unsigned long match = 0;
+	unsigned int i;
+
+	for (i = 0; i + 2 <= nr; i += 2) {
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(keys + i)), k);
+
+		eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		match |= (unsigned long)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+	}
+	if (i < nr) match |= __match_keys_scalar(keys + i, nr - i, key) << i;
+
+	return match;
+}
+
+__attribute__((target("avx2")))
+static unsigned long __match_keys_avx2(const uint64_t *keys, unsigned int nr, uint64_t key)
+{
+	const __m256i k = _mm256_set1_epi64x(key);
+	unsigned long match = 0;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= nr; i += 4) {
+		__m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i *)(keys + i)), k);
+
+		match |= (unsigned long)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+	}
+	if (i < nr) match |= __match_keys_sse2(keys + i, nr - i, key) << i;
+
+	return match;
+}
+
+static bool __sse2_supported(void)
+{
+	return !!__builtin_cpu_supports("sse2");
+}
+
+static bool __avx2_supported(void)
+{
+	return !!__builtin_cpu_supports("avx2");
+}
+#endif
+
+/* From the narrowest to the widest */
+static const struct simd_ops simd_impls[] = {
+	{
+		.name = "scalar",
+		.supported = __scalar_supported,
+		.fork_copy = __fork_copy_scalar,
+		.match_keys = __match_keys_scalar,
+	},
+#ifdef HAVE_X86_SIMD
+	{
+		.name = "sse2",
+		.supported = __sse2_supported,
+		.fork_copy = __fork_copy_sse2,
+		.match_keys = __match_keys_sse2,
+	},
+	{
+		.name = "avx2",
+		.supported = __avx2_supported,
+		.fork_copy = __fork_copy_avx2,
+		.match_keys = __match_keys_avx2,
+	},
+#endif
+};
+
+#define NR_SIMD_IMPLS	(sizeof(simd_impls) / sizeof(simd_impls[0]))
+
+const struct simd_ops *simd = simd_impls;
+
+bool simd_init(const char *name)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+#endif
+	for (int i = NR_SIMD_IMPLS - 1; i >= 0; i--) {
+		const struct simd_ops *ops = simd_impls + i;
+
+		if (name && strcmp(name, ops->name)) continue;
+		if (!ops->supported()) {
+			if (name) return false;
+			continue;
+		}
+		simd = ops;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,60 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <stdint.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+
+/**
+ * Kernels for the hot loops over PTEs and TLB tags, built for the vector
+ * extensions of x86. simd_init() picks the widest ones the CPU supports at
+ * startup, and the scalar ones serve the rest. All of them give the same
+ * results, so the choice only matters for the speed.
+ *
+ * The kernels work on up to BITS_PER_LONG items, and return one bit per item.
+ */
+struct simd_ops {
+	const char *name;
+	bool (*supported)(void);
+
+	/**
+	 * Copy @nr PTEs from @src to @dst, write-protecting the valid ones in
+	 * both. Return the mask of the valid or swapped ones, which the child
+	 * shares with the parent.
+	 */
+	unsigned long (*fork_copy)(struct pte *dst, struct pte *src, unsigned int nr);
+
+	/* Return the mask of @nr @keys equal to @key */
+	unsigned long (*match_keys)(const uint64_t *keys, unsigned int nr, uint64_t key);
+};
+
+extern const struct simd_ops *simd;
+
+/**
+ * Use the kernels of @name (scalar, sse2 or avx2), or the best ones the CPU
+ * supports if @name is NULL. Return false if they are unknown or unsupported.
+ */
+bool simd_init(const char *name);
+
+/* Iterate the set bits of @mask from the lowest, consuming @mask */
+#define for_each_set_bit(bit, mask) \
+	for (; (mask) && ((bit) = __builtin_ctzl(mask), 1); (mask) &= (mask) - 1)
+
+#endif
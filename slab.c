@@ -0,0 +1,181 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "slab.h"
+
+#define SLAB_MIN_SIZE		(16 * 1024)
+#define SLAB_MIN_OBJS		8
+#define SLAB_ALIGN		16
+
+struct slab {
+	struct list_head list;
+	unsigned int nr_free;
+	void *freelist;			/* Free objects chained by their first word */
+	unsigned char objs[] __attribute__((aligned(SLAB_ALIGN)));
+};
+
+/**
+ * All caches of the simulation. A thread starts with the head zeroed, so it
+ * is initialized on the first cache
+ */
+__sim struct list_head kmem_caches;
+
+static inline struct slab *__slab_of(struct kmem_cache *c, const void *obj)
+{
+	return (struct slab *)((uintptr_t)obj & ~(uintptr_t)(c->slab_size - 1));
+}
+
+void kmem_cache_init(struct kmem_cache *c, const char *name, size_t obj_size)
+{
+	c->name = name;
+	c->obj_size = (obj_size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+
+	c->slab_size = SLAB_MIN_SIZE;
+	while (c->slab_size < sizeof(struct slab) + c->obj_size * SLAB_MIN_OBJS) {
+		c->slab_size <<= 1;
+	}
+	c->nr_per_slab = (c->slab_size - sizeof(struct slab)) / c->obj_size;
+
+	INIT_LIST_HEAD(&c->partial);
+	INIT_LIST_HEAD(&c->full);
+	c->empty = NULL;
+	c->nr_slabs = c->nr_active = c->nr_allocs = c->nr_near = 0;
+
+	if (!kmem_caches.next) INIT_LIST_HEAD(&kmem_caches);
+	list_add_tail(&c->list, &kmem_caches);
+}
+
+void kmem_cache_exit(struct kmem_cache *c)
+{
+	struct slab *s, *tmp;
+
+	list_for_each_entry_safe(s, tmp, &c->partial, list) {
+		free(s);
+	}
+	list_for_each_entry_safe(s, tmp, &c->full, list) {
+		free(s);
+	}
+	free(c->empty);
+	list_del_init(&c->list);
+}
+
+static struct slab *__new_slab(struct kmem_cache *c)
+{
+	struct slab *s;
+	void **next;
+
+	if (posix_memalign((void **)&s, c->slab_size, c->slab_size)) return NULL;
+
+	s->nr_free = c->nr_per_slab;
+	s->freelist = s->objs;
+
+	/* Chain the objects in the ascending address order */
+	for (unsigned int i = 0; i < c->nr_per_slab; i++) {
+		next = (void **)(s->objs + i * c->obj_size);
+		*next = i + 1 < c->nr_per_slab ? s->objs + (i + 1) * c->obj_size : NULL;
+	}
+	c->nr_slabs++;
+
+	return s;
+}
+
+static void *__take(struct kmem_cache *c, struct slab *s)
+{
+	void *obj = s->freelist;
+
+	s->freelist = *(void **)obj;
+	if (--s->nr_free == 0) {
+		list_move(&s->list, &c->full);
+	}
+	c->nr_active++;
+	c->nr_allocs++;
+
+	return memset(obj, 0x00, c->obj_size);
+}
+
+/**
+ * kmem_cache_alloc()
+ *
+ * DESCRIPTION
+ *   Allocate an object from the slab of @near if it has a free one. Otherwise,
+ *   take it from the first partial slab, then from the spare empty slab, and
+ *   allocate a new slab only when all of them are full.
+ *
+ * RETURN
+ *   The zero-filled object
+ *   NULL if the system is out of memory
+ */
+void *kmem_cache_alloc(struct kmem_cache *c, const void *near)
+{
+	struct slab *s;
+
+	if (near) {
+		s = __slab_of(c, near);
+		if (s->nr_free) {
+			c->nr_near++;
+			return __take(c, s);
+		}
+	}
+
+	if (!list_empty(&c->partial)) {
+		return __take(c, list_first_entry(&c->partial, struct slab, list));
+	}
+
+	if (c->empty) {
+		s = c->empty;
+		c->empty = NULL;
+	} else {
+		s = __new_slab(c);
+		if (!s) return NULL;
+	}
+	list_add(&s->list, &c->partial);
+
+	return __take(c, s);
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+	struct slab *s;
+
+	if (!obj) return;
+
+	s = __slab_of(c, obj);
+	assert(s->nr_free < c->nr_per_slab);
+
+	*(void **)obj = s->freelist;
+	s->freelist = obj;
+	c->nr_active--;
+
+	if (s->nr_free++ == 0) {
+		list_move(&s->list, &c->partial);
+	}
+	if (s->nr_free < c->nr_per_slab) return;
+
+	/* Keep one empty slab around to absorb alloc/free churn */
+	list_del(&s->list);
+	if (!c->empty) {
+		c->empty = s;
+	} else {
+		free(s);
+		c->nr_slabs--;
+	}
+}
@@ -0,0 +1,62 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdlib.h>
+
+#include "types.h"
+#include "list_head.h"
+
+/**
+ * Pool of fixed-size objects. Objects are carved out of slabs, which are
+ * aligned to their size so that the slab of an object is found by masking
+ * its address. Freed objects go back to the free list of their slab and
+ * are handed out again before a new slab is allocated.
+ */
+struct kmem_cache {
+	const char *name;
+	size_t obj_size;
+	size_t slab_size;		/* Power of 2 */
+	unsigned int nr_per_slab;
+
+	struct list_head partial;	/* Slabs with free objects */
+	struct list_head full;
+	struct slab *empty;		/* A spare slab kept for reuse */
+
+	unsigned long nr_slabs;
+	unsigned long nr_active;	/* Objects in use */
+	unsigned long nr_allocs;
+	unsigned long nr_near;		/* Allocations placed next to the hint */
+
+	struct list_head list;		/* Chained in @kmem_caches */
+};
+
+/* All caches of the system */
+extern __sim struct list_head kmem_caches;
+
+void kmem_cache_init(struct kmem_cache *c, const char *name, size_t obj_size);
+void kmem_cache_exit(struct kmem_cache *c);
+
+/**
+ * Allocate a zeroed object. If @near is an object of @c, the new one is
+ * taken from the same slab when it has room, keeping related objects
+ * close together in memory.
+ */
+void *kmem_cache_alloc(struct kmem_cache *c, const void *near);
+void kmem_cache_free(struct kmem_cache *c, void *obj);
+
+#endif
@@ -0,0 +1,718 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "tlb.h"
+#include "pagetable.h"
+#include "process.h"
+#include "swap.h"
+#include "cpu.h"
+#include "rmap.h"
+#include "snapshot.h"
+
+extern unsigned int nr_pageframes;
+extern __sim unsigned int *mapcounts;
+extern bool lazy_fork;
+extern __sim struct list_head processes;
+extern __sim struct pid_table pids;
+extern __sim struct asid_allocator asids;
+
+struct section_header {
+	uint32_t tag;
+	uint32_t reserved;
+	uint64_t len;		/* Of the section following this */
+};
+
+/**
+ * A process is followed by its upper directories in the preorder, each of
+ * which is the number of its children and the index of each in it followed
+ * by the child. A last-level directory is the index of it in SNAP_LEAVES.
+ */
+#define SNAP_NO_CPU	(~0U)
+
+struct process_image {
+	uint32_t pid;
+	uint32_t asid;
+	uint64_t asid_generation;
+	uint64_t cpumask;
+	uint32_t cpu;		/* SNAP_NO_CPU if in the ready queue */
+	uint32_t has_root;
+	uint8_t mempolicy_mode;
+	uint8_t mempolicy_node;
+	uint8_t mempolicy_next;
+	uint8_t reserved[5];
+	struct stats stats;
+};
+
+/* A slot in the paging-structure cache, following the directories of a process */
+struct pt_cache_image {
+	uint32_t level;
+	uint32_t reserved;
+	uint64_t tag;
+};
+
+/* A last-level directory in SNAP_LEAVES, followed by its PTEs */
+struct leaf_image {
+	uint32_t huge;
+	uint32_t reserved;
+};
+
+static inline size_t __leaf_image_size(void)
+{
+	return sizeof(struct leaf_image) + NR_PD_ENTRIES * sizeof(struct pte);
+}
+
+void snap_write(struct snap_writer *w, const void *buf, size_t len)
+{
+	if (w->failed || !len) return;
+	if (fwrite(buf, 1, len, w->out) != len) w->failed = true;
+}
+
+bool snap_read_copy(struct snap_reader *r, void *buf, size_t len)
+{
+	const void *src = snap_read(r, len);
+
+	if (!src) return false;
+
+	memcpy(buf, src, len);
+	return true;
+}
+
+static void __begin_section(struct snap_writer *w)
+{
+	struct section_header header = { 0 };
+
+	w->section = ftell(w->out);
+	if (w->section < 0) w->failed = true;
+	snap_put(w, header);
+}
+
+/* Fill in the header of the section, now that its length is known */
+static void __end_section(struct snap_writer *w, unsigned int tag)
+{
+	long end = ftell(w->out);
+	struct section_header header = {
+		.tag = tag,
+		.len = end - w->section - sizeof(header),
+	};
+
+	if (w->failed || end < 0 || fseek(w->out, w->section, SEEK_SET)) {
+		w->failed = true;
+		return;
+	}
+	snap_put(w, header);
+	if (fseek(w->out, end, SEEK_SET)) w->failed = true;
+}
+
+static bool __get_section(struct snap_reader *r, unsigned int tag, struct snap_reader *sec)
+{
+	struct section_header header;
+
+	if (!snap_get(r, header) || header.tag != tag) return false;
+
+	sec->pos = snap_read(r, header.len);
+	if (!sec->pos) return false;
+
+	sec->end = sec->pos + header.len;
+	return true;
+}
+
+static void __fill_header(struct snapshot_header *header)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+
+	header->pte_size = sizeof(struct pte);
+	header->nr_stats = NR_STATS;
+	header->nr_pageframes = nr_pageframes;
+	header->nr_pt_levels = nr_pt_levels;
+	header->pt_shift = pt_shift;
+	header->nr_cpus = nr_cpus;
+	header->nr_tlb_entries = cpus[0].tlb.nr_entries;
+	header->nr_tlb_ways = cpus[0].tlb.nr_ways;
+	header->tlb_policy = cpus[0].tlb.policy;
+	header->nr_asids = asids.nr_asids;
+	header->nr_swap_slots = swap_nr_slots();
+	snprintf(header->swap_policy, sizeof(header->swap_policy), "%s", swap_policy_name());
+	header->lazy_fork = lazy_fork;
+	header->nr_nodes = nr_nodes;
+
+	header->this_cpu = this_cpu->id;
+}
+
+
+/**
+ * Last-level directories may be shared by page tables, so they are written
+ * once for all in SNAP_LEAVES, and numbered by their order there
+ */
+struct leaf_table {
+	struct pte_directory **leaves;
+	unsigned long nr_leaves;
+	unsigned long max_leaves;
+};
+
+static void __collect_leaf(struct pte_directory *pd, vpn_t base, void *data)
+{
+	struct leaf_table *t = data;
+
+	if (t->nr_leaves == t->max_leaves) {
+		t->max_leaves = t->max_leaves ? t->max_leaves * 2 : 64;
+		t->leaves = realloc(t->leaves, sizeof(*t->leaves) * t->max_leaves);
+	}
+	t->leaves[t->nr_leaves++] = pd;
+}
+
+static int __compare_leaves(const void *a, const void *b)
+{
+	const struct pte_directory *x = *(struct pte_directory * const *)a;
+	const struct pte_directory *y = *(struct pte_directory * const *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void __collect_pagetable(struct leaf_table *t, struct process *proc)
+{
+	pt_for_each_leaf(&proc->pagetable, __collect_leaf, t);
+}
+
+/* Sort the directories collected from all page tables, and drop the shared */
+static void __sort_leaves(struct leaf_table *t)
+{
+	unsigned long nr_unique = 0;
+
+	if (!t->nr_leaves) return;
+
+	qsort(t->leaves, t->nr_leaves, sizeof(*t->leaves), __compare_leaves);
+	for (unsigned long i = 1; i < t->nr_leaves; i++) {
+		if (t->leaves[i] != t->leaves[nr_unique]) t->leaves[++nr_unique] = t->leaves[i];
+	}
+	t->nr_leaves = nr_unique + 1;
+}
+
+static uint32_t __leaf_index(struct leaf_table *t, struct pte_directory *pd)
+{
+	struct pte_directory **leaf = bsearch(&pd, t->leaves, t->nr_leaves,
+			sizeof(*t->leaves), __compare_leaves);
+
+	return leaf - t->leaves;
+}
+
+static void __save_leaves(struct snap_writer *w, struct leaf_table *t)
+{
+	uint64_t nr_leaves = t->nr_leaves;
+
+	snap_put(w, nr_leaves);
+	for (unsigned long i = 0; i < t->nr_leaves; i++) {
+		struct leaf_image image = {
+			.huge = t->leaves[i]->huge,
+		};
+
+		snap_put(w, image);
+		snap_write(w, t->leaves[i]->ptes, NR_PD_ENTRIES * sizeof(struct pte));
+	}
+}
+
+static void __save_dir(struct snap_writer *w, struct leaf_table *t,
+		struct pte_directory *pd, unsigned int level)
+{
+	uint32_t nr_dirs = 0;
+
+	if (pt_leaf_level(level)) {
+		uint32_t index = __leaf_index(t, pd);
+
+		snap_put(w, index);
+		return;
+	}
+
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		if (pd->dirs[i]) nr_dirs++;
+	}
+	snap_put(w, nr_dirs);
+
+	for (uint32_t i = 0; i < NR_PD_ENTRIES; i++) {
+		if (!pd->dirs[i]) continue;
+		snap_put(w, i);
+		__save_dir(w, t, pd->dirs[i], level + 1);
+	}
+}
+
+/* The cache is saved as the tags, and loaded by walking to the slots again */
+static void __save_pt_cache(struct snap_writer *w, struct pagetable *pt)
+{
+	uint32_t nr_cached = 0;
+
+	for (unsigned int level = 1; level < nr_pt_levels; level++) {
+		for (unsigned int i = 0; i < PT_CACHE_ENTRIES; i++) {
+			if (pt->cache[level - 1][i].slot) nr_cached++;
+		}
+	}
+	snap_put(w, nr_cached);
+
+	for (unsigned int level = 1; level < nr_pt_levels; level++) {
+		for (unsigned int i = 0; i < PT_CACHE_ENTRIES; i++) {
+			struct pt_cache_entry *e = &pt->cache[level - 1][i];
+			struct pt_cache_image image = {
+				.level = level,
+				.tag = e->tag,
+			};
+
+			if (!e->slot) continue;
+			snap_put(w, image);
+		}
+	}
+}
+
+static void __save_process(struct snap_writer *w, struct leaf_table *t, struct process *proc)
+{
+	struct process_image image;
+
+	memset(&image, 0, sizeof(image));
+	image.pid = proc->pid;
+	image.asid = proc->asid;
+	image.asid_generation = proc->asid_generation;
+	image.cpumask = proc->cpumask;
+	image.cpu = proc->cpu ? proc->cpu->id : SNAP_NO_CPU;
+	image.has_root = proc->pagetable.root != NULL;
+	image.mempolicy_mode = proc->mempolicy.mode;
+	image.mempolicy_node = proc->mempolicy.node;
+	image.mempolicy_next = proc->mempolicy.next;
+	image.stats = proc->stats;
+	snap_put(w, image);
+
+	if (proc->pagetable.root) __save_dir(w, t, proc->pagetable.root, 0);
+	__save_pt_cache(w, &proc->pagetable);
+}
+
+/**
+ * snapshot_save()
+ *
+ * DESCRIPTION
+ *   Write the image of this simulation to @path. The running processes come
+ *   first in the order of their CPUs, followed by the ready queue in order.
+ *
+ * RETURN
+ *   @true if the image is written
+ *   @false otherwise
+ */
+bool snapshot_save(const char *path)
+{
+	struct snap_writer w = { .out = fopen(path, "w") };
+	struct snapshot_header header;
+	struct leaf_table leaves = { 0 };
+	struct process *proc;
+	struct cpu *cpu;
+	uint32_t nr_processes = 0;
+
+	if (!w.out) return false;
+
+	__fill_header(&header);
+	snap_put(&w, header);
+
+	__begin_section(&w);
+	frame_save(&w);
+	__end_section(&w, SNAP_FRAMES);
+
+	__begin_section(&w);
+	swap_save(&w);
+	__end_section(&w, SNAP_SWAP);
+
+	__begin_section(&w);
+	asid_save(&asids, &w);
+	__end_section(&w, SNAP_ASIDS);
+
+	for_each_cpu(cpu) {
+		__begin_section(&w);
+		tlb_save(&cpu->tlb, &w);
+		__end_section(&w, SNAP_TLB);
+	}
+
+	for_each_cpu(cpu) {
+		if (!cpu->curr) continue;
+		__collect_pagetable(&leaves, cpu->curr);
+		nr_processes++;
+	}
+	list_for_each_entry(proc, &processes, list) {
+		__collect_pagetable(&leaves, proc);
+		nr_processes++;
+	}
+	__sort_leaves(&leaves);
+
+	__begin_section(&w);
+	__save_leaves(&w, &leaves);
+	__end_section(&w, SNAP_LEAVES);
+
+	__begin_section(&w);
+	snap_put(&w, nr_processes);
+	for_each_cpu(cpu) {
+		if (cpu->curr) __save_process(&w, &leaves, cpu->curr);
+	}
+	list_for_each_entry(proc, &processes, list) {
+		__save_process(&w, &leaves, proc);
+	}
+	__end_section(&w, SNAP_PROCESSES);
+	free(leaves.leaves);
+
+	__begin_section(&w);
+	snap_put(&w, global_stats);
+	__end_section(&w, SNAP_STATS);
+
+	/* Now that the size is known */
+	header.size = ftell(w.out);
+	if (!w.failed && !fseek(w.out, 0, SEEK_SET)) {
+		snap_put(&w, header);
+	} else {
+		w.failed = true;
+	}
+
+	if (fclose(w.out)) w.failed = true;
+	return !w.failed;
+}
+
+
+/**
+ * snapshot_open()
+ *
+ * DESCRIPTION
+ *   Map the image at @path, and check it is taken with the configuration of
+ *   this simulation.
+ *
+ * RETURN
+ *   One of enum snapshot_result
+ */
+int snapshot_open(struct snapshot *snap, const char *path)
+{
+	struct snapshot_header header, expected;
+	struct stat st;
+	void *buf;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return SNAPSHOT_NO_FILE;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return SNAPSHOT_NO_FILE;
+	}
+	if (st.st_size < sizeof(header)) {
+		close(fd);
+		return SNAPSHOT_INVALID;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) return SNAPSHOT_NO_FILE;
+
+	memcpy(&header, buf, sizeof(header));
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) ||
+			header.size != st.st_size) {
+		munmap(buf, st.st_size);
+		return SNAPSHOT_INVALID;
+	}
+
+	__fill_header(&expected);
+	expected.size = header.size;
+	expected.this_cpu = header.this_cpu;
+	if (memcmp(&header, &expected, sizeof(header))) {
+		munmap(buf, st.st_size);
+		return SNAPSHOT_MISMATCH;
+	}
+
+	/* The whole image is read at once on restore */
+	madvise(buf, st.st_size, MADV_WILLNEED);
+
+	snap->buf = buf;
+	snap->len = st.st_size;
+	return SNAPSHOT_OK;
+}
+
+void snapshot_close(struct snapshot *snap)
+{
+	munmap((void *)snap->buf, snap->len);
+	snap->buf = NULL;
+	snap->len = 0;
+}
+
+/* The last-level directories in the mapping, allocated as they are found */
+struct leaf_loader {
+	const unsigned char *images;
+	unsigned long nr_leaves;
+	struct pte_directory **leaves;
+};
+
+static bool __load_leaves(struct leaf_loader *l, struct snap_reader *r)
+{
+	uint64_t nr_leaves;
+
+	if (!snap_get(r, nr_leaves)) return false;
+	if (nr_leaves > (r->end - r->pos) / __leaf_image_size()) return false;
+
+	l->nr_leaves = nr_leaves;
+	l->images = snap_read(r, nr_leaves * __leaf_image_size());
+	l->leaves = calloc(nr_leaves ? : 1, sizeof(*l->leaves));
+
+	return true;
+}
+
+static bool __load_dir(struct leaf_loader *l, struct snap_reader *r, unsigned int level,
+		struct pte_directory *root, struct pte_directory **slot)
+{
+	struct pte_directory *pd;
+	uint32_t nr_dirs;
+
+	if (pt_leaf_level(level)) {
+		const unsigned char *image;
+		struct leaf_image leaf;
+		uint32_t index;
+
+		if (!snap_get(r, index) || index >= l->nr_leaves) return false;
+
+		/* Shared by the page tables that came before */
+		if (l->leaves[index]) {
+			*slot = l->leaves[index];
+			(*slot)->refs++;
+			return true;
+		}
+
+		image = l->images + index * __leaf_image_size();
+		memcpy(&leaf, image, sizeof(leaf));
+
+		pd = *slot = l->leaves[index] = pd_alloc(root);
+		pd->huge = leaf.huge;
+		memcpy(pd->ptes, image + sizeof(leaf), NR_PD_ENTRIES * sizeof(struct pte));
+		return true;
+	}
+
+	pd = *slot = pd_alloc(root);
+	if (!snap_get(r, nr_dirs) || nr_dirs > NR_PD_ENTRIES) return false;
+
+	while (nr_dirs--) {
+		uint32_t i;
+
+		if (!snap_get(r, i) || i >= NR_PD_ENTRIES || pd->dirs[i]) return false;
+		if (!__load_dir(l, r, level + 1, root ? : pd, pd->dirs + i)) return false;
+	}
+	return true;
+}
+
+static bool __load_pt_cache(struct snap_reader *r, struct pagetable *pt)
+{
+	uint32_t nr_cached;
+
+	if (!snap_get(r, nr_cached)) return false;
+
+	while (nr_cached--) {
+		struct pt_cache_image image;
+
+		if (!snap_get(r, image)) return false;
+		if (!pt_cache_insert(pt, image.level, image.tag)) return false;
+	}
+	return true;
+}
+
+/**
+ * The init process of the system just set up is taken over by the one in the
+ * image. The processes go on the CPUs once all of them are in place, so that
+ * the allocations on the way are not charged to any of them.
+ */
+static bool __load_processes(struct leaf_loader *l, struct snap_reader *r)
+{
+	struct process *running[MAX_CPUS] = { NULL };
+	struct process *init = pid_table_find(&pids, 0);
+	struct process *proc;
+	bool has_init = false;
+	uint32_t nr_processes;
+
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		cpus[i].curr = NULL;
+		cpus[i].pt_base = NULL;
+	}
+	init->cpu = NULL;
+
+	if (!snap_get(r, nr_processes)) return false;
+
+	while (nr_processes--) {
+		struct process_image image;
+
+		if (!snap_get(r, image) || image.asid >= asids.nr_asids) return false;
+
+		if (image.pid == 0) {
+			if (has_init) return false;
+			proc = init;
+			has_init = true;
+		} else {
+			if (pid_table_find(&pids, image.pid)) return false;
+			proc = process_alloc();
+			proc->pid = image.pid;
+			INIT_LIST_HEAD(&proc->list);
+			pid_table_insert(&pids, proc);
+		}
+		proc->asid = image.asid;
+		proc->asid_generation = image.asid_generation;
+		proc->cpumask = image.cpumask;
+		proc->stats = image.stats;
+
+		if (image.mempolicy_mode >= NR_MPOL_MODES || image.mempolicy_node >= nr_nodes ||
+				image.mempolicy_next >= nr_nodes) {
+			return false;
+		}
+		proc->mempolicy = (struct mempolicy) {
+			.mode = image.mempolicy_mode,
+			.node = image.mempolicy_node,
+			.next = image.mempolicy_next,
+		};
+
+		if (image.has_root &&
+				!__load_dir(l, r, 0, NULL, &proc->pagetable.root)) {
+			return false;
+		}
+		if (!__load_pt_cache(r, &proc->pagetable)) return false;
+
+		if (image.cpu == SNAP_NO_CPU) {
+			list_add_tail(&proc->list, &processes);
+			continue;
+		}
+		if (image.cpu >= nr_cpus || running[image.cpu]) return false;
+		running[image.cpu] = proc;
+		proc->cpu = cpus + image.cpu;
+	}
+	if (!has_init) return false;
+
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		cpus[i].curr = running[i];
+		cpus[i].pt_base = running[i] ? &running[i]->pagetable : NULL;
+		if (running[i]) rmap_add_pagetable(running[i]);
+	}
+
+	/* The rmap is not in the image. It follows from the page tables */
+	list_for_each_entry(proc, &processes, list) {
+		rmap_add_pagetable(proc);
+	}
+	return true;
+}
+
+/**
+ * Every directory in SNAP_LEAVES should be in a page table, and their PTEs
+ * should account for @mapcounts[], with the zero frame, and the swap slots exactly
+ */
+static bool __check_leaves(struct leaf_loader *l)
+{
+	unsigned int *counts = calloc(nr_pageframes + 1, sizeof(*counts));
+	unsigned int *slot_counts = calloc(swap_nr_slots() ? : 1, sizeof(*slot_counts));
+	bool ok = true;
+
+	for (unsigned long i = 0; ok && i < l->nr_leaves; i++) {
+		struct pte_directory *pd = l->leaves[i];
+
+		if (!pd) {
+			ok = false;
+			break;
+		}
+		for (unsigned int j = 0; j < NR_PD_ENTRIES; j++) {
+			struct pte *pte = pd->ptes + j;
+
+			if (pte_valid(pte)) {
+				if (pte_pfn(pte) > nr_pageframes) {
+					ok = false;
+					break;
+				}
+				counts[pte_pfn(pte)]++;
+			} else if (pte_swapped(pte)) {
+				if (pte_pfn(pte) >= swap_nr_slots()) {
+					ok = false;
+					break;
+				}
+				slot_counts[pte_pfn(pte)]++;
+			}
+		}
+	}
+	if (ok) ok = !memcmp(counts, mapcounts, sizeof(*counts) * (nr_pageframes + 1));
+
+	for (unsigned int slot = 0; ok && slot < swap_nr_slots(); slot++) {
+		ok = slot_counts[slot] == swap_slot_count(slot);
+	}
+
+	free(slot_counts);
+	free(counts);
+	return ok;
+}
+
+/* TLB entries should translate to the frames there are, or the zero frame */
+static bool __check_tlb(struct tlb *tlb)
+{
+	struct tlb_entry *entry;
+
+	tlb_for_each_entry(entry, tlb) {
+		unsigned int nr_pages = tlb_entry_huge(entry) ? 1U << tlb->huge_shift : 1;
+
+		if (tlb_entry_pfn(entry) + (unsigned long)nr_pages > nr_pageframes + 1) return false;
+	}
+	return true;
+}
+
+/**
+ * snapshot_load()
+ *
+ * DESCRIPTION
+ *   Restore the image of @snap into the simulation just set up.
+ *
+ * RETURN
+ *   @true if the simulation is restored
+ *   @false if the image is corrupted
+ */
+bool snapshot_load(struct snapshot *snap)
+{
+	struct snapshot_header header;
+	struct snap_reader r = {
+		.pos = (const unsigned char *)snap->buf + sizeof(header),
+		.end = (const unsigned char *)snap->buf + snap->len,
+	};
+	struct snap_reader sec;
+	struct leaf_loader leaves = { 0 };
+	struct cpu *cpu;
+	bool ok = false;
+
+	memcpy(&header, snap->buf, sizeof(header));
+	if (header.this_cpu >= nr_cpus) return false;
+
+	if (!__get_section(&r, SNAP_FRAMES, &sec) || !frame_load(&sec)) return false;
+	if (!__get_section(&r, SNAP_SWAP, &sec) || !swap_load(&sec)) return false;
+	if (!__get_section(&r, SNAP_ASIDS, &sec) || !asid_load(&asids, &sec)) return false;
+	for_each_cpu(cpu) {
+		if (!__get_section(&r, SNAP_TLB, &sec) || !tlb_load(&cpu->tlb, &sec)) return false;
+		if (!__check_tlb(&cpu->tlb)) return false;
+	}
+
+	if (!__get_section(&r, SNAP_LEAVES, &sec) || !__load_leaves(&leaves, &sec)) return false;
+	if (__get_section(&r, SNAP_PROCESSES, &sec) && __load_processes(&leaves, &sec)) {
+		ok = __check_leaves(&leaves);
+	}
+	free(leaves.leaves);
+	if (!ok) return false;
+
+	if (!__get_section(&r, SNAP_STATS, &sec) || !snap_get(&sec, global_stats)) return false;
+
+	this_cpu = cpus + header.this_cpu;
+	return true;
+}
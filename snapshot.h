@@ -0,0 +1,133 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "types.h"
+
+/**
+ * Snapshot of a simulation. The processes, page tables, frames, swap,
+ * ASIDs, TLBs and counters are written to a flat image, which is mapped
+ * back later to resume the simulation from there. Traces sharing a long
+ * warm-up may then run it once and restore the image instead.
+ *
+ * Nothing in the image is a pointer. Page directories refer to each other
+ * by their index in the image, and the rest are plain arrays and numbers,
+ * which are copied out of the mapping in bulk on restore. The image starts
+ * with struct snapshot_header, and is followed by the sections in the order
+ * of enum snapshot_section, each with its tag and length. The numbers are
+ * in the native byte order and types of the build that wrote them, so an
+ * image is restored only by the same build with the same configuration.
+ */
+#define SNAPSHOT_MAGIC		"VMSNAP04"
+#define SNAPSHOT_MAGIC_LEN	8
+
+struct snapshot_header {
+	char magic[SNAPSHOT_MAGIC_LEN];
+	uint64_t size;			/* Of the whole image */
+
+	/* The configuration, which must match on restore */
+	uint32_t pte_size;		/* Tells packed PTEs from unpacked ones */
+	uint32_t nr_stats;
+	uint32_t nr_pageframes;
+	uint32_t nr_pt_levels;
+	uint32_t pt_shift;
+	uint32_t nr_cpus;
+	uint32_t nr_tlb_entries;
+	uint32_t nr_tlb_ways;
+	uint32_t tlb_policy;
+	uint32_t nr_asids;
+	uint32_t nr_swap_slots;
+	char swap_policy[8];
+	uint32_t lazy_fork;
+	uint32_t nr_nodes;
+
+	uint32_t this_cpu;
+};
+
+enum snapshot_section {
+	SNAP_FRAMES = 1,	/* Frame allocator, mapcounts[] and page_tags[] */
+	SNAP_SWAP,		/* Swap slots and the replacement policy */
+	SNAP_ASIDS,
+	SNAP_TLB,		/* One for each CPU */
+	SNAP_LEAVES,		/* Last-level directories */
+	SNAP_PROCESSES,		/* Processes and their upper directories */
+	SNAP_STATS,
+};
+
+/**
+ * Each subsystem writes its own part of the image through a writer, and
+ * reads it back from a reader over its section of the mapping.
+ */
+struct snap_writer {
+	FILE *out;
+	long section;		/* Offset of the section being written */
+	bool failed;
+};
+
+struct snap_reader {
+	const unsigned char *pos;
+	const unsigned char *end;
+};
+
+void snap_write(struct snap_writer *w, const void *buf, size_t len);
+
+/* Return @len bytes at the current position, or NULL if they are not there */
+static inline const void *snap_read(struct snap_reader *r, size_t len)
+{
+	const unsigned char *buf = r->pos;
+
+	if (len > (size_t)(r->end - r->pos)) return NULL;
+
+	r->pos += len;
+	return buf;
+}
+
+/* Copy @len bytes out to @buf. Return false if they are not there */
+bool snap_read_copy(struct snap_reader *r, void *buf, size_t len);
+
+#define snap_put(w, val)	snap_write(w, &(val), sizeof(val))
+#define snap_get(r, val)	snap_read_copy(r, &(val), sizeof(val))
+
+enum snapshot_result {
+	SNAPSHOT_OK = 0,
+	SNAPSHOT_NO_FILE,	/* Unable to open or map the file */
+	SNAPSHOT_INVALID,	/* Not an image, or truncated */
+	SNAPSHOT_MISMATCH,	/* Taken with another configuration */
+};
+
+/* Write the image of this simulation to @path */
+bool snapshot_save(const char *path);
+
+/**
+ * An image mapped by snapshot_open(), which checks its header against the
+ * configuration. snapshot_load() then restores it into a simulation that is
+ * just set up, and returns false if the image turns out to be corrupted.
+ * The simulation is left half-restored then, and should be set up again.
+ */
+struct snapshot {
+	const void *buf;
+	size_t len;
+};
+
+int snapshot_open(struct snapshot *snap, const char *path);
+bool snapshot_load(struct snapshot *snap);
+void snapshot_close(struct snapshot *snap);
+
+#endif
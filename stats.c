@@ -0,0 +1,49 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "stats.h"
+#include "cpu.h"
+
+const char * const stat_names[NR_STATS] = {
+#define __STAT_NAME(name) [STAT_##name] = #name,
+	STAT_COUNTERS(__STAT_NAME)
+#undef __STAT_NAME
+};
+
+__sim struct stats global_stats;
+
+void count_events(enum stat_item item, unsigned long nr)
+{
+	/* An idle CPU has no process to charge */
+	if (current) current->stats.count[item] += nr;
+	global_stats.count[item] += nr;
+}
+
+void count_event(enum stat_item item)
+{
+	count_events(item, 1);
+}
+
+void stats_dump(FILE *out, const char *scope, const struct stats *stats)
+{
+	for (unsigned int i = 0; i < NR_STATS; i++) {
+		fprintf(out, "%s %s %lu\n", scope, stat_names[i], stats->count[i]);
+	}
+}
@@ -0,0 +1,89 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+
+#include "types.h"
+
+/**
+ * Event counters of the simulator. Each of them is kept for every process
+ * and for the whole system. Add a counter to the list below and count it
+ * with count_event(); the rest follows from the list.
+ */
+#define STAT_COUNTERS(X)						\
+	X(accesses)		/* Accesses to the memory */		\
+	X(cycles)		/* Their cost in the model of cost.h */	\
+	X(tlb_read_hits)						\
+	X(tlb_read_misses)						\
+	X(tlb_write_hits)						\
+	X(tlb_write_misses)						\
+	X(tlb_huge_hits)	/* Hits on huge entries */		\
+	X(tlb_prefetches)	/* Entries filled ahead of the use */	\
+	X(tlb_prefetch_hits)	/* Misses the prefetches avoided */	\
+	X(tlb_shootdowns)	/* Remote CPUs interrupted to flush */	\
+	X(shootdown_entries)	/* Entries they flushed */		\
+	X(pt_walks)		/* Page table walks */			\
+	X(pt_walk_reads)	/* Directory entries the walks read */	\
+	X(pt_cache_hits)	/* Walks resumed from a cached slot */	\
+	X(pt_cache_skips)	/* Levels they skipped */		\
+	X(pd_allocs)		/* Page directories allocated */	\
+	X(pd_unshares)		/* Shared directories copied */		\
+	X(huge_allocs)		/* Huge pages allocated */		\
+	X(huge_splits)		/* Huge pages split into small ones */	\
+	X(faults_cow_copy)	/* COW faults copying the page */	\
+	X(faults_cow_promote)	/* COW faults on the last mapping */	\
+	X(cow_reuses)		/* Last mappings made writable early */	\
+	X(faults_failed)	/* Faults unable to handle */		\
+	X(faults_swapin)	/* Faults bringing a page back */	\
+	X(faults_demand)	/* First accesses to lazy pages */	\
+	X(faults_around)	/* Pages resolved around faults */	\
+	X(swap_outs)		/* Pages written to the swap */		\
+	X(numa_local)		/* Accesses to frames on the node */	\
+	X(numa_remote)		/* Accesses to frames on other nodes */	\
+	X(numa_misses)		/* Frames off the node of the policy */	\
+	X(numa_migrations)	/* Pages moved to the accessing node */	\
+	X(ksm_scans)		/* Merge passes over the frames */	\
+	X(ksm_merges)		/* Frames freed by merging them */	\
+	X(ksm_cow_faults)	/* Write faults on merged frames */	\
+	X(forks)							\
+	X(exits)
+
+enum stat_item {
+#define __STAT_ENUM(name) STAT_##name,
+	STAT_COUNTERS(__STAT_ENUM)
+#undef __STAT_ENUM
+	NR_STATS,
+};
+
+struct stats {
+	unsigned long count[NR_STATS];
+};
+
+extern const char * const stat_names[NR_STATS];
+
+/* Counters of the whole system, including the exited processes */
+extern __sim struct stats global_stats;
+
+/* Count @item for @current and the system */
+void count_event(enum stat_item item);
+void count_events(enum stat_item item, unsigned long nr);
+
+/* Print @stats as "@scope counter value" lines */
+void stats_dump(FILE *out, const char *scope, const struct stats *stats);
+
+#endif
@@ -0,0 +1,445 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "bitmap.h"
+#include "swap.h"
+
+extern __sim unsigned int *mapcounts;
+
+/**
+ * Swap slots. A bit is set for each free slot
+ */
+static __sim struct hbitmap free_slots;
+static __sim unsigned int *slot_counts;
+static __sim unsigned int nr_slots;
+static __sim unsigned int nr_free;
+
+/**
+ * Frames are tracked by the replacement policy while they are in use
+ */
+static __sim unsigned int nr_frames;
+__sim unsigned char *frame_referenced = NULL;
+__sim unsigned long swap_tick_left;
+
+struct swap_policy_ops {
+	const char *name;
+	void (*init)(void);
+	void (*exit)(void);
+	void (*track)(unsigned int pfn);
+	unsigned int (*select)(unsigned int keep);
+	void (*tick)(void);
+
+	void (*save)(struct snap_writer *w);
+	bool (*load)(struct snap_reader *r);
+};
+
+static __sim const struct swap_policy_ops *policy_ops;
+
+static inline bool __frame_in_use(unsigned int pfn)
+{
+	return mapcounts[pfn] != 0;
+}
+
+
+/**
+ * FIFO keeps the frames in the order they are put in use
+ */
+static __sim struct list_head *fifo_nodes;
+static __sim struct list_head fifo_queue;
+
+static void __fifo_init(void)
+{
+	INIT_LIST_HEAD(&fifo_queue);
+	fifo_nodes = malloc(sizeof(*fifo_nodes) * nr_frames);
+	for (unsigned int i = 0; i < nr_frames; i++) {
+		INIT_LIST_HEAD(fifo_nodes + i);
+	}
+}
+
+static void __fifo_exit(void)
+{
+	INIT_LIST_HEAD(&fifo_queue);
+	free(fifo_nodes);
+}
+
+static void __fifo_track(unsigned int pfn)
+{
+	list_move_tail(fifo_nodes + pfn, &fifo_queue);
+}
+
+static unsigned int __fifo_select(unsigned int keep)
+{
+	struct list_head *node, *tmp;
+
+	list_for_each_safe(node, tmp, &fifo_queue) {
+		unsigned int pfn = node - fifo_nodes;
+
+		/* Freed since it was tracked */
+		if (!__frame_in_use(pfn)) {
+			list_del_init(node);
+			continue;
+		}
+		if (pfn == keep) continue;
+
+		list_del_init(node);
+		return pfn;
+	}
+	return -1;
+}
+
+/* The tracked frames in the order of the queue */
+static void __fifo_save(struct snap_writer *w)
+{
+	struct list_head *node;
+	unsigned int nr_tracked = 0;
+
+	list_for_each(node, &fifo_queue) {
+		nr_tracked++;
+	}
+	snap_put(w, nr_tracked);
+
+	list_for_each(node, &fifo_queue) {
+		unsigned int pfn = node - fifo_nodes;
+
+		snap_put(w, pfn);
+	}
+}
+
+static bool __fifo_load(struct snap_reader *r)
+{
+	unsigned int nr_tracked;
+
+	if (!snap_get(r, nr_tracked)) return false;
+
+	while (nr_tracked--) {
+		unsigned int pfn;
+
+		if (!snap_get(r, pfn) || pfn >= nr_frames) return false;
+		if (!list_empty(fifo_nodes + pfn)) return false;
+
+		list_add_tail(fifo_nodes + pfn, &fifo_queue);
+	}
+	return true;
+}
+
+
+/**
+ * Clock sweeps the frames with a hand, giving a second chance to the ones
+ * referenced since the last sweep
+ */
+static __sim unsigned int clock_hand;
+
+static void __clock_init(void)
+{
+	clock_hand = 0;
+}
+
+static void __clock_track(unsigned int pfn)
+{
+	frame_referenced[pfn] = 1;
+}
+
+static unsigned int __clock_select(unsigned int keep)
+{
+	/* Two rounds at most; all reference bits are clear after the first */
+	for (unsigned long i = 0; i < 2UL * nr_frames; i++) {
+		unsigned int pfn = clock_hand;
+
+		clock_hand = (clock_hand + 1) % nr_frames;
+
+		if (!__frame_in_use(pfn) || pfn == keep) continue;
+		if (frame_referenced[pfn]) {
+			frame_referenced[pfn] = 0;
+			continue;
+		}
+		return pfn;
+	}
+	return -1;
+}
+
+static void __clock_save(struct snap_writer *w)
+{
+	snap_put(w, clock_hand);
+}
+
+static bool __clock_load(struct snap_reader *r)
+{
+	return snap_get(r, clock_hand) && clock_hand < nr_frames;
+}
+
+
+/**
+ * LRU approximation with aging. On each tick, the referenced bits are shifted
+ * into the 8-bit ages of the frames, so the frame with the smallest age is
+ * the least recently used one. The search for it starts after the previous
+ * victim, so that the frames with the same age are evicted in turn.
+ */
+static __sim unsigned char *lru_ages;
+static __sim unsigned int lru_hand;
+
+static void __lru_init(void)
+{
+	lru_ages = calloc(nr_frames, sizeof(*lru_ages));
+	lru_hand = 0;
+}
+
+static void __lru_exit(void)
+{
+	free(lru_ages);
+}
+
+static void __lru_track(unsigned int pfn)
+{
+	lru_ages[pfn] = 0;
+	frame_referenced[pfn] = 1;
+}
+
+static void __lru_tick(void)
+{
+	for (unsigned int pfn = 0; pfn < nr_frames; pfn++) {
+		lru_ages[pfn] = (lru_ages[pfn] >> 1) | (frame_referenced[pfn] << 7);
+		frame_referenced[pfn] = 0;
+	}
+}
+
+static unsigned int __lru_select(unsigned int keep)
+{
+	unsigned int victim = -1;
+	unsigned int victim_age = ~0U;
+
+	for (unsigned int i = 0; i < nr_frames; i++) {
+		unsigned int pfn = (lru_hand + i) % nr_frames;
+		/* Referenced since the last tick is more recent than any age */
+		unsigned int age = frame_referenced[pfn] << 8 | lru_ages[pfn];
+
+		if (!__frame_in_use(pfn) || pfn == keep) continue;
+		if (age < victim_age) {
+			victim = pfn;
+			victim_age = age;
+			if (!age) break;
+		}
+	}
+	if (victim != -1) lru_hand = (victim + 1) % nr_frames;
+
+	return victim;
+}
+
+static void __lru_save(struct snap_writer *w)
+{
+	snap_write(w, lru_ages, sizeof(*lru_ages) * nr_frames);
+	snap_put(w, lru_hand);
+}
+
+static bool __lru_load(struct snap_reader *r)
+{
+	return snap_read_copy(r, lru_ages, sizeof(*lru_ages) * nr_frames) &&
+			snap_get(r, lru_hand) && lru_hand < nr_frames;
+}
+
+
+static const struct swap_policy_ops policies[NR_SWAP_POLICIES] = {
+	[SWAP_POLICY_FIFO] = {
+		.name = "fifo",
+		.init = __fifo_init,
+		.exit = __fifo_exit,
+		.track = __fifo_track,
+		.select = __fifo_select,
+		.save = __fifo_save,
+		.load = __fifo_load,
+	},
+	[SWAP_POLICY_CLOCK] = {
+		.name = "clock",
+		.init = __clock_init,
+		.track = __clock_track,
+		.select = __clock_select,
+		.save = __clock_save,
+		.load = __clock_load,
+	},
+	[SWAP_POLICY_LRU] = {
+		.name = "lru",
+		.init = __lru_init,
+		.exit = __lru_exit,
+		.track = __lru_track,
+		.select = __lru_select,
+		.tick = __lru_tick,
+		.save = __lru_save,
+		.load = __lru_load,
+	},
+};
+
+/**
+ * swap_parse_config()
+ *
+ * DESCRIPTION
+ *   Parse the swap configuration given as "slots[:fifo|clock|lru]".
+ *   The policy defaults to clock.
+ *
+ * RETURN
+ *   @true if @str is valid
+ *   @false otherwise
+ */
+bool swap_parse_config(const char *str, unsigned int *nr_slots, enum swap_policy *policy)
+{
+	char *end;
+
+	*nr_slots = strtoul(str, &end, 0);
+	if (!*nr_slots) return false;
+
+	*policy = SWAP_POLICY_CLOCK;
+	if (*end == '\0') return true;
+	if (*end != ':') return false;
+
+	for (unsigned int i = 0; i < NR_SWAP_POLICIES; i++) {
+		if (strcmp(end + 1, policies[i].name) == 0) {
+			*policy = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void swap_init(unsigned int slots, enum swap_policy policy, unsigned int frames)
+{
+	nr_slots = nr_free = slots;
+	hbitmap_init(&free_slots, nr_slots, true);
+	slot_counts = calloc(nr_slots, sizeof(*slot_counts));
+
+	nr_frames = frames;
+	/* The zero frame is marked as well, but never looked at */
+	frame_referenced = calloc(nr_frames + 1, sizeof(*frame_referenced));
+
+	policy_ops = policies + policy;
+	policy_ops->init();
+	swap_tick_left = nr_frames;
+}
+
+void swap_exit(void)
+{
+	if (!policy_ops) return;
+
+	if (policy_ops->exit) policy_ops->exit();
+	policy_ops = NULL;
+
+	free(frame_referenced);
+	frame_referenced = NULL;
+	free(slot_counts);
+	hbitmap_exit(&free_slots);
+	nr_slots = nr_free = 0;
+}
+
+bool swap_enabled(void)
+{
+	return policy_ops != NULL;
+}
+
+const char *swap_policy_name(void)
+{
+	return policy_ops ? policy_ops->name : "none";
+}
+
+unsigned int swap_nr_slots(void)
+{
+	return nr_slots;
+}
+
+unsigned int nr_free_swap_slots(void)
+{
+	return nr_free;
+}
+
+unsigned int swap_slot_alloc(void)
+{
+	unsigned long slot = hbitmap_first(&free_slots);
+
+	if (slot == HBITMAP_NONE) return SWAP_SLOT_NONE;
+
+	hbitmap_clear(&free_slots, slot);
+	slot_counts[slot] = 1;
+	nr_free--;
+
+	return slot;
+}
+
+unsigned int swap_slot_count(unsigned int slot)
+{
+	return slot_counts[slot];
+}
+
+void swap_slot_get(unsigned int slot)
+{
+	assert(slot_counts[slot]);
+	slot_counts[slot]++;
+}
+
+void swap_slot_put(unsigned int slot)
+{
+	assert(slot_counts[slot]);
+	if (--slot_counts[slot]) return;
+
+	hbitmap_set(&free_slots, slot);
+	nr_free++;
+}
+
+void swap_tick(void)
+{
+	swap_tick_left = nr_frames;
+	if (policy_ops->tick) policy_ops->tick();
+}
+
+void swap_track_frame(unsigned int pfn)
+{
+	if (policy_ops) policy_ops->track(pfn);
+}
+
+unsigned int swap_select_victim(unsigned int keep)
+{
+	if (!policy_ops) return -1;
+	return policy_ops->select(keep);
+}
+
+void swap_save(struct snap_writer *w)
+{
+	if (!policy_ops) return;
+
+	snap_write(w, slot_counts, sizeof(*slot_counts) * nr_slots);
+	snap_write(w, frame_referenced, sizeof(*frame_referenced) * nr_frames);
+	snap_put(w, swap_tick_left);
+	policy_ops->save(w);
+}
+
+bool swap_load(struct snap_reader *r)
+{
+	if (!policy_ops) return true;
+
+	if (!snap_read_copy(r, slot_counts, sizeof(*slot_counts) * nr_slots)) return false;
+	for (unsigned int slot = 0; slot < nr_slots; slot++) {
+		if (!slot_counts[slot]) continue;
+		hbitmap_clear(&free_slots, slot);
+		nr_free--;
+	}
+
+	if (!snap_read_copy(r, frame_referenced, sizeof(*frame_referenced) * nr_frames)) {
+		return false;
+	}
+	if (!snap_get(r, swap_tick_left) || !swap_tick_left) return false;
+
+	return policy_ops->load(r);
+}
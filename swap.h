@@ -0,0 +1,102 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include "types.h"
+#include "snapshot.h"
+
+/**
+ * Simulated swap device and page reclaim. When all frames are in use, a
+ * victim frame is chosen by the replacement policy, its mappings are turned
+ * into swap entries pointing to a swap slot, and the frame is reused. The
+ * page is brought back to a new frame on the next fault to it.
+ *
+ * A swap entry is a PTE with @swapped set and the slot number in @pfn.
+ * Like a frame, each slot counts the swap entries pointing to it.
+ */
+enum swap_policy {
+	SWAP_POLICY_FIFO,	/* Evict the page mapped first */
+	SWAP_POLICY_CLOCK,	/* Second chance with the referenced bits */
+	SWAP_POLICY_LRU,	/* Approximate LRU by aging the referenced bits */
+	NR_SWAP_POLICIES,
+};
+
+#define SWAP_SLOT_NONE	(~0U)
+
+bool swap_parse_config(const char *str, unsigned int *nr_slots, enum swap_policy *policy);
+
+void swap_init(unsigned int nr_slots, enum swap_policy policy, unsigned int nr_frames);
+void swap_exit(void);
+
+/* Whether the swap device is configured at all */
+bool swap_enabled(void);
+
+unsigned int swap_nr_slots(void);
+unsigned int nr_free_swap_slots(void);
+
+/**
+ * Allocate the free slot with the smallest number with one swap entry to it.
+ * Return SWAP_SLOT_NONE if the device is full.
+ */
+unsigned int swap_slot_alloc(void);
+
+/* The number of swap entries to @slot */
+unsigned int swap_slot_count(unsigned int slot);
+
+/* Add or drop a swap entry to @slot. The slot is freed on the last one */
+void swap_slot_get(unsigned int slot);
+void swap_slot_put(unsigned int slot);
+
+/**
+ * Replacement policy. The policy is told about every frame newly put in use,
+ * and the MMU marks the frames referenced on each access. Frames freed in the
+ * meantime are skipped as the policy finds them.
+ *
+ * The accesses also drive a clock tick, which happens once every as many
+ * accesses as there are frames.
+ */
+extern __sim unsigned char *frame_referenced;
+extern __sim unsigned long swap_tick_left;
+
+void swap_tick(void);
+
+static inline void swap_mark_referenced(unsigned int pfn)
+{
+	if (!frame_referenced) return;
+
+	frame_referenced[pfn] = 1;
+	if (--swap_tick_left == 0) swap_tick();
+}
+
+void swap_track_frame(unsigned int pfn);
+
+/**
+ * Choose the frame to evict other than @keep, which the caller is about to
+ * use. Return -1 if there is no frame to evict.
+ */
+unsigned int swap_select_victim(unsigned int keep);
+
+const char *swap_policy_name(void);
+
+/**
+ * Write the slots and the state of the policy to a snapshot, and read them
+ * back into the swap just set up in the same configuration
+ */
+void swap_save(struct snap_writer *w);
+bool swap_load(struct snap_reader *r);
+
+#endif
@@ -0,0 +1,549 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "tlb.h"
+#include "simd.h"
+
+static const char * const tlb_policy_names[] = {
+	[TLB_POLICY_FIFO] = "fifo",
+	[TLB_POLICY_LRU] = "lru",
+	[TLB_POLICY_RANDOM] = "random",
+};
+
+/**
+ * tlb_parse_config()
+ *
+ * DESCRIPTION
+ *   Parse the TLB geometry given as "entries[:ways[:policy]]". The number of
+ *   sets (@nr_entries / @nr_ways) should be a power of two.
+ *
+ * RETURN
+ *   @true if @str describes a valid geometry
+ *   @false otherwise
+ */
+bool tlb_parse_config(const char *str, unsigned int *nr_entries,
+		unsigned int *nr_ways, enum tlb_policy *policy)
+{
+	char *end;
+	unsigned int nr_sets;
+
+	*nr_entries = strtoul(str, &end, 0);
+	if (*end == ':') {
+		*nr_ways = strtoul(end + 1, &end, 0);
+	}
+	if (*end == ':') {
+		int i;
+		for (i = 0; i < sizeof(tlb_policy_names) / sizeof(*tlb_policy_names); i++) {
+			if (strcmp(end + 1, tlb_policy_names[i]) == 0) break;
+		}
+		if (i == sizeof(tlb_policy_names) / sizeof(*tlb_policy_names)) return false;
+		*policy = i;
+		end += strlen(end);
+	}
+	if (*end != '\0') return false;
+
+	if (!*nr_entries || !*nr_ways || *nr_ways > *nr_entries) return false;
+	if (*nr_entries % *nr_ways) return false;
+
+	nr_sets = *nr_entries / *nr_ways;
+	return (nr_sets & (nr_sets - 1)) == 0;
+}
+
+void tlb_init(struct tlb *tlb, unsigned int nr_entries, unsigned int nr_ways,
+		enum tlb_policy policy, unsigned int huge_shift)
+{
+	tlb->nr_entries = nr_entries;
+	tlb->nr_ways = nr_ways;
+	tlb->nr_sets = nr_entries / nr_ways;
+	tlb->policy = policy;
+	tlb->huge_shift = huge_shift;
+	tlb->clock = 0;
+	tlb->seed = 0x2545f4914f6cdd1dUL;
+
+	assert((tlb->nr_sets & (tlb->nr_sets - 1)) == 0);
+
+	tlb->entries = calloc(nr_entries, sizeof(*tlb->entries));
+	tlb->keys = calloc(nr_entries, sizeof(*tlb->keys));
+	INIT_LIST_HEAD(&tlb->fifo);
+
+	tlb->prefetcher.policy = TLB_PREFETCH_NONE;
+	tlb->prefetcher.degree = 0;
+	tlb->prefetcher.last_miss = 0;
+	tlb->prefetcher.stride = 0;
+
+	tlb->nr_hits = tlb->nr_misses = 0;
+	tlb->nr_flushes = tlb->nr_asid_flushes = 0;
+	tlb->nr_prefetches = tlb->nr_prefetch_hits = 0;
+}
+
+void tlb_exit(struct tlb *tlb)
+{
+	free(tlb->entries);
+	tlb->entries = NULL;
+	free(tlb->keys);
+	tlb->keys = NULL;
+	INIT_LIST_HEAD(&tlb->fifo);
+}
+
+static const char * const tlb_prefetch_names[] = {
+	[TLB_PREFETCH_NONE] = "none",
+	[TLB_PREFETCH_NEXT] = "next",
+	[TLB_PREFETCH_STRIDE] = "stride",
+};
+
+const char *tlb_prefetch_name(enum tlb_prefetch_policy policy)
+{
+	return tlb_prefetch_names[policy];
+}
+
+/**
+ * tlb_parse_prefetch()
+ *
+ * DESCRIPTION
+ *   Parse the prefetcher given as "policy[:degree]", where @degree is the
+ *   number of VPNs to prefetch on a miss (default TLB_PREFETCH_DEGREE).
+ *
+ * RETURN
+ *   @true if @str describes a valid prefetcher
+ *   @false otherwise
+ */
+bool tlb_parse_prefetch(const char *str, enum tlb_prefetch_policy *policy,
+		unsigned int *degree)
+{
+	size_t len = strcspn(str, ":");
+	int i;
+
+	for (i = 0; i < sizeof(tlb_prefetch_names) / sizeof(*tlb_prefetch_names); i++) {
+		if (strlen(tlb_prefetch_names[i]) == len &&
+				strncmp(str, tlb_prefetch_names[i], len) == 0) break;
+	}
+	if (i == sizeof(tlb_prefetch_names) / sizeof(*tlb_prefetch_names)) return false;
+	*policy = i;
+
+	*degree = TLB_PREFETCH_DEGREE;
+	if (str[len] == ':') {
+		char *end;
+
+		*degree = strtoul(str + len + 1, &end, 0);
+		if (*end != '\0' || !*degree) return false;
+	}
+	return true;
+}
+
+long tlb_prefetch_stride(struct tlb *tlb, vpn_t vpn)
+{
+	struct tlb_prefetcher *p = &tlb->prefetcher;
+	long stride = (long)(vpn - p->last_miss);
+	bool repeated = stride && stride == p->stride;
+
+	p->last_miss = vpn;
+	p->stride = stride;
+
+	switch (p->policy) {
+	case TLB_PREFETCH_NEXT:
+		return 1;
+	case TLB_PREFETCH_STRIDE:
+		return repeated ? stride : 0;
+	default:
+		return 0;
+	}
+}
+
+static inline struct tlb_entry *__tlb_set(struct tlb *tlb, vpn_t vpn)
+{
+	return tlb->entries + (vpn & (tlb->nr_sets - 1)) * tlb->nr_ways;
+}
+
+static inline bool __tlb_match(struct tlb_entry *entry, unsigned int asid,
+		vpn_t vpn, bool huge)
+{
+	return entry->vpn == vpn && entry->asid == asid && tlb_entry_huge(entry) == huge;
+}
+
+static inline void __tlb_clear(struct tlb *tlb, struct tlb_entry *entry)
+{
+	tlb_entry_clear(entry);
+	tlb->keys[entry - tlb->entries] = 0;
+	list_del(&entry->list);
+}
+
+/**
+ * Compare the keys of the set in vectors, and check the ASIDs of the entries
+ * with the key. Another address space may have the same VPN in the set.
+ */
+static struct tlb_entry *__tlb_find(struct tlb *tlb, unsigned int asid,
+		vpn_t vpn, bool huge)
+{
+	struct tlb_entry *set = __tlb_set(tlb, huge ? vpn >> tlb->huge_shift : vpn);
+	const uint64_t *keys = tlb->keys + (set - tlb->entries);
+	uint64_t key = tlb_key(vpn, huge);
+
+	for (unsigned int i = 0; i < tlb->nr_ways; i += BITS_PER_LONG) {
+		unsigned int n = tlb->nr_ways - i < BITS_PER_LONG ? tlb->nr_ways - i : BITS_PER_LONG;
+		unsigned long match = simd->match_keys(keys + i, n, key);
+		unsigned int bit;
+
+		for_each_set_bit(bit, match) {
+			if (set[i + bit].asid == asid) return set + i + bit;
+		}
+	}
+	return NULL;
+}
+
+struct tlb_entry *tlb_find(struct tlb *tlb, unsigned int asid, vpn_t vpn)
+{
+	return __tlb_find(tlb, asid, vpn, false);
+}
+
+struct tlb_entry *tlb_find_huge(struct tlb *tlb, unsigned int asid, vpn_t vpn)
+{
+	vpn_t base = vpn & ~((1UL << tlb->huge_shift) - 1);
+
+	return __tlb_find(tlb, asid, base, true);
+}
+
+static struct tlb_entry *__select_victim(struct tlb *tlb, struct tlb_entry *set)
+{
+	struct tlb_entry *victim = set;
+
+	if (tlb->policy == TLB_POLICY_RANDOM) {
+		/* xorshift64 */
+		tlb->seed ^= tlb->seed << 13;
+		tlb->seed ^= tlb->seed >> 7;
+		tlb->seed ^= tlb->seed << 17;
+		return set + tlb->seed % tlb->nr_ways;
+	}
+
+	/* FIFO and LRU both evict the entry with the oldest timestamp */
+	for (unsigned int i = 1; i < tlb->nr_ways; i++) {
+		if (set[i].stamp < victim->stamp) victim = set + i;
+	}
+	return victim;
+}
+
+static struct tlb_entry *__tlb_fill(struct tlb *tlb, unsigned int asid,
+		vpn_t vpn, bool huge)
+{
+	struct tlb_entry *set = __tlb_set(tlb, huge ? vpn >> tlb->huge_shift : vpn);
+	struct tlb_entry *entry = NULL;
+
+	for (unsigned int i = 0; i < tlb->nr_ways; i++) {
+		if (!tlb_entry_valid(set + i)) {
+			if (!entry) entry = set + i;
+		} else if (__tlb_match(set + i, asid, vpn, huge)) {
+			tlb_touch(tlb, set + i);
+			return set + i;
+		}
+	}
+
+	if (!entry) {
+		entry = __select_victim(tlb, set);
+		tlb_invalidate(tlb, entry);
+	}
+
+	tlb_entry_mkvalid(entry, huge);
+	entry->asid = asid;
+	entry->vpn = vpn;
+	tlb->keys[entry - tlb->entries] = tlb_key(vpn, huge);
+	entry->stamp = ++tlb->clock;
+	list_add_tail(&entry->list, &tlb->fifo);
+
+	return entry;
+}
+
+struct tlb_entry *tlb_fill(struct tlb *tlb, unsigned int asid, vpn_t vpn)
+{
+	return __tlb_fill(tlb, asid, vpn, false);
+}
+
+struct tlb_entry *tlb_fill_huge(struct tlb *tlb, unsigned int asid, vpn_t vpn)
+{
+	vpn_t base = vpn & ~((1UL << tlb->huge_shift) - 1);
+
+	return __tlb_fill(tlb, asid, base, true);
+}
+
+void tlb_invalidate(struct tlb *tlb, struct tlb_entry *entry)
+{
+	if (!tlb_entry_valid(entry)) return;
+
+	__tlb_clear(tlb, entry);
+}
+
+void tlb_flush(struct tlb *tlb)
+{
+	struct tlb_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, &tlb->fifo, list) {
+		__tlb_clear(tlb, entry);
+	}
+	tlb->nr_flushes++;
+}
+
+unsigned int tlb_flush_asid(struct tlb *tlb, unsigned int asid)
+{
+	struct tlb_entry *entry, *tmp;
+	unsigned int nr_flushed = 0;
+
+	list_for_each_entry_safe(entry, tmp, &tlb->fifo, list) {
+		if (entry->asid != asid) continue;
+		__tlb_clear(tlb, entry);
+		nr_flushed++;
+	}
+	tlb->nr_asid_flushes++;
+	return nr_flushed;
+}
+
+unsigned int tlb_flush_vpn(struct tlb *tlb, unsigned int asid, vpn_t vpn)
+{
+	struct tlb_entry *entry;
+	unsigned int nr_flushed = 0;
+
+	entry = tlb_find(tlb, asid, vpn);
+	if (entry) {
+		tlb_invalidate(tlb, entry);
+		nr_flushed++;
+	}
+	entry = tlb_find_huge(tlb, asid, vpn);
+	if (entry) {
+		tlb_invalidate(tlb, entry);
+		nr_flushed++;
+	}
+	return nr_flushed;
+}
+
+void tlb_flush_range(struct tlb *tlb, unsigned int asid,
+		vpn_t start, vpn_t last, unsigned long stride)
+{
+	struct tlb_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, &tlb->fifo, list) {
+		if (entry->asid != asid) continue;
+		if (tlb_entry_huge(entry)) continue;	/* Split before any part is unmapped */
+		if (entry->vpn < start || entry->vpn > last) continue;
+		if ((entry->vpn - start) % stride) continue;
+
+		__tlb_clear(tlb, entry);
+	}
+}
+
+void tlb_wrprotect_asid(struct tlb *tlb, unsigned int asid)
+{
+	struct tlb_entry *entry;
+
+	tlb_for_each_entry(entry, tlb) {
+		if (entry->asid != asid) continue;
+		tlb_entry_wrprotect(entry);
+	}
+}
+
+
+/**
+ * A valid entry in a snapshot. They are kept in the insertion order, and
+ * the list and the keys are rebuilt from them
+ */
+struct tlb_entry_image {
+	uint32_t index;
+	uint32_t asid;
+	uint64_t vpn;
+	uint64_t stamp;
+	uint32_t pfn;
+	uint8_t rw;
+	uint8_t huge;
+	uint8_t prefetched;
+};
+
+void tlb_save(struct tlb *tlb, struct snap_writer *w)
+{
+	struct tlb_entry *entry;
+	unsigned int nr_valid = 0;
+
+	snap_put(w, tlb->clock);
+	snap_put(w, tlb->seed);
+	snap_put(w, tlb->nr_hits);
+	snap_put(w, tlb->nr_misses);
+	snap_put(w, tlb->nr_flushes);
+	snap_put(w, tlb->nr_asid_flushes);
+	snap_put(w, tlb->nr_prefetches);
+	snap_put(w, tlb->nr_prefetch_hits);
+	snap_put(w, tlb->prefetcher.last_miss);
+	snap_put(w, tlb->prefetcher.stride);
+
+	tlb_for_each_entry(entry, tlb) {
+		nr_valid++;
+	}
+	snap_put(w, nr_valid);
+
+	tlb_for_each_entry(entry, tlb) {
+		struct tlb_entry_image image;
+
+		memset(&image, 0, sizeof(image));
+		image.index = entry - tlb->entries;
+		image.asid = entry->asid;
+		image.vpn = entry->vpn;
+		image.stamp = entry->stamp;
+		image.pfn = tlb_entry_pfn(entry);
+		image.rw = tlb_entry_rw(entry);
+		image.huge = tlb_entry_huge(entry);
+		image.prefetched = tlb_entry_prefetched(entry);
+		snap_put(w, image);
+	}
+}
+
+bool tlb_load(struct tlb *tlb, struct snap_reader *r)
+{
+	unsigned int nr_valid;
+
+	if (!snap_get(r, tlb->clock) || !snap_get(r, tlb->seed) ||
+			!snap_get(r, tlb->nr_hits) || !snap_get(r, tlb->nr_misses) ||
+			!snap_get(r, tlb->nr_flushes) || !snap_get(r, tlb->nr_asid_flushes)) {
+		return false;
+	}
+	if (!snap_get(r, tlb->nr_prefetches) || !snap_get(r, tlb->nr_prefetch_hits) ||
+			!snap_get(r, tlb->prefetcher.last_miss) ||
+			!snap_get(r, tlb->prefetcher.stride)) {
+		return false;
+	}
+	if (!snap_get(r, nr_valid) || nr_valid > tlb->nr_entries) return false;
+
+	while (nr_valid--) {
+		struct tlb_entry_image image;
+		struct tlb_entry *entry;
+
+		if (!snap_get(r, image) || image.index >= tlb->nr_entries) return false;
+
+		entry = tlb->entries + image.index;
+		if (tlb_entry_valid(entry)) return false;
+
+		/* In the set of the VPN */
+		if (__tlb_set(tlb, image.huge ? image.vpn >> tlb->huge_shift : image.vpn) !=
+				tlb->entries + image.index / tlb->nr_ways * tlb->nr_ways) {
+			return false;
+		}
+
+		tlb_entry_mkvalid(entry, image.huge);
+		tlb_entry_set(entry, image.pfn, image.rw);
+		tlb_entry_set_prefetched(entry, image.prefetched);
+		entry->asid = image.asid;
+		entry->vpn = image.vpn;
+		entry->stamp = image.stamp;
+		tlb->keys[image.index] = tlb_key(entry->vpn, image.huge);
+		list_add_tail(&entry->list, &tlb->fifo);
+	}
+	return true;
+}
+
+
+void asid_init(struct asid_allocator *asids, unsigned int nr_asids)
+{
+	asids->nr_asids = nr_asids;
+	asids->generation = 1;
+	asids->nr_rollovers = 0;
+	hbitmap_init(&asids->free, nr_asids, true);
+}
+
+void asid_exit(struct asid_allocator *asids)
+{
+	hbitmap_exit(&asids->free);
+}
+
+bool asid_switch(struct asid_allocator *asids, struct process *proc)
+{
+	unsigned int asid;
+
+	if (proc->asid_generation == asids->generation) return true;
+
+	/* Prefer the ASID that matches the PID so that they read the same */
+	asid = proc->pid % asids->nr_asids;
+	if (!hbitmap_test(&asids->free, asid)) {
+		asid = hbitmap_first(&asids->free);
+	}
+	if (asid == (unsigned int)HBITMAP_NONE) return false;
+
+	hbitmap_clear(&asids->free, asid);
+	proc->asid = asid;
+	proc->asid_generation = asids->generation;
+
+	/* No TLB has the entries of the fresh ASID yet */
+	proc->cpumask = 0;
+	return true;
+}
+
+void asid_rollover(struct asid_allocator *asids)
+{
+	hbitmap_exit(&asids->free);
+	hbitmap_init(&asids->free, asids->nr_asids, true);
+	asids->generation++;
+	asids->nr_rollovers++;
+}
+
+void asid_reserve(struct asid_allocator *asids, struct process *proc)
+{
+	hbitmap_clear(&asids->free, proc->asid);
+	proc->asid_generation = asids->generation;
+}
+
+bool asid_release(struct asid_allocator *asids, struct process *proc)
+{
+	if (proc->asid_generation != asids->generation) return false;
+
+	hbitmap_set(&asids->free, proc->asid);
+	proc->asid_generation = 0;
+	return true;
+}
+
+/* The generation, and the ASIDs in use in it */
+void asid_save(struct asid_allocator *asids, struct snap_writer *w)
+{
+	unsigned int nr_used = 0;
+
+	snap_put(w, asids->generation);
+	snap_put(w, asids->nr_rollovers);
+
+	for (unsigned int asid = 0; asid < asids->nr_asids; asid++) {
+		if (!hbitmap_test(&asids->free, asid)) nr_used++;
+	}
+	snap_put(w, nr_used);
+
+	for (unsigned int asid = 0; asid < asids->nr_asids; asid++) {
+		if (!hbitmap_test(&asids->free, asid)) snap_put(w, asid);
+	}
+}
+
+bool asid_load(struct asid_allocator *asids, struct snap_reader *r)
+{
+	unsigned int nr_used;
+
+	hbitmap_exit(&asids->free);
+	hbitmap_init(&asids->free, asids->nr_asids, true);
+
+	if (!snap_get(r, asids->generation) || !snap_get(r, asids->nr_rollovers)) return false;
+	if (!snap_get(r, nr_used)) return false;
+
+	while (nr_used--) {
+		unsigned int asid;
+
+		if (!snap_get(r, asid) || asid >= asids->nr_asids) return false;
+		hbitmap_clear(&asids->free, asid);
+	}
+	return true;
+}
@@ -0,0 +1,224 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include "types.h"
+#include "list_head.h"
+#include "bitmap.h"
+#include "vm.h"
+#include "snapshot.h"
+
+enum tlb_policy {
+	TLB_POLICY_FIFO = 0,
+	TLB_POLICY_LRU,
+	TLB_POLICY_RANDOM,
+};
+
+enum tlb_prefetch_policy {
+	TLB_PREFETCH_NONE = 0,
+	TLB_PREFETCH_NEXT,
+	TLB_PREFETCH_STRIDE,
+};
+
+/**
+ * TLB prefetcher. On each miss filled from the page table, it predicts the
+ * VPNs to be translated next. NEXT predicts the @degree VPNs following the
+ * missing one, and STRIDE those apart by the distance between the last two
+ * misses once the same distance is seen twice in a row. Only the predicted
+ * VPNs mapped in the same last-level directory are filled.
+ */
+struct tlb_prefetcher {
+	enum tlb_prefetch_policy policy;
+	unsigned int degree;
+
+	vpn_t last_miss;
+	long stride;		/* From the miss before @last_miss */
+};
+
+#define TLB_PREFETCH_DEGREE	4
+
+/**
+ * Set-associative TLB. A VPN is cached only in the set selected by its low
+ * bits, so a lookup compares at most @nr_ways entries. Entries are tagged
+ * with the ASID of the address space they belong to, and valid ones are
+ * also chained in @fifo in the order they were inserted.
+ * A huge entry translates an aligned block of VPNs, and is kept in the set
+ * selected by the block number instead.
+ *
+ * The VPN of each entry is also kept in @keys with its valid and huge bits,
+ * so that a set is searched by comparing the keys in vectors (see simd.h).
+ */
+struct tlb {
+	unsigned int nr_entries;
+	unsigned int nr_ways;
+	unsigned int nr_sets;
+	enum tlb_policy policy;
+	unsigned int huge_shift;	/* A huge entry covers 1 << @huge_shift VPNs */
+
+	unsigned long clock;	/* Timestamp for FIFO and LRU replacement */
+	unsigned long seed;	/* State for random replacement */
+
+	struct tlb_entry *entries;
+	uint64_t *keys;		/* tlb_key() of each entry, 0 if invalid */
+	struct list_head fifo;
+
+	struct tlb_prefetcher prefetcher;
+
+	unsigned long nr_hits;
+	unsigned long nr_misses;
+	unsigned long nr_flushes;	/* Whole TLB flushes */
+	unsigned long nr_asid_flushes;	/* Flushes of a single address space */
+	unsigned long nr_prefetches;	/* Entries filled by the prefetcher */
+	unsigned long nr_prefetch_hits;	/* Of them, ones used before going away */
+};
+
+/**
+ * ASIDs are handed out in generations. When all of them are used up, the
+ * generation is bumped and every TLB is flushed, so that every process
+ * picks a fresh ASID when it is switched in next time. The processes running
+ * on the CPUs at the moment keep theirs in the new generation.
+ */
+struct asid_allocator {
+	unsigned int nr_asids;
+	unsigned long generation;
+	struct hbitmap free;
+
+	unsigned long nr_rollovers;
+};
+
+#define NR_ASIDS	256
+
+/* VPNs have up to MAX_VPN_BITS bits, which leaves room for the two bits */
+static inline uint64_t tlb_key(vpn_t vpn, bool huge)
+{
+	return ((uint64_t)vpn << 2) | (huge ? 2 : 0) | 1;
+}
+
+bool tlb_parse_config(const char *str, unsigned int *nr_entries,
+		unsigned int *nr_ways, enum tlb_policy *policy);
+
+void tlb_init(struct tlb *tlb, unsigned int nr_entries, unsigned int nr_ways,
+		enum tlb_policy policy, unsigned int huge_shift);
+void tlb_exit(struct tlb *tlb);
+
+/* Parse the prefetcher given as "none|next|stride[:degree]" */
+bool tlb_parse_prefetch(const char *str, enum tlb_prefetch_policy *policy,
+		unsigned int *degree);
+const char *tlb_prefetch_name(enum tlb_prefetch_policy policy);
+
+static inline void tlb_init_prefetch(struct tlb *tlb,
+		enum tlb_prefetch_policy policy, unsigned int degree)
+{
+	tlb->prefetcher.policy = policy;
+	tlb->prefetcher.degree = degree;
+}
+
+/**
+ * Train the prefetcher with the miss on @vpn, and return the distance
+ * between the VPNs to prefetch after it. 0 tells not to prefetch any.
+ */
+long tlb_prefetch_stride(struct tlb *tlb, vpn_t vpn);
+
+/* Return the valid entry caching @vpn of @asid, or NULL if there is none */
+struct tlb_entry *tlb_find(struct tlb *tlb, unsigned int asid, vpn_t vpn);
+
+/* Return the valid huge entry covering @vpn of @asid, or NULL */
+struct tlb_entry *tlb_find_huge(struct tlb *tlb, unsigned int asid, vpn_t vpn);
+
+/**
+ * Return any valid entry translating @vpn of @asid. The PFN of @vpn is
+ * tlb_entry_pfn(@entry) + (@vpn - @entry->vpn) for both kinds of entries.
+ */
+static inline struct tlb_entry *tlb_lookup(struct tlb *tlb, unsigned int asid, vpn_t vpn)
+{
+	return tlb_find(tlb, asid, vpn) ? : tlb_find_huge(tlb, asid, vpn);
+}
+
+/* Mark @entry as just used for LRU replacement */
+static inline void tlb_touch(struct tlb *tlb, struct tlb_entry *entry)
+{
+	if (tlb->policy == TLB_POLICY_LRU) entry->stamp = ++tlb->clock;
+}
+
+/**
+ * Return the entry for @vpn of @asid. A new entry is taken from the set,
+ * evicting one according to the replacement policy if needed, when @vpn is
+ * not cached yet.
+ */
+struct tlb_entry *tlb_fill(struct tlb *tlb, unsigned int asid, vpn_t vpn);
+
+/* Same as tlb_fill(), but for the huge entry covering @vpn */
+struct tlb_entry *tlb_fill_huge(struct tlb *tlb, unsigned int asid, vpn_t vpn);
+
+void tlb_invalidate(struct tlb *tlb, struct tlb_entry *entry);
+void tlb_flush(struct tlb *tlb);
+
+/* Invalidate all entries of @asid, and return how many there were */
+unsigned int tlb_flush_asid(struct tlb *tlb, unsigned int asid);
+
+/**
+ * Invalidate the entries of @asid translating @vpn, small or huge, and
+ * return how many there were
+ */
+unsigned int tlb_flush_vpn(struct tlb *tlb, unsigned int asid, vpn_t vpn);
+
+/* Invalidate entries of @asid for VPNs in [@start, @last] every @stride */
+void tlb_flush_range(struct tlb *tlb, unsigned int asid,
+		vpn_t start, vpn_t last, unsigned long stride);
+
+/* Drop the write permission from all entries of @asid */
+void tlb_wrprotect_asid(struct tlb *tlb, unsigned int asid);
+
+void asid_init(struct asid_allocator *asids, unsigned int nr_asids);
+void asid_exit(struct asid_allocator *asids);
+
+/**
+ * Make sure @proc owns an ASID of the current generation, allocating one
+ * when it does not. Return false if all of them are in use. A new
+ * generation has to be started with asid_rollover() then.
+ */
+bool asid_switch(struct asid_allocator *asids, struct process *proc);
+
+/**
+ * Recycle all ASIDs by bumping the generation. Every TLB has to be flushed,
+ * and the ASIDs of the running processes kept with asid_reserve() before
+ * handing out new ones.
+ */
+void asid_rollover(struct asid_allocator *asids);
+void asid_reserve(struct asid_allocator *asids, struct process *proc);
+
+/**
+ * Give the ASID of @proc back. Return false if it is from a past generation,
+ * whose TLB entries are all gone already. Otherwise the entries are left
+ * to the caller to invalidate.
+ */
+bool asid_release(struct asid_allocator *asids, struct process *proc);
+
+/**
+ * Write the entries and counters of @tlb, or the state of @asids, to a
+ * snapshot, and read them back into ones just set up with the same geometry
+ */
+void tlb_save(struct tlb *tlb, struct snap_writer *w);
+bool tlb_load(struct tlb *tlb, struct snap_reader *r);
+void asid_save(struct asid_allocator *asids, struct snap_writer *w);
+bool asid_load(struct asid_allocator *asids, struct snap_reader *r);
+
+/* Iterate valid entries in their insertion order */
+#define tlb_for_each_entry(entry, tlb) \
+	list_for_each_entry(entry, &(tlb)->fifo, list)
+
+#endif
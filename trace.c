@@ -0,0 +1,473 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "parser.h"
+#include "list_head.h"
+#include "vm.h"
+#include "numa.h"
+#include "trace.h"
+
+/**
+ * Commands of the text trace
+ *
+ * Each command has an entry in @commands[], and so does each alias of it,
+ * and takes @min_args to @max_args arguments, which @parse decodes into the
+ * command with @op and @rw. The names are kept in a perfect hash table,
+ * built before main() with a seed that gives each name a slot of its own,
+ * so a lookup hashes the name and compares it with a single entry however
+ * many commands there are. The name is made lowercase on the same pass.
+ */
+struct trace_command {
+	const char *name;
+	unsigned char op;
+	unsigned char rw;
+	unsigned char min_args;
+	unsigned char max_args;
+	int (*parse)(struct trace_cmd *cmd, char *args[], int nr_args);
+};
+
+#define COMMAND_HASH_BITS	6
+
+static bool __parse_number(const char *token, unsigned long *val)
+{
+	char *end;
+
+	*val = strtoul(token, &end, 0);
+	return end != token && *end == '\0';
+}
+
+/* Parse the flags like "rw" in @token into @rw, which are read at least */
+static bool __parse_rw(const char *token, unsigned char *rw)
+{
+	*rw = ACCESS_READ;
+
+	for (; *token; token++) {
+		switch (tolower(*token)) {
+		case 'r':
+			*rw |= ACCESS_READ;
+			break;
+		case 'w':
+			*rw |= ACCESS_WRITE;
+			break;
+		case 'h':
+			*rw |= ACCESS_HUGE;
+			break;
+		case 'l':
+			*rw |= ACCESS_LAZY;
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Parse "start [last [stride]]" in @args into @cmd
+ */
+static bool __parse_range(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	cmd->stride = 1;
+
+	if (!__parse_number(args[0], &cmd->vpn)) return false;
+	cmd->last = cmd->vpn;
+
+	if (nr_args >= 2 && !__parse_number(args[1], &cmd->last)) return false;
+	if (nr_args >= 3 && !__parse_number(args[2], &cmd->stride)) return false;
+
+	return cmd->vpn <= cmd->last && cmd->stride;
+}
+
+static int __parse_none(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	return TRACE_PARSE_OK;
+}
+
+/* switch|cpu|kill number */
+static int __parse_arg(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	return __parse_number(args[0], &cmd->arg) ? TRACE_PARSE_OK : TRACE_PARSE_BAD_ARGS;
+}
+
+/* exit [pid], where the pid makes it kill */
+static int __parse_exit(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	if (!nr_args) return TRACE_PARSE_OK;
+
+	cmd->op = TRACE_OP_KILL;
+	return __parse_arg(cmd, args, nr_args);
+}
+
+/* snapshot|restore file, taken as it is */
+static int __parse_path(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	cmd->path = args[0];
+	return TRACE_PARSE_OK;
+}
+
+/* read|write|free start [last [stride]] */
+static int __parse_access(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	return __parse_range(cmd, args, nr_args) ? TRACE_PARSE_OK : TRACE_PARSE_BAD_ARGS;
+}
+
+/**
+ * Parse "tag=name" into the content tag of the name in @tag. A number is
+ * taken as the tag itself, as trace_print() prints it, and a name is hashed
+ * with FNV-1a into one. Return false if @token is not a tag.
+ */
+static bool __parse_tag(const char *token, unsigned long *tag)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	if (strncasecmp(token, "tag=", 4) || !token[4]) return false;
+	token += 4;
+
+	if (__parse_number(token, tag)) return true;
+
+	for (; *token; token++) {
+		hash = (hash ^ (unsigned char)*token) * 1099511628211ULL;
+	}
+	*tag = hash ? : 1;
+	return true;
+}
+
+/* alloc|access start [last] rw [stride] [tag=name] */
+static int __parse_alloc(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	char *range[3] = { args[0], args[1], args[3] };
+
+	if (nr_args >= 3 && __parse_tag(args[nr_args - 1], &cmd->arg)) {
+		if (cmd->op != TRACE_OP_ALLOC || !cmd->arg) return TRACE_PARSE_BAD_ARGS;
+		nr_args--;
+	}
+	if (nr_args > 4) return TRACE_PARSE_BAD_ARGS;
+	if (!__parse_rw(args[nr_args == 2 ? 1 : 2], &cmd->rw)) return TRACE_PARSE_BAD_ARGS;
+
+	/**
+	 * Only allocations can be huge or lazy, but not both. Tagged pages have
+	 * the content already, so they are neither
+	 */
+	if (cmd->op != TRACE_OP_ALLOC) cmd->rw &= ~(ACCESS_HUGE | ACCESS_LAZY);
+	/* An access either reads or writes, and "rw" is taken as a write */
+	if (cmd->op == TRACE_OP_ACCESS) {
+		cmd->rw = cmd->rw & ACCESS_WRITE ? ACCESS_WRITE : ACCESS_READ;
+	}
+	if ((cmd->rw & ACCESS_HUGE) && (cmd->rw & ACCESS_LAZY)) return TRACE_PARSE_BAD_ARGS;
+	if (cmd->arg && (cmd->rw & (ACCESS_HUGE | ACCESS_LAZY))) return TRACE_PARSE_BAD_ARGS;
+
+	return __parse_range(cmd, range, nr_args - 1) ? TRACE_PARSE_OK : TRACE_PARSE_BAD_ARGS;
+}
+
+/* mempolicy local|interleave|preferred [node] */
+static int __parse_mempolicy(struct trace_cmd *cmd, char *args[], int nr_args)
+{
+	if (strcasecmp(args[0], "local") == 0) {
+		cmd->rw = MPOL_LOCAL;
+	} else if (strcasecmp(args[0], "interleave") == 0) {
+		cmd->rw = MPOL_INTERLEAVE;
+	} else if (strcasecmp(args[0], "preferred") == 0) {
+		if (nr_args != 2) return TRACE_PARSE_BAD_ARGS;
+		cmd->rw = MPOL_PREFERRED;
+		return __parse_arg(cmd, args + 1, 1);
+	} else {
+		return TRACE_PARSE_BAD_ARGS;
+	}
+	return nr_args == 1 ? TRACE_PARSE_OK : TRACE_PARSE_BAD_ARGS;
+}
+
+static const struct trace_command commands[] = {
+	{ "exit",	TRACE_OP_EXIT,		0,		0, 1, __parse_exit },
+	{ "show",	TRACE_OP_SHOW,		0,		0, 0, __parse_none },
+	{ "frames",	TRACE_OP_FRAMES,	0,		0, 0, __parse_none },
+	{ "tlb",	TRACE_OP_TLB,		0,		0, 0, __parse_none },
+	{ "tlbstat",	TRACE_OP_TLBSTAT,	0,		0, 0, __parse_none },
+	{ "stats",	TRACE_OP_STATS,		0,		0, 0, __parse_none },
+	{ "merge",	TRACE_OP_MERGE,		0,		0, 0, __parse_none },
+	{ "help",	TRACE_OP_HELP,		0,		0, 0, __parse_none },
+	{ "?",		TRACE_OP_HELP,		0,		0, 0, __parse_none },
+	{ "switch",	TRACE_OP_SWITCH,	0,		1, 1, __parse_arg },
+	{ "s",		TRACE_OP_SWITCH,	0,		1, 1, __parse_arg },
+	{ "cpu",	TRACE_OP_CPU,		0,		1, 1, __parse_arg },
+	{ "kill",	TRACE_OP_KILL,		0,		1, 1, __parse_arg },
+	{ "mempolicy",	TRACE_OP_MEMPOLICY,	0,		1, 2, __parse_mempolicy },
+	{ "snapshot",	TRACE_OP_SNAPSHOT,	0,		1, 1, __parse_path },
+	{ "restore",	TRACE_OP_RESTORE,	0,		1, 1, __parse_path },
+	{ "read",	TRACE_OP_ACCESS,	ACCESS_READ,	1, 3, __parse_access },
+	{ "r",		TRACE_OP_ACCESS,	ACCESS_READ,	1, 3, __parse_access },
+	{ "write",	TRACE_OP_ACCESS,	ACCESS_WRITE,	1, 3, __parse_access },
+	{ "w",		TRACE_OP_ACCESS,	ACCESS_WRITE,	1, 3, __parse_access },
+	{ "free",	TRACE_OP_FREE,		0,		1, 3, __parse_access },
+	{ "f",		TRACE_OP_FREE,		0,		1, 3, __parse_access },
+	{ "alloc",	TRACE_OP_ALLOC,		0,		2, 5, __parse_alloc },
+	{ "a",		TRACE_OP_ALLOC,		0,		2, 5, __parse_alloc },
+	{ "access",	TRACE_OP_ACCESS,	0,		2, 4, __parse_alloc },
+};
+
+#define NR_COMMANDS	(sizeof(commands) / sizeof(commands[0]))
+
+static const struct trace_command *command_table[1 << COMMAND_HASH_BITS];
+static uint32_t command_seed;
+
+/* FNV-1a from the seed, folded to the bits of the table */
+static inline uint32_t __hash_init(void)
+{
+	return 2166136261U ^ command_seed;
+}
+
+static inline uint32_t __hash_char(uint32_t hash, unsigned char c)
+{
+	return (hash ^ c) * 16777619U;
+}
+
+static inline unsigned int __hash_slot(uint32_t hash)
+{
+	return hash >> (32 - COMMAND_HASH_BITS);
+}
+
+/**
+ * Find the seed that leaves no two names in the same slot. There are a few
+ * dozens of names in 64 slots, so it takes about a hundred tries
+ */
+static void __attribute__((constructor)) __build_command_table(void)
+{
+	unsigned int i;
+
+	do {
+		command_seed = command_seed * 0x9E3779B9U + 1;
+		memset(command_table, 0, sizeof(command_table));
+
+		for (i = 0; i < NR_COMMANDS; i++) {
+			uint32_t hash = __hash_init();
+			unsigned int slot;
+
+			for (const char *c = commands[i].name; *c; c++) {
+				hash = __hash_char(hash, *c);
+			}
+			slot = __hash_slot(hash);
+
+			if (command_table[slot]) break;
+			command_table[slot] = commands + i;
+		}
+	} while (i < NR_COMMANDS);
+}
+
+/* Make @name lowercase, and look it up in the table on the way */
+static const struct trace_command *__lookup_command(char *name)
+{
+	const struct trace_command *command;
+	uint32_t hash = __hash_init();
+
+	for (char *c = name; *c; c++) {
+		*c = tolower(*c);
+		hash = __hash_char(hash, *c);
+	}
+
+	command = command_table[__hash_slot(hash)];
+	return command && strcmp(command->name, name) == 0 ? command : NULL;
+}
+
+/**
+ * trace_parse_line()
+ *
+ * DESCRIPTION
+ *   Tokenize @line with parse_command(), make the command name lowercase,
+ *   and decode the tokens into @cmd in place. Numbers should be whole tokens,
+ *   and file names are taken as they are.
+ *
+ * RETURN
+ *   One of enum trace_parse_result
+ */
+int trace_parse_line(char *line, struct trace_cmd *cmd, char **name)
+{
+	char *tokens[MAX_NR_TOKENS] = { NULL };
+	const struct trace_command *command;
+	int nr_tokens = 0;
+	int nr_args;
+
+	if (parse_command(line, &nr_tokens, tokens) < 0 || nr_tokens == 0) {
+		return TRACE_PARSE_EMPTY;
+	}
+
+	memset(cmd, 0, sizeof(*cmd));
+	*name = tokens[0];
+	nr_args = nr_tokens - 1;
+
+	command = __lookup_command(tokens[0]);
+	if (!command || nr_args < command->min_args || nr_args > command->max_args) {
+		return TRACE_PARSE_UNKNOWN;
+	}
+
+	cmd->op = command->op;
+	cmd->rw = command->rw;
+	return command->parse(cmd, tokens + 1, nr_args);
+}
+
+
+static void __put_varint(FILE *out, unsigned long val)
+{
+	while (val >= 0x80) {
+		fputc((val & 0x7f) | 0x80, out);
+		val >>= 7;
+	}
+	fputc(val, out);
+}
+
+void trace_writer_init(struct trace_writer *w, FILE *out)
+{
+	w->out = out;
+	w->last_vpn = 0;
+
+	fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, out);
+}
+
+bool trace_write(struct trace_writer *w, const struct trace_cmd *cmd)
+{
+	unsigned char op = cmd->op;
+	long delta;
+
+	if (cmd->rw & ACCESS_HUGE) {
+		op = TRACE_OP_ALLOC_HUGE;
+	} else if (cmd->rw & ACCESS_LAZY) {
+		op = TRACE_OP_ALLOC_LAZY;
+	} else if (cmd->op == TRACE_OP_ALLOC && cmd->arg) {
+		op = TRACE_OP_ALLOC_TAGGED;
+	}
+
+	fputc(op | ((cmd->rw & TRACE_RW_MASK) << TRACE_RW_SHIFT) |
+			(trace_cmd_is_range(cmd) ? TRACE_RANGE : 0), w->out);
+
+	switch (cmd->op) {
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+	case TRACE_OP_FREE:
+		delta = cmd->vpn - w->last_vpn;
+		__put_varint(w->out, ((unsigned long)delta << 1) ^ (delta >> 63));
+		w->last_vpn = cmd->vpn;
+
+		if (trace_cmd_is_range(cmd)) {
+			__put_varint(w->out, cmd->last - cmd->vpn);
+			__put_varint(w->out, cmd->stride);
+		}
+		if (op == TRACE_OP_ALLOC_TAGGED) __put_varint(w->out, cmd->arg);
+		break;
+	case TRACE_OP_SWITCH:
+	case TRACE_OP_KILL:
+	case TRACE_OP_CPU:
+	case TRACE_OP_MEMPOLICY:
+		__put_varint(w->out, cmd->arg);
+		break;
+	case TRACE_OP_SNAPSHOT:
+	case TRACE_OP_RESTORE:
+		__put_varint(w->out, strlen(cmd->path));
+		fwrite(cmd->path, 1, strlen(cmd->path) + 1, w->out);
+		break;
+	default:
+		break;
+	}
+
+	return !ferror(w->out);
+}
+
+/**
+ * trace_print()
+ *
+ * DESCRIPTION
+ *   Print @cmd in the text workload form that trace_parse_line() accepts.
+ */
+void trace_print(FILE *out, const struct trace_cmd *cmd)
+{
+	static const char * const names[] = {
+		[TRACE_OP_SHOW] = "show",
+		[TRACE_OP_FRAMES] = "frames",
+		[TRACE_OP_TLB] = "tlb",
+		[TRACE_OP_TLBSTAT] = "tlbstat",
+		[TRACE_OP_HELP] = "help",
+		[TRACE_OP_EXIT] = "exit",
+		[TRACE_OP_STATS] = "stats",
+		[TRACE_OP_MERGE] = "merge",
+	};
+	char rw[8], last[32] = "", stride[32] = "", tag[32] = "";
+
+	snprintf(rw, sizeof(rw), "r%s%s%s", cmd->rw & ACCESS_WRITE ? "w" : "",
+			cmd->rw & ACCESS_HUGE ? "h" : "", cmd->rw & ACCESS_LAZY ? "l" : "");
+
+	if (trace_cmd_is_range(cmd)) {
+		snprintf(last, sizeof(last), " %lu", cmd->last);
+	}
+	if (trace_cmd_is_range(cmd) && cmd->stride > 1) {
+		snprintf(stride, sizeof(stride), " %lu", cmd->stride);
+	}
+	if (cmd->op == TRACE_OP_ALLOC && cmd->arg) {
+		snprintf(tag, sizeof(tag), " tag=%#lx", cmd->arg);
+	}
+
+	switch (cmd->op) {
+	case TRACE_OP_ACCESS:
+		if (cmd->rw == ACCESS_READ) {
+			fprintf(out, "read %lu%s%s\n", cmd->vpn, last, stride);
+		} else if (cmd->rw == ACCESS_WRITE) {
+			fprintf(out, "write %lu%s%s\n", cmd->vpn, last, stride);
+		} else {
+			fprintf(out, "access %lu%s %s%s\n", cmd->vpn, last, rw, stride);
+		}
+		break;
+	case TRACE_OP_ALLOC:
+		fprintf(out, "alloc %lu%s %s%s%s\n", cmd->vpn, last, rw, stride, tag);
+		break;
+	case TRACE_OP_FREE:
+		fprintf(out, "free %lu%s%s\n", cmd->vpn, last, stride);
+		break;
+	case TRACE_OP_SWITCH:
+		fprintf(out, "switch %lu\n", cmd->arg);
+		break;
+	case TRACE_OP_KILL:
+		fprintf(out, "kill %lu\n", cmd->arg);
+		break;
+	case TRACE_OP_CPU:
+		fprintf(out, "cpu %lu\n", cmd->arg);
+		break;
+	case TRACE_OP_MEMPOLICY:
+		if (cmd->rw == MPOL_PREFERRED) {
+			fprintf(out, "mempolicy preferred %lu\n", cmd->arg);
+		} else {
+			fprintf(out, "mempolicy %s\n", cmd->rw == MPOL_LOCAL ? "local" : "interleave");
+		}
+		break;
+	case TRACE_OP_SNAPSHOT:
+		fprintf(out, "snapshot %s\n", cmd->path);
+		break;
+	case TRACE_OP_RESTORE:
+		fprintf(out, "restore %s\n", cmd->path);
+		break;
+	default:
+		fprintf(out, "%s\n", names[cmd->op]);
+		break;
+	}
+}
+
+bool trace_is_binary(const void *buf, size_t len)
+{
+	return len >= TRACE_MAGIC_LEN && memcmp(buf, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0;
+}
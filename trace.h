@@ -0,0 +1,222 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "numa.h"
+
+/**
+ * A decoded trace command. Both the text and the binary traces are turned
+ * into this, and the simulator runs it without looking at the source.
+ */
+enum trace_op {
+	TRACE_OP_NONE = 0,
+	TRACE_OP_ACCESS,	/* [@vpn, @last] every @stride for @rw */
+	TRACE_OP_ALLOC,		/* Same, with the content tag @arg or 0 */
+	TRACE_OP_FREE,		/* [@vpn, @last] every @stride */
+	TRACE_OP_SWITCH,	/* to pid @arg */
+	TRACE_OP_SHOW,
+	TRACE_OP_FRAMES,
+	TRACE_OP_TLB,
+	TRACE_OP_TLBSTAT,
+	TRACE_OP_HELP,
+	TRACE_OP_EXIT,
+	TRACE_OP_KILL,		/* pid @arg */
+	TRACE_OP_STATS,
+	TRACE_OP_CPU,		/* to cpu @arg */
+	TRACE_OP_SNAPSHOT,	/* to file @path */
+	TRACE_OP_RESTORE,	/* from file @path */
+	TRACE_OP_MEMPOLICY,	/* @rw of enum mempolicy_mode, on node @arg */
+	TRACE_OP_MERGE,
+	NR_TRACE_OPS,
+};
+
+struct trace_cmd {
+	unsigned char op;
+	unsigned char rw;
+	vpn_t vpn;
+	vpn_t last;		/* Same as @vpn unless it is for a range */
+	unsigned long stride;
+	unsigned long arg;
+	const char *path;	/* In the line or the record decoded */
+};
+
+static inline bool trace_cmd_is_range(const struct trace_cmd *cmd)
+{
+	return cmd->last != cmd->vpn;
+}
+
+enum trace_parse_result {
+	TRACE_PARSE_OK = 0,
+	TRACE_PARSE_EMPTY,	/* Blank or comment-only line */
+	TRACE_PARSE_UNKNOWN,	/* Unknown command name or number of arguments */
+	TRACE_PARSE_BAD_ARGS,	/* Malformed arguments such as a reversed range */
+};
+
+/**
+ * Parse a line of the text trace in place into @cmd. Unless the line is
+ * empty, @name is set to the command token.
+ */
+int trace_parse_line(char *line, struct trace_cmd *cmd, char **name);
+void trace_print(FILE *out, const struct trace_cmd *cmd);
+
+/**
+ * Binary trace format
+ *
+ * The file starts with TRACE_MAGIC followed by records. Each record is an
+ * opcode byte with the command in the low 5 bits, the rw flag in bits 5-6,
+ * and TRACE_RANGE in bit 7, then the operands as LEB128 varints. VPNs are
+ * stored as zigzag-encoded deltas from the VPN of the previous record, so
+ * sweeps take 2 bytes each. Ranges add the length and the stride.
+ * A path is its length followed by the bytes and a terminating NUL.
+ * The rw flag has no room for ACCESS_HUGE, so huge allocations are recorded
+ * with the TRACE_OP_ALLOC_HUGE opcode instead, and so are lazy ones with
+ * TRACE_OP_ALLOC_LAZY. Tagged ones are TRACE_OP_ALLOC_TAGGED with the tag
+ * after the range.
+ */
+#define TRACE_MAGIC		"VMTRACE1"
+#define TRACE_MAGIC_LEN		8
+#define TRACE_MAX_RECORD	32
+
+#define TRACE_OP_MASK		0x1f
+#define TRACE_OP_ALLOC_HUGE	TRACE_OP_MASK
+#define TRACE_OP_ALLOC_LAZY	(TRACE_OP_MASK - 1)
+#define TRACE_OP_ALLOC_TAGGED	(TRACE_OP_MASK - 2)
+#define TRACE_RW_SHIFT		5
+#define TRACE_RW_MASK		0x03
+#define TRACE_RANGE		0x80
+
+struct trace_writer {
+	FILE *out;
+	vpn_t last_vpn;
+};
+
+void trace_writer_init(struct trace_writer *w, FILE *out);
+bool trace_write(struct trace_writer *w, const struct trace_cmd *cmd);
+
+bool trace_is_binary(const void *buf, size_t len);
+
+static inline bool __trace_get_varint(const unsigned char **pos,
+		const unsigned char *end, unsigned long *val)
+{
+	unsigned long v = 0;
+	unsigned int shift = 0;
+
+	while (*pos < end && shift < 64) {
+		unsigned char byte = *(*pos)++;
+
+		v |= (unsigned long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*val = v;
+			return true;
+		}
+		shift += 7;
+	}
+	return false;
+}
+
+/**
+ * trace_decode()
+ *
+ * Decode the record at @*pos into @cmd and advance @*pos past it. @last_vpn
+ * carries the delta base between calls, and should start from 0.
+ * Return false on a truncated or unknown record, or one with the rw flag an
+ * access or an allocation cannot have. An access is either a read or a
+ * write, and an allocation is readable at least. A mempolicy takes the
+ * modes of enum mempolicy_mode only.
+ */
+static inline bool trace_decode(const unsigned char **pos, const unsigned char *end,
+		struct trace_cmd *cmd, vpn_t *last_vpn)
+{
+	unsigned char opcode;
+	unsigned long val;
+	bool tagged = false;
+
+	if (*pos >= end) return false;
+
+	opcode = *(*pos)++;
+	cmd->op = opcode & TRACE_OP_MASK;
+	cmd->rw = (opcode >> TRACE_RW_SHIFT) & TRACE_RW_MASK;
+	if (cmd->op == TRACE_OP_ALLOC_HUGE) {
+		cmd->op = TRACE_OP_ALLOC;
+		cmd->rw |= ACCESS_HUGE;
+	} else if (cmd->op == TRACE_OP_ALLOC_LAZY) {
+		cmd->op = TRACE_OP_ALLOC;
+		cmd->rw |= ACCESS_LAZY;
+	} else if (cmd->op == TRACE_OP_ALLOC_TAGGED) {
+		cmd->op = TRACE_OP_ALLOC;
+		tagged = true;
+	}
+
+	/* The simulator takes none of these, so they are not from trace_write() */
+	if (cmd->op == TRACE_OP_ACCESS && cmd->rw != ACCESS_READ && cmd->rw != ACCESS_WRITE) {
+		return false;
+	}
+	if (cmd->op == TRACE_OP_ALLOC && !(cmd->rw & ACCESS_READ)) return false;
+
+	switch (cmd->op) {
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+	case TRACE_OP_FREE:
+		if (!__trace_get_varint(pos, end, &val)) return false;
+		/* Zigzag-encoded delta */
+		*last_vpn += (val >> 1) ^ -(val & 1);
+		cmd->vpn = cmd->last = *last_vpn;
+		cmd->stride = 1;
+		cmd->arg = 0;
+
+		if (opcode & TRACE_RANGE) {
+			if (!__trace_get_varint(pos, end, &val)) return false;
+			cmd->last = cmd->vpn + val;
+			if (!__trace_get_varint(pos, end, &cmd->stride) || !cmd->stride) {
+				return false;
+			}
+		}
+		return !tagged || (__trace_get_varint(pos, end, &cmd->arg) && cmd->arg);
+	case TRACE_OP_SWITCH:
+	case TRACE_OP_KILL:
+	case TRACE_OP_CPU:
+		return __trace_get_varint(pos, end, &cmd->arg);
+	case TRACE_OP_MEMPOLICY:
+		if (cmd->rw >= NR_MPOL_MODES) return false;
+		return __trace_get_varint(pos, end, &cmd->arg);
+	case TRACE_OP_SNAPSHOT:
+	case TRACE_OP_RESTORE:
+		if (!__trace_get_varint(pos, end, &val)) return false;
+		if (val >= (unsigned long)(end - *pos) || (*pos)[val]) return false;
+		cmd->path = (const char *)*pos;
+		*pos += val + 1;
+		return true;
+	case TRACE_OP_SHOW:
+	case TRACE_OP_FRAMES:
+	case TRACE_OP_TLB:
+	case TRACE_OP_TLBSTAT:
+	case TRACE_OP_HELP:
+	case TRACE_OP_EXIT:
+	case TRACE_OP_STATS:
+	case TRACE_OP_MERGE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+#endif
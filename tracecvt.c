@@ -0,0 +1,144 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "parser.h"
+#include "list_head.h"
+#include "vm.h"
+#include "trace.h"
+
+/**
+ * Convert text workloads (see testcases/) to the binary trace format, or
+ * dump a binary trace back to text with -d.
+ */
+
+static int __encode(FILE *in, FILE *out)
+{
+	char line[MAX_COMMAND_LEN];
+	struct trace_writer w;
+	unsigned long lineno = 0;
+
+	trace_writer_init(&w, out);
+
+	while (fgets(line, sizeof(line), in)) {
+		struct trace_cmd cmd;
+		char *name;
+
+		lineno++;
+		switch (trace_parse_line(line, &cmd, &name)) {
+		case TRACE_PARSE_EMPTY:
+			continue;
+		case TRACE_PARSE_UNKNOWN:
+			fprintf(stderr, "line %lu: unknown command %s\n", lineno, name);
+			return EXIT_FAILURE;
+		case TRACE_PARSE_BAD_ARGS:
+			fprintf(stderr, "line %lu: invalid command %s\n", lineno, name);
+			return EXIT_FAILURE;
+		}
+
+		if (!trace_write(&w, &cmd)) {
+			perror("write");
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static int __decode(FILE *in, FILE *out)
+{
+	struct stat st;
+	const unsigned char *buf, *pos, *end;
+	vpn_t last_vpn = 0;
+
+	if (fstat(fileno(in), &st)) {
+		perror("stat");
+		return EXIT_FAILURE;
+	}
+	buf = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+	if (buf == MAP_FAILED || !trace_is_binary(buf, st.st_size)) {
+		fprintf(stderr, "Not a binary trace\n");
+		return EXIT_FAILURE;
+	}
+
+	pos = buf + TRACE_MAGIC_LEN;
+	end = buf + st.st_size;
+	while (pos < end) {
+		struct trace_cmd cmd;
+
+		if (!trace_decode(&pos, end, &cmd, &last_vpn)) {
+			fprintf(stderr, "Corrupted trace at offset %zu\n", (size_t)(pos - buf));
+			return EXIT_FAILURE;
+		}
+		trace_print(out, &cmd);
+	}
+	return EXIT_SUCCESS;
+}
+
+static void __print_usage(const char *name)
+{
+	printf("Usage: %s {-d} [input] [output]\n", name);
+	printf("\n");
+	printf("  Convert a text workload into the binary trace format\n");
+	printf("  -d: Dump a binary trace as a text workload instead\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	bool decode = false;
+	FILE *in, *out;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "dh")) != -1) {
+		switch (opt) {
+		case 'd':
+			decode = true;
+			break;
+		case 'h':
+		default:
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2) {
+		__print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	in = fopen(argv[optind], decode ? "rb" : "r");
+	if (!in) {
+		fprintf(stderr, "No input file %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	out = fopen(argv[optind + 1], decode ? "w" : "wb");
+	if (!out) {
+		fprintf(stderr, "Unable to open %s\n", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	ret = decode ? __decode(in, out) : __encode(in, out);
+
+	fclose(in);
+	if (fclose(out)) ret = EXIT_FAILURE;
+
+	return ret;
+}
@@ -20,4 +20,11 @@ typedef unsigned char bool;
 #define true	1
 #define false	0
 
+/**
+ * State of a simulation. Each thread simulates on its own instance of it,
+ * so independent traces can be run in parallel (see runner.c). The
+ * configuration set up from the options is shared by all of them
+ */
+#define __sim	__thread
+
 #endif
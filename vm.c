@@ -21,63 +21,176 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "types.h"
 #include "parser.h"
 
 #include "list_head.h"
 #include "vm.h"
+#include "frame.h"
+#include "tlb.h"
+#include "pagetable.h"
+#include "trace.h"
+#include "process.h"
+#include "slab.h"
+#include "swap.h"
+#include "cpu.h"
+#include "rmap.h"
+#include "mrc.h"
+#include "pipeline.h"
+#include "numa.h"
+#include "cost.h"
+#include "ksm.h"
+#include "runner.h"
+#include "simd.h"
+#include "output.h"
+#include "snapshot.h"
 
 static bool verbose = true;
 
 static bool print_tlb_result = false;
 
+static const char *stats_path = NULL;
+
+static const char *restore_path = NULL;
+
+bool lazy_fork = false;
+
+/* Make all allocations of small pages lazy as if they had ACCESS_LAZY */
+static bool lazy_alloc = false;
+
+/* Pages resolved together on a demand or copy-on-write fault. See pa3.c */
+unsigned int fault_around = 1;
+
+bool cow_reuse = false;
+
+/* Profile the miss ratio curve of the TLB, with working sets of the windows */
+static bool mrc_profile = false;
+static unsigned long mrc_window = 0;
+
+/* Parse text traces ahead on another thread into a ring of this many records */
+static unsigned long pipeline_records = 0;
+static unsigned long pipeline_batch = 0;
+
 /**
- * Initial process
+ * Merge the frames of identical content every this many accesses, checked
+ * between the commands. @ksm_mark is the multiple of it the accesses had
+ * reached at the last pass
  */
-static struct process init = {
-	.pid = 0,
-	.list = LIST_HEAD_INIT(init.list),
-	.pagetable = {
-		.outer_ptes = { NULL },
-	},
-};
+static unsigned long ksm_interval = 0;
+static __sim unsigned long ksm_mark;
+
+/**
+ * Initial process. Set up by __init_system()
+ */
+static __sim struct process init;
 
 /**
- * Current process. Should not be listed in the @processes
+ * CPUs of the system. Commands run on @this_cpu. Its @current process should
+ * not be listed in the @processes, and neither should those of the others
  */
-struct process *current = &init;
+__sim struct cpu cpus[MAX_CPUS];
+unsigned int nr_cpus = 1;
+__sim struct cpu *this_cpu;
 
 /**
  * Ready queue. Put @current process to the tail of this list on
  * switch_process(). Don't forget to remove the switched process from the list.
  */
-LIST_HEAD(processes);
+__sim struct list_head processes;
 
 /**
- * Page table base register
+ * All processes including @current, indexed by their pids
  */
-struct pagetable *ptbr = NULL;
+__sim struct pid_table pids;
 
 /**
- * Map count for each page frame
+ * The number of page frames in the system and map count for each of them
  */
-unsigned int mapcounts[NR_PAGEFRAMES] = { 0 };
+unsigned int nr_pageframes = NR_PAGEFRAMES;
+__sim unsigned int *mapcounts = NULL;
 
 /**
- * TLB of the system
+ * The content tag of each page frame. See ksm.h
  */
-struct tlb_entry tlb[NR_TLB_ENTRIES] = {
-	{false, 0, 0},
-};
+__sim unsigned long *page_tags = NULL;
 
-extern unsigned int alloc_page(unsigned int vpn, unsigned int rw);
-extern void free_page(unsigned int vpn);
-extern bool handle_page_fault(unsigned int vpn, unsigned int rw);
-extern void switch_process(unsigned int pid);
+/**
+ * Address space IDs to tag TLB entries with. They are shared by all CPUs
+ */
+__sim struct asid_allocator asids;
 
-extern bool lookup_tlb(unsigned int vpn, unsigned int rw, unsigned int *pfn);
-extern void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn);
+static unsigned int nr_asids = NR_ASIDS;
+
+/**
+ * Geometry of the TLB of each CPU
+ */
+static unsigned int nr_tlb_entries = NR_TLB_ENTRIES;
+static unsigned int nr_tlb_ways = NR_TLB_WAYS;
+static enum tlb_policy tlb_policy = TLB_POLICY_FIFO;
+static enum tlb_prefetch_policy tlb_prefetch = TLB_PREFETCH_NONE;
+static unsigned int tlb_prefetch_degree = 0;
+
+/**
+ * Swap device. Disabled unless configured, so the allocation fails when all
+ * frames are in use
+ */
+static unsigned int nr_swap_slots = 0;
+static enum swap_policy swap_policy = SWAP_POLICY_CLOCK;
+
+extern unsigned int alloc_page(vpn_t vpn, unsigned int rw);
+extern unsigned int alloc_page_at(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw);
+extern unsigned int alloc_huge_page_at(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw);
+extern void reserve_page_at(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw);
+extern void free_page(vpn_t vpn);
+extern void free_page_at(struct pt_cursor *cursor, vpn_t vpn, struct mmu_gather *gather);
+extern void flush_tlb_range(vpn_t start, vpn_t last, unsigned long stride);
+extern bool handle_page_fault(vpn_t vpn, unsigned int rw);
+extern bool switch_process(unsigned int pid);
+extern bool exit_process(unsigned int pid);
+
+extern bool lookup_tlb(vpn_t vpn, unsigned int rw, unsigned int *pfn);
+extern void insert_tlb(vpn_t vpn, unsigned int rw, unsigned int pfn);
+extern void insert_huge_tlb(vpn_t vpn, unsigned int rw, unsigned int pfn);
+extern void prefetch_tlb(vpn_t vpn, unsigned int rw, unsigned int pfn);
+extern bool migrate_page_at(struct pt_cursor *cursor, vpn_t vpn, struct pte *pte);
+
+/* What the TLB caches for @pte in the directory of @cursor */
+static inline unsigned int __tlb_prot(struct pt_cursor *cursor, struct pte *pte)
+{
+	unsigned int prot = pte_rw(pte);
+
+	/* Shared directories are write-protected as a whole */
+	if (pd_shared(cursor->pd)) prot &= ~ACCESS_WRITE;
+	return prot;
+}
+
+/**
+ * Fill the TLB with the mappings the prefetcher predicts to be translated
+ * after the miss on @vpn. They are looked up in the directory of @cursor,
+ * which @vpn is just translated through, so the prediction stops at the
+ * boundary of the directory. Mappings not valid yet are skipped.
+ */
+static void __prefetch_tlb(struct pt_cursor *cursor, vpn_t vpn)
+{
+	struct tlb *tlb = &this_cpu->tlb;
+	long stride = tlb_prefetch_stride(tlb, vpn);
+
+	for (unsigned int i = 1; stride && i <= tlb->prefetcher.degree; i++) {
+		vpn_t next = vpn + stride * i;
+		struct pte *pte;
+
+		if (next >> pt_shift != vpn >> pt_shift) break;
+
+		pte = cursor->pd->ptes + pt_index(next, nr_pt_levels - 1);
+		if (!pte_valid(pte)) continue;
+
+		prefetch_tlb(next, __tlb_prot(cursor, pte), pte_pfn(pte));
+	}
+}
 
 /**
  * __translate()
@@ -85,25 +198,32 @@ extern void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn);
  * DESCRIPTION
  *   This function simulates the address translation in MMU.
  *   It translates @vpn to @pfn using the page table pointed by @ptbr.
+ *   The page table is walked through @cursor so that translating VPNs in
+ *   the same directory in a row does not walk from the root every time.
+ *   The lookup and the walk are charged to the cost model with @charge,
+ *   which the checks of the simulator itself leave out.
  *
  * RETURN
  *   @true on successful translation
  *   @false if unable to translate. This includes the case when the page access
- *   is for write (indicated in @rw), but @pte->rw indicates it's read-only.
+ *   is for write (indicated in @rw), but pte_rw() indicates it's read-only.
  */
-static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bool *from_tlb)
+static bool __translate(struct pt_cursor *cursor, unsigned int rw, vpn_t vpn,
+		unsigned int *pfn, bool *from_tlb, bool charge)
 {
-	int pd_index = vpn / NR_PTES_PER_PAGE;
-	int pte_index = vpn % NR_PTES_PER_PAGE;
-
-	struct pagetable *pt = ptbr;
-	struct pte_directory *pd;
+	struct pagetable *pt = cursor->pt;
 	struct pte *pte;
+	unsigned int prot;
+	unsigned long nr_reads;
 
 	/* Lookup the mapping from TLB */
-	if (print_tlb_result && lookup_tlb(vpn, rw, pfn)) {
-		*from_tlb = true;
-		return true;
+	if (print_tlb_result) {
+		if (charge) charge_cycles(COST_tlb_hit, 1);
+		if (lookup_tlb(vpn, rw, pfn)) {
+			*from_tlb = true;
+			swap_mark_referenced(*pfn);
+			return true;
+		}
 	}
 
 	/* Nah, TLB miss */
@@ -112,30 +232,57 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bo
 	/* Page table is invalid */
 	if (!pt) return false;
 
-	pd = pt->outer_ptes[pd_index];
+	/* The walk reads the directories down from where the cursor is, and the PTE */
+	nr_reads = global_stats.count[STAT_pt_walk_reads];
+	pte = pt_cursor_lookup(cursor, vpn);
+	if (charge) {
+		charge_cycles(COST_walk,
+				global_stats.count[STAT_pt_walk_reads] - nr_reads + (pte != NULL));
+	}
 
 	/* Page directory does not exist */
-	if (!pd) return false;
-
-	pte = &pd->ptes[pte_index];
+	if (!pte) return false;
 
 	/* PTE is invalid */
-	if (!pte->valid) return false;
+	if (!pte_valid(pte)) return false;
+
+	prot = __tlb_prot(cursor, pte);
 
 	/* Unable to handle the write access */
 	if (rw & ACCESS_WRITE) {
-		if (!(pte->rw & ACCESS_WRITE)) return false;
+		if (!(prot & ACCESS_WRITE)) return false;
 	}
-	*pfn = pte->pfn;
 
-	/* Insert the mapping into TLB */
+	/* The miss hints the page is used on this node */
+	if (numa_migrate) migrate_page_at(cursor, vpn, pte);
+
+	*pfn = pte_pfn(pte);
+	swap_mark_referenced(*pfn);
+
+	/* Insert the mapping into TLB. A huge page takes a single entry */
 	if (print_tlb_result) {
-		insert_tlb(vpn, pte->rw, *pfn);
+		if (cursor->pd->huge) {
+			insert_huge_tlb(vpn, prot, *pfn);
+		} else {
+			insert_tlb(vpn, prot, *pfn);
+			__prefetch_tlb(cursor, vpn);
+		}
 	}
 
 	return true;
 }
 
+/* Count the access to @pfn from @this_cpu as local or remote */
+static void __count_node_access(unsigned int pfn)
+{
+	/* The zero frame is never written, so it is as good as on every node */
+	if (frame_is_zero(pfn) || frame_node(pfn) == cpu_node(this_cpu->id)) {
+		count_event(STAT_numa_local);
+	} else {
+		count_event(STAT_numa_remote);
+	}
+}
+
 /**
  * __access_memory
  *
@@ -147,7 +294,7 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bo
  *   @true on successful access
  *   @false if unable to access @vpn for @rw
  */
-static bool __access_memory(unsigned int vpn, unsigned int rw)
+static bool __access_memory(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw)
 {
 	unsigned int pfn;
 	int ret;
@@ -155,23 +302,18 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 
 	/* Cannot read nor write at the same time!! */
 	assert((rw & ACCESS_READ) ^ (rw & ACCESS_WRITE));
-
-	/**
-	 * We have NR_PTES_PER_PAGE entries in the outer table and so do for
-	 * inner page table. Thus each process can have up to NR_PTES_PER_PAGE^2
-	 * as its VPN
-	 */
-	assert(vpn < NR_PTES_PER_PAGE * NR_PTES_PER_PAGE);
+	count_event(STAT_accesses);
 
 	do {
 		bool from_tlb;
 		/* Ask MMU to translate VPN */
-		if (__translate(rw, vpn, &pfn, &from_tlb)) {
+		if (__translate(cursor, rw, vpn, &pfn, &from_tlb, true)) {
 			/* Success on address translation */
-			if (print_tlb_result) {
-				fprintf(stderr, "%c |", from_tlb ? 'o' : 'x');
-			}
-			fprintf(stderr, " %3u --> %-3u\n", vpn, pfn);
+			if (mrc_profile) mrc_access(current->pid, vpn);
+			if (nr_nodes > 1) __count_node_access(pfn);
+			/* The content is of its own from now on */
+			if ((rw & ACCESS_WRITE) && page_tags[pfn]) page_tags[pfn] = 0;
+			out_access(vpn, pfn, from_tlb);
 			return true;
 		}
 
@@ -179,228 +321,1058 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 		 * Failed to translate the address. So, call OS through the page fault
 		 * and restart the translation if the fault is successfully handled.
 		 * Count the number of retries to prevent buggy translation.
+		 * The handler may change the directories, so walk from the root again.
 		 */
 		nr_retries++;
-	} while ((ret = handle_page_fault(vpn, rw)) == true && nr_retries < 2);
+		ret = handle_page_fault(vpn, rw);
+		pt_cursor_reset(cursor);
+	} while (ret == true && nr_retries < 2);
 
 	if (ret == false) {
-		fprintf(stderr, "Unable to access %u\n", vpn);
+		out_text("Unable to access %lu\n", vpn);
 	}
 
 	return ret;
 }
 
-static unsigned int __make_rwflag(const char *rw)
+/* Whether @vpn is reserved by a lazy allocation but not accessed yet */
+static bool __reserved(struct pt_cursor *cursor, vpn_t vpn)
 {
-	int len = strlen(rw);
-	unsigned int rwflag = ACCESS_READ;
+	struct pte *pte = pt_cursor_lookup(cursor, vpn);
 
-	for (int i = 0; i < len; i++) {
-		if (rw[i] == 'r' || rw[i] == 'R') {
-			rwflag |= ACCESS_READ;
-		}
-		if (rw[i] == 'w' || rw[i] == 'W') {
-			rwflag |= ACCESS_WRITE;
+	return pte && pte_reserved(pte);
+}
+
+/* Whether @vpn is allocated but swapped out */
+static bool __swapped_out(struct pt_cursor *cursor, vpn_t vpn, unsigned int *slot)
+{
+	struct pte *pte = pt_cursor_lookup(cursor, vpn);
+
+	if (!pte || !pte_swapped(pte)) return false;
+
+	*slot = pte_pfn(pte);
+	return true;
+}
+
+/**
+ * Allocate a huge page covering the last-level directory for @vpn. It has
+ * to start the directory, and none of the VPNs in it may be allocated.
+ */
+static bool __alloc_huge_page(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw)
+{
+	unsigned int pfn;
+
+	if (nr_pt_levels < 2) {
+		out_text("huge pages need two or more page table levels\n");
+		return false;
+	}
+	if (vpn & (NR_PD_ENTRIES - 1)) {
+		out_text("%lu is not aligned to a huge page\n", vpn);
+		return false;
+	}
+	for (unsigned int i = 0; i < NR_PD_ENTRIES; i++) {
+		struct pte *pte = pt_cursor_lookup(cursor, vpn + i);
+
+		if (!pte) break;
+		if (pte_present(pte) || pte_reserved(pte)) {
+			out_text("%lu is already allocated\n", vpn + i);
+			return false;
 		}
 	}
-	return rwflag;
+
+	pfn = alloc_huge_page_at(cursor, vpn, rw);
+	if (pfn == -1) {
+		out_text("no free block for a huge page\n");
+		return false;
+	}
+	out_alloc(vpn, pfn, NR_PD_ENTRIES);
+
+	return true;
 }
 
-static bool __alloc_page(unsigned int vpn, unsigned int rw)
+/* Allocate a page at @vpn for @rw holding the content of @tag, or of its own with 0 */
+static bool __alloc_page(struct pt_cursor *cursor, vpn_t vpn, unsigned int rw,
+		unsigned long tag)
 {
 	unsigned int pfn;
 	bool from_tlb;
 
+	if (rw & ACCESS_HUGE) {
+		return __alloc_huge_page(cursor, vpn, rw & ~ACCESS_HUGE);
+	}
+
 	assert(rw);
 	assert(rw & ACCESS_READ);
 
 	/* Check whether the requested VPN is already allocated */
-	if (__translate(ACCESS_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is already allocated to %u\n", vpn, pfn);
+	if (__translate(cursor, ACCESS_READ, vpn, &pfn, &from_tlb, false)) {
+		out_text("%lu is already allocated to %u\n", vpn, pfn);
 		return false;
 	}
+	if (__swapped_out(cursor, vpn, &pfn)) {
+		out_text("%lu is already allocated to swap %u\n", vpn, pfn);
+		return false;
+	}
+	if (__reserved(cursor, vpn)) {
+		out_text("%lu is already allocated lazily\n", vpn);
+		return false;
+	}
+
+	if (rw & ACCESS_LAZY) {
+		reserve_page_at(cursor, vpn, rw & ~ACCESS_LAZY);
+		out_reserve(vpn);
+		return true;
+	}
 
-	pfn = alloc_page(vpn, rw);
+	pfn = alloc_page_at(cursor, vpn, rw);
 	if (pfn == -1) {
-		fprintf(stderr, "memory is full\n");
+		out_text("memory is full\n");
 		return false;
 	}
-	fprintf(stderr, "alloc %3u --> %-3u\n", vpn, pfn);
+	page_tags[pfn] = tag;
+	out_alloc(vpn, pfn, 0);
 	
 	return true;
 }
 
-static bool __free_page(unsigned int vpn)
+static bool __free_page(struct pt_cursor *cursor, vpn_t vpn, struct mmu_gather *gather)
 {
 	unsigned int pfn;
 	bool from_tlb;
 
-	if (!__translate(ACCESS_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is not allocated\n", vpn);
+	if (__swapped_out(cursor, vpn, &pfn)) {
+		out_free(vpn, pfn, true);
+	} else if (__reserved(cursor, vpn)) {
+		out_unreserve(vpn);
+	} else if (__translate(cursor, ACCESS_READ, vpn, &pfn, &from_tlb, false)) {
+		out_free(vpn, pfn, false);
+	} else {
+		out_text("%lu is not allocated\n", vpn);
 		return false;
 	}
-	fprintf(stderr, "free %u (pfn %u)\n", vpn, pfn);
-	free_page(vpn);
+	free_page_at(cursor, vpn, gather);
+
+	return true;
+}
+
+/**
+ * Iterate VPNs in [@start, @last] every @stride. The range is checked with
+ * __check_range() beforehand, so that @vpn never overflows
+ */
+#define for_each_vpn(vpn, start, last, stride) \
+	for (vpn = (start); vpn <= (last); vpn += (stride))
 
+static bool __check_range(vpn_t start, vpn_t last, unsigned long stride)
+{
+	/**
+	 * We have NR_PD_ENTRIES entries in each of nr_pt_levels directories.
+	 * Thus each process can have up to NR_PD_ENTRIES^nr_pt_levels VPNs
+	 */
+	if (!pt_vpn_valid(last) || !pt_vpn_valid(stride)) {
+		out_text("%lu is out of range\n", last);
+		return false;
+	}
 	return true;
 }
 
+/**
+ * __access_range(), __alloc_range(), __free_range()
+ *
+ * DESCRIPTION
+ *   Run the access, allocation, or deallocation for each VPN in the range as
+ *   one batch. They share a page table cursor, so each directory is walked
+ *   down once, and the TLB entries of freed pages are invalidated in bulk,
+ *   with a single shootdown to each remote CPU.
+ *   The result is the same as doing it page by page.
+ *   The pages allocated with @tag hold the content of it at their offsets
+ *   from @start.
+ *
+ * RETURN
+ *   @false if the simulation should stop (i.e., the allocation failed)
+ *   @true otherwise
+ */
+static bool __access_range(vpn_t start, vpn_t last, unsigned long stride, unsigned int rw)
+{
+	struct pt_cursor cursor;
+	vpn_t vpn;
+
+	if (!__check_range(start, last, stride)) return true;
+
+	pt_cursor_init(&cursor, ptbr);
+	for_each_vpn(vpn, start, last, stride) {
+		__access_memory(&cursor, vpn, rw);
+	}
+	return true;
+}
+
+static bool __alloc_range(vpn_t start, vpn_t last, unsigned long stride, unsigned int rw,
+		unsigned long tag)
+{
+	struct pt_cursor cursor;
+	vpn_t vpn;
+
+	if (!__check_range(start, last, stride)) return false;
+
+	/* Each huge page takes a directory regardless of @last */
+	if (rw & ACCESS_HUGE) {
+		stride = (stride + NR_PD_ENTRIES - 1) & ~(NR_PD_ENTRIES - 1UL);
+	} else if (lazy_alloc && !tag) {
+		/* Tagged pages have the content already, so they are mapped now */
+		rw |= ACCESS_LAZY;
+	}
+
+	pt_cursor_init(&cursor, ptbr);
+	for_each_vpn(vpn, start, last, stride) {
+		if (!__alloc_page(&cursor, vpn, rw, tag ? page_tag(tag, vpn - start) : 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool __free_range(vpn_t start, vpn_t last, unsigned long stride)
+{
+	struct pt_cursor cursor;
+	struct mmu_gather gather;
+	vpn_t vpn;
+
+	if (!__check_range(start, last, stride)) return true;
+
+	pt_cursor_init(&cursor, ptbr);
+	mmu_gather_init(&gather, current);
+	for_each_vpn(vpn, start, last, stride) {
+		__free_page(&cursor, vpn, &gather);
+	}
+	flush_tlb_range(start, last, stride);
+	mmu_gather_finish(&gather);
+
+	return true;
+}
+
+/**
+ * __init_system()
+ *
+ * DESCRIPTION
+ *   Set up the simulation of this thread from scratch, with the init process
+ *   running on cpu 0. A thread may run a simulation after another one torn
+ *   down by __exit_system().
+ */
 static void __init_system(void)
 {
-	ptbr = &init.pagetable;
+	init = (struct process) {
+		.pid = 0,
+		.cpu = cpus,
+		.mempolicy = default_mempolicy,
+	};
+	INIT_LIST_HEAD(&init.list);
+	INIT_LIST_HEAD(&processes);
+	memset(&global_stats, 0, sizeof(global_stats));
+
+	mapcounts = calloc(nr_pageframes + 1, sizeof(*mapcounts));
+	page_tags = calloc(nr_pageframes + 1, sizeof(*page_tags));
+	ksm_mark = 0;
+	frame_init(nr_pageframes, nr_nodes, NR_PD_ENTRIES);
+	rmap_init(nr_pageframes);
+	if (mrc_profile) mrc_init(mrc_window);
+	if (nr_swap_slots) swap_init(nr_swap_slots, swap_policy, nr_pageframes);
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		cpus[i] = (struct cpu) { .id = i, };
+		tlb_init(&cpus[i].tlb, nr_tlb_entries, nr_tlb_ways, tlb_policy, pt_shift);
+		tlb_init_prefetch(&cpus[i].tlb, tlb_prefetch, tlb_prefetch_degree);
+	}
+	this_cpu = cpus;
+	cpus[0].curr = &init;
+	asid_init(&asids, nr_asids);
+	switch_mm(cpus, &init);
+	pt_init();
+	proc_cache_init();
+	pid_table_init(&pids);
+	pid_table_insert(&pids, &init);
+
+	cpus[0].pt_base = &init.pagetable;
+}
+
+/* Tear down the simulation. The processes go away with their slab caches */
+static void __exit_system(void)
+{
+	pid_table_exit(&pids);
+	proc_cache_exit();
+	pt_exit();
+	asid_exit(&asids);
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		tlb_exit(&cpus[i].tlb);
+	}
+	swap_exit();
+	if (mrc_profile) mrc_exit();
+	rmap_exit();
+	frame_exit();
+	free(page_tags);
+	page_tags = NULL;
+	free(mapcounts);
+	mapcounts = NULL;
+}
+
+/**
+ * __restore()
+ *
+ * DESCRIPTION
+ *   Replace the simulation with the snapshot at @path. The simulation is set
+ *   up from scratch to restore the snapshot in, and again if the snapshot
+ *   turns out to be corrupted on the way.
+ *
+ * RETURN
+ *   @true if the snapshot is restored
+ *   @false otherwise. The simulation is left as it was unless the snapshot
+ *   is corrupted
+ */
+static bool __restore(const char *path)
+{
+	struct snapshot snap;
+	bool restored;
+
+	switch (snapshot_open(&snap, path)) {
+	case SNAPSHOT_NO_FILE:
+		out_text("Unable to open snapshot %s\n", path);
+		return false;
+	case SNAPSHOT_INVALID:
+		out_text("%s is not a snapshot\n", path);
+		return false;
+	case SNAPSHOT_MISMATCH:
+		out_text("Snapshot %s is of another configuration\n", path);
+		return false;
+	}
+
+	__exit_system();
+	__init_system();
+	restored = snapshot_load(&snap);
+	snapshot_close(&snap);
+
+	if (!restored) {
+		out_text("Snapshot %s is corrupted. Start over\n", path);
+		__exit_system();
+		__init_system();
+	}
+
+	/* The snapshot was taken between commands, so right after a check */
+	if (ksm_interval) {
+		ksm_mark = global_stats.count[STAT_accesses];
+		ksm_mark -= ksm_mark % ksm_interval;
+	}
+	return restored;
 }
 
 static void __show_pageframes(void)
 {
-	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
+	for (unsigned int i = 0; i < nr_pageframes; i++) {
 		if (!mapcounts[i]) continue;
-		fprintf(stderr, "%3u: %d\n", i, mapcounts[i]);
+		out_text("%3u: %d\n", i, mapcounts[i]);
 	}
-	fprintf(stderr, "\n");
+	out_text("\n");
+}
+
+static void __show_pagedir(struct pte_directory *pd, vpn_t base, void *data)
+{
+	int width = *(int *)data;
+
+	for (unsigned int j = 0; j < NR_PD_ENTRIES; j++) {
+		struct pte *pte = &pd->ptes[j];
+		vpn_t vpn = (base << pt_shift) | j;
+
+		if (!verbose && !pte_present(pte) && !pte_reserved(pte)) continue;
+		for (unsigned int level = 0; level < nr_pt_levels; level++) {
+			out_text("%s%0*u", level ? ":" : "", width, pt_index(vpn, level));
+		}
+		out_text(" | %c %c%c | %-3d%s\n",
+			pte_valid(pte) ? 'v' : (pte_swapped(pte) ? 's' :
+					(pte_reserved(pte) ? 'l' : ' ')),
+			pte_valid(pte) ? (pte_rw(pte) & ACCESS_READ ? 'r' : ' ') : ' ',
+			pte_rw(pte) & ACCESS_WRITE && !pd_shared(pd) ? 'w' : ' ',
+			pte_pfn(pte), pd->huge ? " h" : "");
+	}
+	out_msg("\n");
 }
 
 static void __show_pagetable(void)
 {
-	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+	int width = 2;
+
+	/* Wide enough to print the largest index in a directory */
+	for (unsigned int max = NR_PD_ENTRIES - 1; max >= 100; max /= 10) {
+		width++;
+	}
+
+	out_text("\n*** PID %u ***\n", current->pid);
+
+	pt_for_each_leaf(&current->pagetable, __show_pagedir, &width);
+}
+
+static void __show_tlb(void)
+{
+	struct tlb_entry *t;
 
-	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
-		struct pte_directory *pd = current->pagetable.outer_ptes[i];
+	tlb_for_each_entry(t, &this_cpu->tlb) {
+		if (t->asid != current->asid) continue;
 
-		if (!pd) continue;
+		out_text("%c%c | %3lu -> %-3d%s\n",
+				tlb_entry_rw(t) & ACCESS_READ ? 'r' : ' ',
+				tlb_entry_rw(t) & ACCESS_WRITE ? 'w' : ' ',
+				t->vpn, tlb_entry_pfn(t), tlb_entry_huge(t) ? " h" : "");
+	}
+}
 
-		for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
-			struct pte *pte = &pd->ptes[j];
+static void __show_tlb_stats(void)
+{
+	struct tlb *tlb = &this_cpu->tlb;
+	unsigned long nr_lookups = tlb->nr_hits + tlb->nr_misses;
+
+	out_text("hits %lu misses %lu (%.2f%% hit)\n",
+			tlb->nr_hits, tlb->nr_misses,
+			nr_lookups ? tlb->nr_hits * 100.0 / nr_lookups : 0.0);
+	out_text("flushes %lu asid-flushes %lu asid-rollovers %lu\n",
+			tlb->nr_flushes, tlb->nr_asid_flushes, asids.nr_rollovers);
+	if (tlb->prefetcher.policy != TLB_PREFETCH_NONE) {
+		out_text("prefetches %lu used %lu (%.2f%% accurate, %s:%u)\n",
+				tlb->nr_prefetches, tlb->nr_prefetch_hits,
+				tlb->nr_prefetches ?
+					tlb->nr_prefetch_hits * 100.0 / tlb->nr_prefetches : 0.0,
+				tlb_prefetch_name(tlb->prefetcher.policy),
+				tlb->prefetcher.degree);
+	}
+}
+
+/* Average cycles of the accesses in @stats. See cost.h */
+static double __amat(const struct stats *stats)
+{
+	unsigned long nr = stats->count[STAT_accesses];
 
-			if (!verbose && !pte->valid) continue;
-			fprintf(stderr, "%02d:%02d | %c %c%c | %-3d\n", i, j,
-				pte->valid ? 'v' : ' ',
-				pte->valid ? (pte->rw & ACCESS_READ ? 'r' : ' ') : ' ',
-				pte->rw & ACCESS_WRITE ? 'w' : ' ',
-				pte->pfn);
+	return nr ? (double)stats->count[STAT_cycles] / nr : 0.0;
+}
+
+static void __show_stats(void)
+{
+	struct kmem_cache *c;
+	unsigned int nr_shared, nr_sharing;
+
+	out_text("%-20s %12s %12s\n", "counter", "current", "all");
+	for (unsigned int i = 0; i < NR_STATS; i++) {
+		out_text("%-20s %12lu %12lu\n", stat_names[i],
+				current ? current->stats.count[i] : 0, global_stats.count[i]);
+	}
+	out_text("%-20s %12s %12u\n", "peak_frames", "-", nr_peak_frames());
+	out_text("%-20s %12.2f %12.2f\n", "amat",
+			current ? __amat(&current->stats) : 0.0, __amat(&global_stats));
+	out_text("\n");
+
+	if (swap_enabled()) {
+		out_text("swap %u/%u slots in use (%s)\n\n",
+				nr_swap_slots - nr_free_swap_slots(), nr_swap_slots,
+				swap_policy_name());
+	}
+
+	ksm_count(&nr_shared, &nr_sharing);
+	if (nr_shared) {
+		out_text("ksm %u frames shared by %u mappings\n\n", nr_shared, nr_sharing);
+	}
+
+	if (nr_nodes > 1) {
+		for (unsigned int i = 0; i < nr_nodes; i++) {
+			out_text("node %u: %u frames free\n", i, nr_free_frames_node(i));
+		}
+		if (current && current->mempolicy.mode == MPOL_PREFERRED) {
+			out_text("mempolicy preferred %u\n\n", current->mempolicy.node);
+		} else if (current) {
+			out_text("mempolicy %s\n\n", mempolicy_name(&current->mempolicy));
+		} else {
+			out_text("\n");
 		}
-		printf("\n");
+	}
+
+	out_text("%-14s %8s %8s %6s %8s %6s\n",
+			"cache", "active", "objs", "slabs", "objsize", "near");
+	list_for_each_entry(c, &kmem_caches, list) {
+		out_text("%-14s %8lu %8lu %6lu %8zu %5.1f%%\n",
+				c->name, c->nr_active, c->nr_slabs * c->nr_per_slab,
+				c->nr_slabs, c->obj_size,
+				c->nr_allocs ? c->nr_near * 100.0 / c->nr_allocs : 0.0);
 	}
 }
 
-static void __show_tlb(void)
+/**
+ * Dump the counters of the system and each live process on exit, in the
+ * "scope counter value" form easy to compare across runs
+ */
+static void __dump_stats(const char *path)
 {
-	for (int i = 0; i < sizeof(tlb) / sizeof(*tlb); i++) {
-		struct tlb_entry *t = tlb + i;
+	FILE *out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	struct process *proc;
+	struct cpu *cpu;
+	char scope[32];
+
+	if (!out) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return;
+	}
 
-		if (!t->valid) continue;
+	stats_dump(out, "all", &global_stats);
+	fprintf(out, "all peak_frames %u\n", nr_peak_frames());
 
-		fprintf(stderr, "%c%c | %3d -> %-3d\n",
-				t->rw & ACCESS_READ ? 'r' : ' ',
-				t->rw & ACCESS_WRITE ? 'w' : ' ',
-				t->vpn, t->pfn);
+	for_each_cpu(cpu) {
+		if (!cpu->curr) continue;
+		snprintf(scope, sizeof(scope), "pid%u", cpu->curr->pid);
+		stats_dump(out, scope, &cpu->curr->stats);
 	}
+	list_for_each_entry(proc, &processes, list) {
+		snprintf(scope, sizeof(scope), "pid%u", proc->pid);
+		stats_dump(out, scope, &proc->stats);
+	}
+
+	if (out != stdout) fclose(out);
 }
 
 static void __print_help(void)
 {
-	printf("  help | ?     : Print out this help message \n");
-	printf("  exit         : Exit the simulation\n");
-	printf("\n");
-	printf("  switch [pid] : Do context switch to pid @pid\n");
-	printf("                 Fork @pid if there is no process with the pid\n");
-	printf("  show         : Show the page table of the current process\n");
-	printf("  frames       : Show the status for each page frame\n");
-	printf("  tlb          : Show TLB entries\n");
-	printf("\n");
-	printf("  alloc [vpn] r|w  : Allocate a page according to the rw flag\n");
-	printf("  free [vpn]       : Deallocate the page at VPN @vpn\n");
-	printf("  access [vpn] r|w : Access VPN @vpn for read or write\n");
-	printf("  read [vpn]       : Equivalent to access @vpn r\n");
-	printf("  write [vpn]      : Equivalent to access @vpn w\n");
-	printf("\n");
+	out_msg("  help | ?     : Print out this help message \n");
+	out_msg("  exit         : Exit the simulation\n");
+	out_msg("\n");
+	out_msg("  switch [pid] : Do context switch to pid @pid\n");
+	out_msg("                 Fork @pid if there is no process with the pid\n");
+	out_msg("  exit [pid]   : Tear down the process @pid and reclaim its pages\n");
+	out_msg("  kill [pid]   : Same as exit @pid\n");
+	out_msg("  cpu [n]      : Run the following commands on cpu @n\n");
+	out_msg("  show         : Show the page table of the current process\n");
+	out_msg("  frames       : Show the status for each page frame\n");
+	out_msg("  tlb          : Show TLB entries\n");
+	out_msg("  tlbstat      : Show TLB hit/miss and flush counters\n");
+	out_msg("  stats        : Show event counters and the object caches\n");
+	out_msg("  mempolicy local|interleave|preferred {node}\n");
+	out_msg("               : Set where the frames of the current process come from\n");
+	out_msg("  merge        : Merge the frames of identical content\n");
+	out_msg("  snapshot [file] : Save the whole simulation to @file\n");
+	out_msg("  restore [file]  : Resume the simulation saved in @file\n");
+	out_msg("\n");
+	out_msg("  alloc [vpn] r|w  : Allocate a page according to the rw flag\n");
+	out_msg("  free [vpn]       : Deallocate the page at VPN @vpn\n");
+	out_msg("  access [vpn] r|w : Access VPN @vpn for read or write\n");
+	out_msg("  read [vpn]       : Equivalent to access @vpn r\n");
+	out_msg("  write [vpn]      : Equivalent to access @vpn w\n");
+	out_msg("\n");
+	out_msg("  Each of them also takes a range of VPNs from @start to @last,\n");
+	out_msg("  optionally every @stride pages, which is run as one batch\n");
+	out_msg("  alloc [start] [last] r|w {stride}\n");
+	out_msg("  free [start] [last] {stride}\n");
+	out_msg("  access [start] [last] r|w {stride}\n");
+	out_msg("  read [start] [last] {stride}\n");
+	out_msg("  write [start] [last] {stride}\n");
+	out_msg("\n");
+	out_msg("  Adding h to the rw flag of alloc maps a huge page, which is a whole\n");
+	out_msg("  last-level directory of contiguous frames cached in a TLB entry.\n");
+	out_msg("  @vpn should be aligned to a directory, and a range gets one every\n");
+	out_msg("  directory\n");
+	out_msg("  alloc [vpn] r|w{h}\n");
+	out_msg("\n");
+	out_msg("  Adding l instead reserves the page, and maps it on the first access.\n");
+	out_msg("  Reads before the first write are served from the zero frame, which\n");
+	out_msg("  follows the last frame\n");
+	out_msg("  alloc [vpn] r|w{l}\n");
+	out_msg("\n");
+	out_msg("  A tag fills the pages with the content it names, which the pages of\n");
+	out_msg("  the same tag at the same offset into their ranges have in common.\n");
+	out_msg("  merge shares such pages copy-on-write, and frees the other frames\n");
+	out_msg("  alloc [start] {last} r|w {stride} tag=[name]\n");
+	out_msg("\n");
 }
 
-static bool strmatch(char * const str, const char *expect)
+/* Whether @op works on the address space of @current */
+static bool __needs_process(unsigned char op)
 {
-	return (strlen(str) == strlen(expect)) &&
-			(strncmp(str, expect, strlen(expect)) == 0);
+	switch (op) {
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+	case TRACE_OP_FREE:
+	case TRACE_OP_SHOW:
+	case TRACE_OP_TLB:
+	case TRACE_OP_MEMPOLICY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Run the merge pass if @ksm_interval accesses have passed since the last one */
+static void __ksm_tick(void)
+{
+	unsigned long nr = global_stats.count[STAT_accesses];
+
+	if (!ksm_interval || nr - ksm_mark < ksm_interval) return;
+
+	ksm_mark = nr - nr % ksm_interval;
+	ksm_merge();
+}
+
+/**
+ * __run_command()
+ *
+ * DESCRIPTION
+ *   Simulate a decoded trace command.
+ *
+ * RETURN
+ *   @false if the simulation should stop
+ *   @true otherwise
+ */
+static bool __run_command(const struct trace_cmd *cmd)
+{
+	__ksm_tick();
+
+	if (!current && __needs_process(cmd->op)) {
+		out_text("cpu %u is idle\n", this_cpu->id);
+		return true;
+	}
+
+	switch (cmd->op) {
+	case TRACE_OP_ACCESS:
+		return __access_range(cmd->vpn, cmd->last, cmd->stride, cmd->rw);
+	case TRACE_OP_ALLOC:
+		return __alloc_range(cmd->vpn, cmd->last, cmd->stride, cmd->rw, cmd->arg);
+	case TRACE_OP_FREE:
+		return __free_range(cmd->vpn, cmd->last, cmd->stride);
+	case TRACE_OP_SWITCH:
+		if (!switch_process(cmd->arg)) {
+			out_text("Unable to switch to %lu\n", cmd->arg);
+		}
+		break;
+	case TRACE_OP_CPU:
+		if (cmd->arg >= nr_cpus) {
+			out_text("No cpu %lu\n", cmd->arg);
+			break;
+		}
+		this_cpu = cpus + cmd->arg;
+		break;
+	case TRACE_OP_MEMPOLICY:
+		if (cmd->rw == MPOL_PREFERRED && cmd->arg >= nr_nodes) {
+			out_text("No node %lu\n", cmd->arg);
+			break;
+		}
+		current->mempolicy = (struct mempolicy) {
+			.mode = cmd->rw,
+			.node = cmd->rw == MPOL_PREFERRED ? cmd->arg : 0,
+		};
+		break;
+	case TRACE_OP_KILL:
+		if (!exit_process(cmd->arg)) {
+			out_text("Unable to exit %lu\n", cmd->arg);
+		}
+		break;
+	case TRACE_OP_SNAPSHOT:
+		if (!snapshot_save(cmd->path)) {
+			out_text("Unable to save snapshot %s\n", cmd->path);
+		}
+		break;
+	case TRACE_OP_RESTORE:
+		__restore(cmd->path);
+		break;
+	case TRACE_OP_SHOW:
+		__show_pagetable();
+		break;
+	case TRACE_OP_FRAMES:
+		__show_pageframes();
+		break;
+	case TRACE_OP_TLB:
+		__show_tlb();
+		break;
+	case TRACE_OP_TLBSTAT:
+		__show_tlb_stats();
+		break;
+	case TRACE_OP_STATS:
+		__show_stats();
+		break;
+	case TRACE_OP_MERGE:
+		ksm_merge();
+		break;
+	case TRACE_OP_HELP:
+		__print_help();
+		break;
+	case TRACE_OP_EXIT:
+		return false;
+	}
+	return true;
+}
+
+/* The pid of @current, prefixed by the CPU when there are more than one */
+static void __print_prompt(void)
+{
+	if (nr_cpus > 1) out_msg("cpu%u:", this_cpu->id);
+
+	if (current) {
+		out_msg("%d >> ", current->pid);
+	} else {
+		out_msg("- >> ");
+	}
+}
+
+/**
+ * __run_line()
+ *
+ * DESCRIPTION
+ *   Simulate a line of the text trace parsed into @cmd with @result, or
+ *   complain about it in the name of @name.
+ *
+ * RETURN
+ *   @false if the simulation should stop
+ *   @true otherwise
+ */
+static bool __run_line(int result, const struct trace_cmd *cmd, const char *name)
+{
+	switch (result) {
+	case TRACE_PARSE_EMPTY:
+		return true;
+	case TRACE_PARSE_UNKNOWN:
+		out_msg("Unknown command %s\n", name);
+		break;
+	case TRACE_PARSE_BAD_ARGS:
+		out_msg("Invalid arguments for %s\n", name);
+		break;
+	default:
+		if (!__run_command(cmd)) return false;
+		break;
+	}
+
+	if (verbose) __print_prompt();
+	return true;
 }
 
 static void __do_simulation(FILE *input)
 {
 	char command[MAX_COMMAND_LEN] = { 0 };
 
-	__init_system();
-
 	while (fgets(command, sizeof(command), input)) {
-		char *tokens[MAX_NR_TOKENS] = { NULL };
-		int nr_tokens = 0;
+		struct trace_cmd cmd;
+		char *name;
+		int result = trace_parse_line(command, &cmd, &name);
 
-		/* Make the command lowercase */
-		for (size_t i = 0; i < strlen(command); i++) {
-			command[i] = tolower(command[i]);
+		if (!__run_line(result, &cmd, name)) return;
+	}
+}
+
+/**
+ * __do_pipelined_simulation()
+ *
+ * DESCRIPTION
+ *   Simulate the text trace in @input as __do_simulation() does, while the
+ *   lines are read and parsed ahead on another thread. See pipeline.h
+ */
+static void __do_pipelined_simulation(FILE *input)
+{
+	struct trace_pipeline pipe;
+	struct pipeline_record *records;
+	unsigned long nr;
+
+	if (!pipeline_start(&pipe, input, pipeline_records, pipeline_batch)) {
+		__do_simulation(input);
+		return;
+	}
+
+	while ((nr = pipeline_next(&pipe, &records))) {
+		for (unsigned long i = 0; i < nr; i++) {
+			if (!__run_line(records[i].result, &records[i].cmd, records[i].text)) {
+				goto out;
+			}
 		}
+		pipeline_consume(&pipe, nr);
+	}
+out:
+	pipeline_finish(&pipe);
+}
+
+/**
+ * __replay_trace()
+ *
+ * DESCRIPTION
+ *   Replay the binary trace mapped at @buf. Records are decoded straight
+ *   from the mapping, and nothing is allocated nor copied per record.
+ */
+static void __replay_trace(const unsigned char *buf, size_t len)
+{
+	const unsigned char *pos = buf + TRACE_MAGIC_LEN;
+	const unsigned char *end = buf + len;
+	vpn_t last_vpn = 0;
+
+	while (pos < end) {
+		struct trace_cmd cmd;
 
-		if (parse_command(command, &nr_tokens, tokens) < 0) {
-			continue;
+		if (!trace_decode(&pos, end, &cmd, &last_vpn)) {
+			out_text("Corrupted trace at offset %zu\n", (size_t)(pos - buf));
+			return;
 		}
-		if (nr_tokens == 0) continue;
-
-		if (nr_tokens == 1) {
-			if (strmatch(tokens[0], "exit")) break;
-			if (strmatch(tokens[0], "show")) {
-				__show_pagetable();
-			} else if (strmatch(tokens[0], "frames")) {
-				__show_pageframes();
-			} else if (strmatch(tokens[0], "tlb")) {
-				__show_tlb();
-			} else if (strmatch(tokens[0], "help") || strmatch(tokens[0], "?")) {
-				__print_help();
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 2) {
-			unsigned int arg = strtoimax(tokens[1], NULL, 0);
-
-			if (strmatch(tokens[0], "switch") || strmatch(tokens[0], "s")) {
-				switch_process(arg);
-			} else if (strmatch(tokens[0], "free") || strmatch(tokens[0], "f")) {
-				__free_page(arg);
-			} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
-				__access_memory(arg, ACCESS_READ);
-			} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
-				__access_memory(arg, ACCESS_WRITE);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 3) {
-			unsigned int vpn = strtoimax(tokens[1], NULL, 0);
-			unsigned int rw = __make_rwflag(tokens[2]);
-
-			if (strmatch(tokens[0], "alloc") || strmatch(tokens[0], "a")) {
-				if (!__alloc_page(vpn, rw)) break;
-			} else if (strmatch(tokens[0], "access")) {
-				__access_memory(vpn, rw);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
+		if (!__run_command(&cmd)) return;
+	}
+}
+
+/**
+ * Map @input and replay it if it is a binary trace.
+ * Return false if @input is not a binary trace.
+ */
+static bool __replay_binary(FILE *input)
+{
+	struct stat st;
+	void *buf;
+
+	if (fstat(fileno(input), &st) || st.st_size < TRACE_MAGIC_LEN) return false;
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(input), 0);
+	if (buf == MAP_FAILED) return false;
+
+	if (!trace_is_binary(buf, st.st_size)) {
+		munmap(buf, st.st_size);
+		return false;
+	}
+
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+	__replay_trace(buf, st.st_size);
+	munmap(buf, st.st_size);
+
+	return true;
+}
+
+/* Whether @input is a regular file, which can be read ahead until its end */
+static bool __is_regular(FILE *input)
+{
+	struct stat st;
+
+	return !fstat(fileno(input), &st) && S_ISREG(st.st_mode);
+}
+
+/* Simulate the commands from @input, which may be a binary trace, and profile */
+static void __simulate(FILE *input)
+{
+	if (input == stdin || !__replay_binary(input)) {
+		if (pipeline_records && __is_regular(input)) {
+			__do_pipelined_simulation(input);
 		} else {
-			assert(!"Unknown command in trace");
+			__do_simulation(input);
 		}
+	}
+	if (mrc_profile) mrc_report();
+}
+
+/**
+ * A trace run by the runner. The results are kept until they are merged
+ * in the order of the traces, and so are the counters of the system
+ */
+struct trace_job {
+	const char *path;
+
+	char *out, *msg;
+	size_t out_len, msg_len;
+
+	struct stats stats;
+	unsigned int peak_frames;
+};
+
+static void __run_job(unsigned int i, void *data)
+{
+	struct trace_job *job = (struct trace_job *)data + i;
+	FILE *out = open_memstream(&job->out, &job->out_len);
+	FILE *msg = open_memstream(&job->msg, &job->msg_len);
+	FILE *input;
+
+	output_init(out, msg);
+
+	input = fopen(job->path, "r");
+	if (input) {
+		__init_system();
+		if (!restore_path || __restore(restore_path)) __simulate(input);
+		job->stats = global_stats;
+		job->peak_frames = nr_peak_frames();
+		__exit_system();
+		fclose(input);
+	} else {
+		out_text("No input file %s\n", job->path);
+	}
+
+	fclose(out);
+	fclose(msg);
+}
+
+/* Dump the counters summed over the traces, followed by those of each */
+static void __dump_merged_stats(const char *path, struct trace_job *jobs, unsigned int nr_jobs)
+{
+	FILE *out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	struct stats total = { 0 };
+	unsigned int peak = 0;
+
+	if (!out) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return;
+	}
+
+	for (unsigned int i = 0; i < nr_jobs; i++) {
+		for (unsigned int j = 0; j < NR_STATS; j++) {
+			total.count[j] += jobs[i].stats.count[j];
+		}
+		if (jobs[i].peak_frames > peak) peak = jobs[i].peak_frames;
+	}
+	stats_dump(out, "all", &total);
+	fprintf(out, "all peak_frames %u\n", peak);
+
+	for (unsigned int i = 0; i < nr_jobs; i++) {
+		stats_dump(out, jobs[i].path, &jobs[i].stats);
+		fprintf(out, "%s peak_frames %u\n", jobs[i].path, jobs[i].peak_frames);
+	}
+
+	if (out != stdout) fclose(out);
+}
 
-		if (verbose) printf("%d >> ", current->pid);
+/**
+ * __run_traces()
+ *
+ * DESCRIPTION
+ *   Simulate each of the @nr_traces traces at @paths from scratch, on
+ *   @nr_threads threads in parallel. The results of each trace are merged
+ *   to stderr and stdout in the order of @paths as soon as the trace and
+ *   the ones before it are done, each headed by the path of the trace.
+ *
+ * RETURN
+ *   @false if unable to start the threads
+ */
+static bool __run_traces(char * const paths[], unsigned int nr_traces, unsigned int nr_threads)
+{
+	struct trace_job *jobs = calloc(nr_traces, sizeof(*jobs));
+	struct runner runner;
+
+	for (unsigned int i = 0; i < nr_traces; i++) {
+		jobs[i].path = paths[i];
+	}
+
+	if (!runner_start(&runner, nr_traces, nr_threads, __run_job, jobs)) {
+		fprintf(stderr, "Unable to start %u threads\n", nr_threads);
+		free(jobs);
+		return false;
 	}
+
+	for (unsigned int i = 0; i < nr_traces; i++) {
+		runner_wait(&runner, i);
+
+		fprintf(stderr, "==> %s <==\n", jobs[i].path);
+		fwrite(jobs[i].out, 1, jobs[i].out_len, stderr);
+		printf("==> %s <==\n", jobs[i].path);
+		fwrite(jobs[i].msg, 1, jobs[i].msg_len, stdout);
+
+		free(jobs[i].out);
+		free(jobs[i].msg);
+	}
+	runner_finish(&runner);
+
+	if (stats_path) __dump_merged_stats(stats_path, jobs, nr_traces);
+	free(jobs);
+
+	return true;
 }
 
 static void __print_usage(const char * name)
 {
-	printf("Usage: %s {-q} {-f [workload file]}\n", name);
+	printf("Usage: %s {-q} {-t} {-m [frames]} {-T [tlb]} {-A [asids]} {-p [pagetable]} {-L} {-Z} {-F [prefetch]} {-a [pages]} {-W} {-M [window]} {-P [pipeline]} {-N [numa]} {-C [cost]} {-K [interval]} {-s [swap]} {-c [cpus]} {-j [jobs]} {-X [simd]} {-o [output]} {-R [snapshot]} {-S [file]} {workload file ...}\n", name);
 	printf("\n");
 	printf("  -t: Show TLB result\n");
-	printf("  -q: Run quietly\n\n");
+	printf("  -q: Run quietly\n");
+	printf("  -m, --frames=N: Simulate N page frames (default %d)\n", NR_PAGEFRAMES);
+	printf("  -T, --tlb=entries[:ways[:fifo|lru|random]]\n");
+	printf("                : Set the TLB geometry (default %d:%d:fifo)\n",
+			NR_TLB_ENTRIES, NR_TLB_WAYS);
+	printf("  -A, --asids=N : Use N address space IDs (default %d)\n", NR_ASIDS);
+	printf("  -p, --pagetable=levels:bits\n");
+	printf("                : Use page tables of @levels levels with 2^@bits entries\n");
+	printf("                  in each directory (default %d:%d)\n",
+			NR_PT_LEVELS, PTES_PER_PAGE_SHIFT);
+	printf("  -L, --lazy-fork: Share page directories on fork, and copy them on write\n");
+	printf("  -Z, --lazy-alloc: Allocate small pages lazily as alloc with l does\n");
+	printf("  -F, --prefetch=none|next|stride[:degree]\n");
+	printf("                : Prefetch up to @degree mappings (default %d) from the\n",
+			TLB_PREFETCH_DEGREE);
+	printf("                  directory into the TLB on a miss, following the missing\n");
+	printf("                  VPN or the stride repeated between misses (default none)\n");
+	printf("  -a, --fault-around=N: Resolve the lazy and copy-on-write pages in the\n");
+	printf("                  aligned block of N pages together on a fault, using\n");
+	printf("                  free frames only (default 1, a power of two)\n");
+	printf("  -W, --cow-reuse: Make the last mapping of a copy-on-write page writable\n");
+	printf("                  as soon as the others go away\n");
+	printf("  -M, --mrc[=window]: Profile the TLB misses of fully-associative LRU TLBs\n");
+	printf("                  of all sizes for the system and each process, and the\n");
+	printf("                  working set in each window of accesses (default none)\n");
+	printf("  -P, --pipeline[=records[:batch]]\n");
+	printf("                : Read and parse text trace files ahead on another thread\n");
+	printf("                  into a ring of @records commands (default %d), handed\n",
+			PIPELINE_RECORDS);
+	printf("                  over in batches of @batch (default %d)\n", PIPELINE_BATCH);
+	printf("  -N, --numa=nodes[:local|interleave|preferred=N][:migrate]\n");
+	printf("                : Split the frames into up to %d nodes, with the CPUs in\n",
+			MAX_NUMA_NODES);
+	printf("                  turn, and allocate them with the default policy (local).\n");
+	printf("                  With migrate, pages move to the node missing in the TLB\n");
+	printf("  -C, --cost=item=cycles[,item=cycles...]\n");
+	printf("                : Set the cycles the translation takes for a TLB lookup,\n");
+	printf("                  a level of a walk, a fault, a copy-on-write copy, a swap-in\n");
+	printf("                  and a TLB flush. stats shows the average per access\n");
+	printf("                  (default ");
+	cost_print_config(stdout);
+	printf(")\n");
+	printf("  -K, --ksm[=interval]: Merge the frames of identical content every\n");
+	printf("                  @interval accesses (default %d) as the merge command\n",
+			KSM_INTERVAL);
+	printf("                  does, between the commands\n");
+	printf("  -s, --swap=slots[:fifo|clock|lru]\n");
+	printf("                : Swap out pages to a swap of @slots pages when the\n");
+	printf("                  frames run out (default policy clock)\n");
+	printf("  -c, --cpus=N  : Simulate N CPUs with a TLB each (default 1, up to %lu)\n",
+			(unsigned long)MAX_CPUS);
+	printf("  -j, --jobs=N  : Simulate the workload files on N threads in parallel\n");
+	printf("                  (default the number of online processors). Each file\n");
+	printf("                  is simulated from scratch, and the results are merged\n");
+	printf("                  in the order of the files\n");
+	printf("  -X, --simd=scalar|sse2|avx2\n");
+	printf("                : Use the kernels of the vector extension for fork and\n");
+	printf("                  TLB lookups (default the widest one supported)\n");
+	printf("  -o, --output=text|csv|counts\n");
+	printf("                : Print the accesses, allocations and deallocations as\n");
+	printf("                  text (default), CSV rows with the rest as # comments,\n");
+	printf("                  or not at all but the rest\n");
+	printf("  -R, --restore=FILE: Start from the snapshot in FILE, which is taken\n");
+	printf("                  with the snapshot command in the same configuration\n");
+	printf("  -S, --stats=FILE: Dump the event counters to FILE (- for stdout) on exit\n\n");
 }
 
 int main(int argc, char * argv[])
 {
 	int opt;
 	FILE *input = stdin;
-
-	while ((opt = getopt(argc, argv, "qht")) != -1) {
+	long nr_jobs = 0;
+	const char *simd_name = NULL;
+	static const struct option options[] = {
+		{ "frames",	required_argument,	NULL, 'm' },
+		{ "tlb",	required_argument,	NULL, 'T' },
+		{ "asids",	required_argument,	NULL, 'A' },
+		{ "cpus",	required_argument,	NULL, 'c' },
+		{ "jobs",	required_argument,	NULL, 'j' },
+		{ "simd",	required_argument,	NULL, 'X' },
+		{ "output",	required_argument,	NULL, 'o' },
+		{ "pagetable",	required_argument,	NULL, 'p' },
+		{ "lazy-fork",	no_argument,		NULL, 'L' },
+		{ "lazy-alloc",	no_argument,		NULL, 'Z' },
+		{ "prefetch",	required_argument,	NULL, 'F' },
+		{ "fault-around", required_argument,	NULL, 'a' },
+		{ "cow-reuse",	no_argument,		NULL, 'W' },
+		{ "mrc",	optional_argument,	NULL, 'M' },
+		{ "pipeline",	optional_argument,	NULL, 'P' },
+		{ "numa",	required_argument,	NULL, 'N' },
+		{ "cost",	required_argument,	NULL, 'C' },
+		{ "ksm",	optional_argument,	NULL, 'K' },
+		{ "restore",	required_argument,	NULL, 'R' },
+		{ "stats",	required_argument,	NULL, 'S' },
+		{ "swap",	required_argument,	NULL, 's' },
+		{ "help",	no_argument,		NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	while ((opt = getopt_long(argc, argv, "qhtLZWM::P::N:C:K::m:T:A:p:F:a:S:s:c:j:X:o:R:", options, NULL)) != -1) {
 		switch (opt) {
 		case 'q':
 			verbose = false;
@@ -408,6 +1380,118 @@ int main(int argc, char * argv[])
 		case 't':
 			print_tlb_result = true;
 			break;
+		case 'm':
+			nr_pageframes = strtoimax(optarg, NULL, 0);
+			if (!nr_pageframes) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'T':
+			if (!tlb_parse_config(optarg, &nr_tlb_entries, &nr_tlb_ways, &tlb_policy)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'A':
+			nr_asids = strtoimax(optarg, NULL, 0);
+			if (!nr_asids) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			if (!pt_parse_config(optarg, &nr_pt_levels, &pt_shift)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'L':
+			lazy_fork = true;
+			break;
+		case 'Z':
+			lazy_alloc = true;
+			break;
+		case 'W':
+			cow_reuse = true;
+			break;
+		case 'M':
+			mrc_profile = true;
+			if (optarg) mrc_window = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			if (!cost_parse_config(optarg)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'K':
+			ksm_interval = optarg ? strtoul(optarg, NULL, 0) : KSM_INTERVAL;
+			if (!ksm_interval) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'N':
+			if (!numa_parse_config(optarg, &nr_nodes, &default_mempolicy, &numa_migrate)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			if (!pipeline_parse_config(optarg, &pipeline_records, &pipeline_batch)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			if (!tlb_parse_prefetch(optarg, &tlb_prefetch, &tlb_prefetch_degree)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+			fault_around = strtoimax(optarg, NULL, 0);
+			if (!fault_around || (fault_around & (fault_around - 1))) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			nr_cpus = strtoimax(optarg, NULL, 0);
+			if (!nr_cpus || nr_cpus > MAX_CPUS) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'j':
+			nr_jobs = strtol(optarg, NULL, 0);
+			if (nr_jobs <= 0) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'X':
+			simd_name = optarg;
+			break;
+		case 'o':
+			if (!output_parse_mode(optarg, &output_mode)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'R':
+			restore_path = optarg;
+			break;
+		case 'S':
+			stats_path = optarg;
+			break;
+		case 's':
+			if (!swap_parse_config(optarg, &nr_swap_slots, &swap_policy)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'h':
 		default:
 			__print_usage(argv[0]);
@@ -415,6 +1499,45 @@ int main(int argc, char * argv[])
 		}
 	}
 
+	/* Each running process holds an ASID over a rollover */
+	if (nr_asids < nr_cpus) {
+		__print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Each of many nodes has a huge page worth of frames at least */
+	if (nr_nodes > 1 && nr_pageframes < nr_nodes << pt_shift) {
+		fprintf(stderr, "%u frames are too few for %u nodes of %u frames each\n",
+				nr_pageframes, nr_nodes, 1U << pt_shift);
+		return EXIT_FAILURE;
+	}
+
+	/* PTEs have room for PFNs, the zero frame, and swap slots up to PTE_MAX_PFN */
+	if (nr_pageframes > PTE_MAX_PFN ||
+			(nr_swap_slots && nr_swap_slots - 1 > PTE_MAX_PFN)) {
+		__print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	output_tlb = print_tlb_result;
+
+	if (!simd_init(simd_name)) {
+		fprintf(stderr, "No %s kernels on this CPU\n", simd_name);
+		return EXIT_FAILURE;
+	}
+
+	/* Many traces, or any number of them on threads. stdin is one trace */
+	if (argv[optind] && (nr_jobs || argv[optind + 1])) {
+		if (!nr_jobs) nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nr_jobs <= 0) nr_jobs = 1;
+
+		verbose = false;
+		if (!__run_traces(argv + optind, argc - optind, nr_jobs)) {
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	if (verbose && !argv[optind]) {
 		printf("***************************************************************************\n");
 		printf(" Welcome to\n\n");
@@ -443,14 +1566,25 @@ int main(int argc, char * argv[])
 		if (verbose) printf("Use stdin for input.\n");
 	}
 
+	output_init(stderr, stdout);
+	__init_system();
+
+	if (restore_path && !__restore(restore_path)) {
+		output_flush();
+		return EXIT_FAILURE;
+	}
+
 	if (verbose) {
 		printf("Type 'help' or '?' for help.\n\n");
-		printf("%d >> ", current->pid);
+		__print_prompt();
 	}
 
-	__do_simulation(input);
+	__simulate(input);
 
 	if (input != stdin) fclose(input);
 
+	output_flush();
+	if (stats_path) __dump_stats(stats_path);
+
 	return EXIT_SUCCESS;
 }
@@ -15,36 +15,287 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdint.h>
+
 #include "types.h"
+#include "stats.h"
+#include "numa.h"
 
-/* The number of physical page frames of the system */
+/* The default number of physical page frames of the system */
 #define NR_PAGEFRAMES	128
 
-/* The number of PTEs in a page */
+/* Virtual page number. Wide enough for sparse 48-bit+ VPN spaces */
+typedef unsigned long vpn_t;
+
+/* The number of PTEs in a page and page table levels by default */
 #define PTES_PER_PAGE_SHIFT	4
 #define NR_PTES_PER_PAGE    (1 << PTES_PER_PAGE_SHIFT)
+#define NR_PT_LEVELS		2
+
+#define MAX_PT_LEVELS		8
+#define MAX_VPN_BITS		60
 
 /* Protection bits for read and write */
 #define ACCESS_NONE  0x00
 #define ACCESS_READ  0x01
 #define ACCESS_WRITE 0x02
 
+/* Map a whole last-level directory with one contiguous frame block */
+#define ACCESS_HUGE  0x04
+
+/* Reserve the page, and leave the frame to the first access */
+#define ACCESS_LAZY  0x08
+
 /**
- * 2-level page table abstraction
+ * Multi-level page table abstraction. The number of levels and the number
+ * of entries in a directory are set at startup (see pagetable.h), and the
+ * directories are allocated on demand.
+ *
+ * A PTE is packed into a 32-bit word so that walking, copying and scanning
+ * the directories touch as little memory as possible:
+ *
+ *   bit 0     valid
+ *   bit 1-2   rw
+ *   bit 3-4   private, the rw to restore on COW and swap-in
+ *   bit 5     swapped, which is a swap entry not valid
+ *   bit 6-31  pfn, or the swap slot if swapped
+ *
+ * A PTE with the private rw but neither valid nor swapped is reserved by a
+ * lazy allocation, and gets a frame on the first access to it.
+ *
+ * Building with CONFIG_UNPACKED_ENTRIES (make UNPACKED=1) keeps them in
+ * separate fields instead, to compare the two in benchmarks. Either way,
+ * PTEs are read and updated only through the accessors below.
  */
+#define PTE_VALID		0x01
+#define PTE_RW_SHIFT		1
+#define PTE_PRIVATE_SHIFT	3
+#define PTE_SWAPPED		0x20
+#define PTE_PFN_SHIFT		6
+
+#define PTE_RW_MASK		(0x3U << PTE_RW_SHIFT)
+#define PTE_PRIVATE_MASK	(0x3U << PTE_PRIVATE_SHIFT)
+
+/* The largest PFN or swap slot a PTE can hold */
+#define PTE_MAX_PFN		(UINT32_MAX >> PTE_PFN_SHIFT)
+
+#ifndef CONFIG_UNPACKED_ENTRIES
+struct pte {
+	uint32_t val;
+};
+
+static inline bool pte_valid(const struct pte *pte)
+{
+	return !!(pte->val & PTE_VALID);
+}
+
+static inline bool pte_swapped(const struct pte *pte)
+{
+	return !!(pte->val & PTE_SWAPPED);
+}
+
+/* Whether @pte maps a page, in a frame or in the swap */
+static inline bool pte_present(const struct pte *pte)
+{
+	return !!(pte->val & (PTE_VALID | PTE_SWAPPED));
+}
+
+static inline unsigned int pte_rw(const struct pte *pte)
+{
+	return (pte->val & PTE_RW_MASK) >> PTE_RW_SHIFT;
+}
+
+static inline unsigned int pte_private(const struct pte *pte)
+{
+	return (pte->val & PTE_PRIVATE_MASK) >> PTE_PRIVATE_SHIFT;
+}
+
+static inline unsigned int pte_pfn(const struct pte *pte)
+{
+	return pte->val >> PTE_PFN_SHIFT;
+}
+
+static inline void pte_set_rw(struct pte *pte, unsigned int rw)
+{
+	pte->val = (pte->val & ~PTE_RW_MASK) | (rw << PTE_RW_SHIFT);
+}
+
+static inline void pte_set_private(struct pte *pte, unsigned int rw)
+{
+	pte->val = (pte->val & ~PTE_PRIVATE_MASK) | (rw << PTE_PRIVATE_SHIFT);
+}
+
+static inline void pte_set_pfn(struct pte *pte, unsigned int pfn)
+{
+	pte->val = (pte->val & ((1U << PTE_PFN_SHIFT) - 1)) | (pfn << PTE_PFN_SHIFT);
+}
+
+/* Map @pfn with @rw, which is also kept as the private one */
+static inline void pte_map(struct pte *pte, unsigned int pfn, unsigned int rw)
+{
+	pte->val = PTE_VALID | (rw << PTE_RW_SHIFT) | (rw << PTE_PRIVATE_SHIFT) |
+			(pfn << PTE_PFN_SHIFT);
+}
+
+/* Point @pte to the swap @slot. The private rw is kept to map it back */
+static inline void pte_mkswap(struct pte *pte, unsigned int slot)
+{
+	pte->val = PTE_SWAPPED | (pte->val & PTE_PRIVATE_MASK) | (slot << PTE_PFN_SHIFT);
+}
+
+/* Map @pfn in place of the swap entry with the private rw */
+static inline void pte_mkvalid(struct pte *pte, unsigned int pfn)
+{
+	unsigned int rw = pte_private(pte);
+
+	pte->val = PTE_VALID | (rw << PTE_RW_SHIFT) | (rw << PTE_PRIVATE_SHIFT) |
+			(pfn << PTE_PFN_SHIFT);
+}
+
+static inline bool pte_reserved(const struct pte *pte)
+{
+	return !(pte->val & (PTE_VALID | PTE_SWAPPED)) && (pte->val & PTE_PRIVATE_MASK);
+}
+
+/* Reserve @pte to be mapped with @rw later */
+static inline void pte_mkreserved(struct pte *pte, unsigned int rw)
+{
+	pte->val = rw << PTE_PRIVATE_SHIFT;
+}
+
+static inline void pte_clear(struct pte *pte)
+{
+	pte->val = 0;
+}
+#else
 struct pte {
 	bool valid;
 	unsigned int rw;
-	unsigned int pfn;
+	unsigned int pfn;	/* Swap slot if @swapped */
 	unsigned int private;	/* May use to backup something ;-) */
+	bool swapped;		/* Swap entry, which is not @valid */
 };
 
+static inline bool pte_valid(const struct pte *pte)
+{
+	return pte->valid;
+}
+
+static inline bool pte_swapped(const struct pte *pte)
+{
+	return pte->swapped;
+}
+
+static inline bool pte_present(const struct pte *pte)
+{
+	return pte->valid || pte->swapped;
+}
+
+static inline unsigned int pte_rw(const struct pte *pte)
+{
+	return pte->rw;
+}
+
+static inline unsigned int pte_private(const struct pte *pte)
+{
+	return pte->private;
+}
+
+static inline unsigned int pte_pfn(const struct pte *pte)
+{
+	return pte->pfn;
+}
+
+static inline void pte_set_rw(struct pte *pte, unsigned int rw)
+{
+	pte->rw = rw;
+}
+
+static inline void pte_set_private(struct pte *pte, unsigned int rw)
+{
+	pte->private = rw;
+}
+
+static inline void pte_set_pfn(struct pte *pte, unsigned int pfn)
+{
+	pte->pfn = pfn;
+}
+
+static inline void pte_map(struct pte *pte, unsigned int pfn, unsigned int rw)
+{
+	pte->valid = true;
+	pte->swapped = false;
+	pte->rw = rw;
+	pte->private = rw;
+	pte->pfn = pfn;
+}
+
+static inline void pte_mkswap(struct pte *pte, unsigned int slot)
+{
+	pte->valid = false;
+	pte->swapped = true;
+	pte->rw = 0;
+	pte->pfn = slot;
+}
+
+static inline void pte_mkvalid(struct pte *pte, unsigned int pfn)
+{
+	pte->swapped = false;
+	pte->valid = true;
+	pte->pfn = pfn;
+	pte->rw = pte->private;
+}
+
+static inline bool pte_reserved(const struct pte *pte)
+{
+	return !pte->valid && !pte->swapped && pte->private;
+}
+
+static inline void pte_mkreserved(struct pte *pte, unsigned int rw)
+{
+	pte->valid = false;
+	pte->swapped = false;
+	pte->rw = 0;
+	pte->pfn = 0;
+	pte->private = rw;
+}
+
+static inline void pte_clear(struct pte *pte)
+{
+	pte->valid = false;
+	pte->swapped = false;
+	pte->rw = 0;
+	pte->pfn = 0;
+	pte->private = 0;
+}
+#endif
+
 struct pte_directory {
-	struct pte ptes[NR_PTES_PER_PAGE];
+	unsigned int refs;			/* # of page tables sharing this */
+	bool huge;				/* Maps a huge page. See pa3.c */
+	union {
+		struct pte_directory *dirs[0];	/* Upper levels */
+		struct pte ptes[0];		/* The last level */
+	};
+};
+
+/**
+ * Paging-structure cache of a page table. Entry i of cache[level - 1] holds
+ * the slot in a directory at @level - 1 pointing to the directory at @level
+ * for the VPNs whose upper @level indices hash to i. Slots stay where they
+ * are until their directory is freed, so alloc and free, which only fill
+ * and replace what is in them, do not need to invalidate the cache.
+ */
+#define PT_CACHE_ENTRIES	4
+
+struct pt_cache_entry {
+	vpn_t tag;			/* Upper @level indices of the VPNs */
+	struct pte_directory **slot;	/* NULL if the entry is empty */
 };
 
 struct pagetable {
-	struct pte_directory *outer_ptes[NR_PTES_PER_PAGE];
+	struct pte_directory *root;
+	struct pt_cache_entry cache[MAX_PT_LEVELS - 1][PT_CACHE_ENTRIES];
 };
 
 
@@ -54,19 +305,164 @@ struct pagetable {
 struct process {
 	unsigned int pid;
 
+	unsigned int asid;	/* Address space ID tagging the TLB entries */
+	unsigned long asid_generation;
+	unsigned long cpumask;	/* CPUs whose TLB may have the entries */
+
+	struct cpu *cpu;	/* CPU running this, NULL if in the ready queue */
+
 	struct pagetable pagetable;
+	struct mempolicy mempolicy;	/* Where the frames come from. See numa.h */
 
 	struct list_head list;  /* List head to chain processes on the system */
+	struct hlist_node hash;	/* Chained in the pid table */
+
+	struct stats stats;	/* Events while the process is running */
 };
 
 
+/**
+ * TLB entry. Likewise, valid, rw, huge and the pfn are packed into a word
+ * of the same layout as the PTE, where bit 3 tells the entry covers the
+ * huge page starting at @vpn. Bit 4 tells the entry is filled by the
+ * prefetcher and not used yet, which tlb_entry_set() clears.
+ */
+#define TLB_ENTRY_HUGE		0x08
+#define TLB_ENTRY_PREFETCHED	0x10
+
+#ifndef CONFIG_UNPACKED_ENTRIES
+struct tlb_entry {
+	uint32_t val;
+	unsigned int asid;
+	vpn_t vpn;
+
+	unsigned long stamp;	/* When inserted (FIFO) or last used (LRU) */
+	struct list_head list;	/* Valid entries in the insertion order */
+};
+
+static inline bool tlb_entry_valid(const struct tlb_entry *entry)
+{
+	return !!(entry->val & PTE_VALID);
+}
+
+static inline bool tlb_entry_huge(const struct tlb_entry *entry)
+{
+	return !!(entry->val & TLB_ENTRY_HUGE);
+}
+
+static inline bool tlb_entry_prefetched(const struct tlb_entry *entry)
+{
+	return !!(entry->val & TLB_ENTRY_PREFETCHED);
+}
+
+static inline unsigned int tlb_entry_rw(const struct tlb_entry *entry)
+{
+	return (entry->val & PTE_RW_MASK) >> PTE_RW_SHIFT;
+}
+
+static inline unsigned int tlb_entry_pfn(const struct tlb_entry *entry)
+{
+	return entry->val >> PTE_PFN_SHIFT;
+}
+
+/* Validate @entry for a small or @huge page, mapping nothing yet */
+static inline void tlb_entry_mkvalid(struct tlb_entry *entry, bool huge)
+{
+	entry->val = PTE_VALID | (huge ? TLB_ENTRY_HUGE : 0);
+}
+
+static inline void tlb_entry_clear(struct tlb_entry *entry)
+{
+	entry->val = 0;
+}
+
+static inline void tlb_entry_set(struct tlb_entry *entry, unsigned int pfn, unsigned int rw)
+{
+	entry->val = (entry->val & (PTE_VALID | TLB_ENTRY_HUGE)) |
+			(rw << PTE_RW_SHIFT) | (pfn << PTE_PFN_SHIFT);
+}
+
+static inline void tlb_entry_wrprotect(struct tlb_entry *entry)
+{
+	entry->val &= ~(ACCESS_WRITE << PTE_RW_SHIFT);
+}
+
+static inline void tlb_entry_set_prefetched(struct tlb_entry *entry, bool prefetched)
+{
+	entry->val = (entry->val & ~TLB_ENTRY_PREFETCHED) |
+			(prefetched ? TLB_ENTRY_PREFETCHED : 0);
+}
+#else
 struct tlb_entry {
 	bool valid;
 	int rw;
-	unsigned int vpn;
+	unsigned int asid;
+	vpn_t vpn;
 	unsigned int pfn;
 	unsigned int private;
+	bool huge;		/* Covers the huge page starting at @vpn */
+	bool prefetched;	/* Filled by the prefetcher, and not used yet */
+
+	unsigned long stamp;	/* When inserted (FIFO) or last used (LRU) */
+	struct list_head list;	/* Valid entries in the insertion order */
 };
 
-#define NR_TLB_ENTRIES	(1 << (PTES_PER_PAGE_SHIFT * 2))
+static inline bool tlb_entry_valid(const struct tlb_entry *entry)
+{
+	return entry->valid;
+}
+
+static inline bool tlb_entry_huge(const struct tlb_entry *entry)
+{
+	return entry->huge;
+}
+
+static inline bool tlb_entry_prefetched(const struct tlb_entry *entry)
+{
+	return entry->prefetched;
+}
+
+static inline unsigned int tlb_entry_rw(const struct tlb_entry *entry)
+{
+	return entry->rw;
+}
+
+static inline unsigned int tlb_entry_pfn(const struct tlb_entry *entry)
+{
+	return entry->pfn;
+}
+
+static inline void tlb_entry_mkvalid(struct tlb_entry *entry, bool huge)
+{
+	entry->valid = true;
+	entry->huge = huge;
+	entry->prefetched = false;
+}
+
+static inline void tlb_entry_clear(struct tlb_entry *entry)
+{
+	entry->valid = false;
+}
+
+static inline void tlb_entry_set(struct tlb_entry *entry, unsigned int pfn, unsigned int rw)
+{
+	entry->pfn = pfn;
+	entry->rw = rw;
+	entry->prefetched = false;
+}
+
+static inline void tlb_entry_wrprotect(struct tlb_entry *entry)
+{
+	entry->rw &= ~ACCESS_WRITE;
+}
+
+static inline void tlb_entry_set_prefetched(struct tlb_entry *entry, bool prefetched)
+{
+	entry->prefetched = prefetched;
+}
+#endif
+
+/* The default TLB geometry */
+#define NR_TLB_ENTRIES	256
+#define NR_TLB_WAYS	4
 #endif
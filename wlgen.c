@@ -0,0 +1,363 @@
+/**********************************************************************
+ * Copyright (c) 2023
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "trace.h"
+
+/**
+ * Synthetic workload generator. Emit a text workload (or a binary trace with
+ * -b) of the requested access pattern to stdout.
+ *
+ * Every pattern starts by allocating @footprint writable pages from VPN 0 in
+ * the initial process, and the other processes are forked from it. With -H
+ * they are allocated as huge pages, so the footprint should be a multiple of
+ * the directory size of the simulator.
+ *
+ * The tenants pattern also has each process allocate a copy of its own of
+ * the same image of @footprint pages, tagged as identical contents, past
+ * the footprint, so that the simulator may merge them with -K.
+ */
+
+enum pattern {
+	PATTERN_SEQ,
+	PATTERN_STRIDE,
+	PATTERN_RANDOM,
+	PATTERN_ZIPF,
+	PATTERN_FORKSTORM,
+	PATTERN_COWSTORM,
+	PATTERN_TENANTS,
+	NR_PATTERNS,
+};
+
+static const char * const pattern_names[NR_PATTERNS] = {
+	[PATTERN_SEQ] = "seq",
+	[PATTERN_STRIDE] = "stride",
+	[PATTERN_RANDOM] = "random",
+	[PATTERN_ZIPF] = "zipf",
+	[PATTERN_FORKSTORM] = "forkstorm",
+	[PATTERN_COWSTORM] = "cowstorm",
+	[PATTERN_TENANTS] = "tenants",
+};
+
+/* The content tag of the image of the tenants, "image" in ASCII */
+#define TENANT_IMAGE_TAG	0x696d616765UL
+
+static enum pattern pattern = PATTERN_SEQ;
+static unsigned long nr_ops = 100000;
+static unsigned long footprint = 64;
+static unsigned int nr_procs = 1;
+static unsigned long stride = 4;
+static unsigned int write_ratio = 30;	/* in percent */
+static unsigned long quantum = 1000;	/* accesses between switches */
+static bool huge_pages = false;
+static unsigned int nr_cpus = 1;
+static double zipf_theta = 0.99;
+
+static bool binary = false;
+static struct trace_writer writer;
+
+static void __emit(const struct trace_cmd *cmd)
+{
+	if (binary) {
+		trace_write(&writer, cmd);
+	} else {
+		trace_print(stdout, cmd);
+	}
+}
+
+static void __emit_op(unsigned char op, unsigned long arg)
+{
+	struct trace_cmd cmd = { .op = op, .arg = arg, };
+
+	__emit(&cmd);
+}
+
+static void __emit_access(unsigned char op, vpn_t start, vpn_t last, unsigned int rw)
+{
+	struct trace_cmd cmd = {
+		.op = op, .rw = rw, .vpn = start, .last = last, .stride = 1,
+	};
+
+	__emit(&cmd);
+}
+
+/* xorshift64* so that the same seed yields the same workload everywhere */
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long __rand(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double __rand_unit(void)
+{
+	return (__rand() >> 11) * (1.0 / (1ULL << 53));
+}
+
+static unsigned int __rand_rw(void)
+{
+	return __rand() % 100 < write_ratio ? ACCESS_WRITE : ACCESS_READ;
+}
+
+/**
+ * Zipfian ranks over the footprint, sampled with a binary search on the
+ * cumulative distribution. VPN 0 is the most popular one.
+ */
+static double *zipf_cdf;
+
+static void __zipf_init(void)
+{
+	double sum = 0;
+
+	zipf_cdf = malloc(sizeof(*zipf_cdf) * footprint);
+	for (unsigned long i = 0; i < footprint; i++) {
+		sum += 1.0 / pow(i + 1, zipf_theta);
+		zipf_cdf[i] = sum;
+	}
+	for (unsigned long i = 0; i < footprint; i++) {
+		zipf_cdf[i] /= sum;
+	}
+}
+
+static vpn_t __zipf_next(void)
+{
+	double u = __rand_unit();
+	unsigned long lo = 0, hi = footprint - 1;
+
+	while (lo < hi) {
+		unsigned long mid = (lo + hi) / 2;
+
+		if (zipf_cdf[mid] < u) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static vpn_t __next_vpn(unsigned long i)
+{
+	switch (pattern) {
+	case PATTERN_SEQ:
+		return i % footprint;
+	case PATTERN_STRIDE:
+		return (i * stride) % footprint;
+	case PATTERN_ZIPF:
+		return __zipf_next();
+	case PATTERN_TENANTS:
+		return __rand() % (footprint * 2);
+	default:
+		return __rand() % footprint;
+	}
+}
+
+/**
+ * Accesses of the pattern, switching among the processes every quantum.
+ * With multiple CPUs, each switch happens on a random CPU, so the processes
+ * migrate among them.
+ */
+static void __gen_accesses(void)
+{
+	for (unsigned long i = 0; i < nr_ops; i++) {
+		if (nr_procs > 1 && i && i % quantum == 0) {
+			if (nr_cpus > 1) __emit_op(TRACE_OP_CPU, __rand() % nr_cpus);
+			__emit_op(TRACE_OP_SWITCH, __rand() % nr_procs);
+		}
+		vpn_t vpn = __next_vpn(i);
+
+		__emit_access(TRACE_OP_ACCESS, vpn, vpn, __rand_rw());
+	}
+}
+
+/**
+ * Fork a child, let it write a few pages, and exit it, over and over. Up to
+ * @nr_procs - 1 children are alive at the same time.
+ */
+static void __gen_forkstorm(void)
+{
+	unsigned int nr_children = nr_procs > 1 ? nr_procs - 1 : 1;
+	unsigned long pid = 1;
+
+	while (pid <= nr_ops) {
+		if (pid > nr_children) {
+			__emit_op(TRACE_OP_KILL, pid - nr_children);
+		}
+		__emit_op(TRACE_OP_SWITCH, pid);
+		for (unsigned int i = 0; i < 4; i++) {
+			vpn_t vpn = __rand() % footprint;
+
+			__emit_access(TRACE_OP_ACCESS, vpn, vpn, __rand_rw());
+		}
+		__emit_op(TRACE_OP_SWITCH, 0);
+		pid++;
+	}
+}
+
+/* Fork the children, and let all of them write to every shared page */
+static void __gen_cowstorm(void)
+{
+	unsigned long nr_done = 0;
+
+	for (unsigned int pid = 1; pid < nr_procs; pid++) {
+		__emit_op(TRACE_OP_SWITCH, pid);
+	}
+
+	while (nr_done < nr_ops) {
+		for (unsigned int pid = 0; pid < nr_procs && nr_done < nr_ops; pid++) {
+			__emit_op(TRACE_OP_SWITCH, pid);
+			for (vpn_t vpn = 0; vpn < footprint && nr_done < nr_ops; vpn++, nr_done++) {
+				__emit_access(TRACE_OP_ACCESS, vpn, vpn, ACCESS_WRITE);
+			}
+		}
+	}
+}
+
+/* Fork the tenants, each loading the image, and access them at random */
+static void __gen_tenants(void)
+{
+	struct trace_cmd image = {
+		.op = TRACE_OP_ALLOC, .rw = ACCESS_READ | ACCESS_WRITE,
+		.vpn = footprint, .last = footprint * 2 - 1, .stride = 1,
+		.arg = TENANT_IMAGE_TAG,
+	};
+
+	/* Forked before any image is there, so that each loads one */
+	for (unsigned int pid = 1; pid < nr_procs; pid++) {
+		__emit_op(TRACE_OP_SWITCH, pid);
+	}
+	for (unsigned int pid = 0; pid < nr_procs; pid++) {
+		__emit_op(TRACE_OP_SWITCH, pid);
+		__emit(&image);
+	}
+	__gen_accesses();
+}
+
+static void __print_usage(const char *name)
+{
+	printf("Usage: %s {-w pattern} {-n ops} {-f pages} {-P procs} {-s stride}\n", name);
+	printf("          {-r write%%} {-q quantum} {-z theta} {-S seed} {-C cpus} {-H} {-b}\n");
+	printf("\n");
+	printf("  -w: seq, stride, random, zipf, forkstorm, cowstorm, or tenants\n");
+	printf("      (default seq)\n");
+	printf("  -n: Number of accesses, or forks for forkstorm (default %lu)\n", nr_ops);
+	printf("  -f: Pages allocated in each process (default %lu)\n", footprint);
+	printf("  -P: Number of processes (default %u)\n", nr_procs);
+	printf("  -s: Stride of the stride pattern (default %lu)\n", stride);
+	printf("  -r: Percentage of writes (default %u)\n", write_ratio);
+	printf("  -q: Accesses between context switches (default %lu)\n", quantum);
+	printf("  -z: Skew of the zipf pattern (default %.2f)\n", zipf_theta);
+	printf("  -S: Random seed\n");
+	printf("  -C: Number of CPUs to run the processes on (default %u)\n", nr_cpus);
+	printf("  -H: Allocate the footprint with huge pages\n");
+	printf("  -b: Emit the binary trace format\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:n:f:P:s:r:q:z:S:C:Hbh")) != -1) {
+		switch (opt) {
+		case 'w':
+			for (pattern = 0; pattern < NR_PATTERNS; pattern++) {
+				if (strcmp(optarg, pattern_names[pattern]) == 0) break;
+			}
+			if (pattern == NR_PATTERNS) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			nr_ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			footprint = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			nr_procs = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			stride = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			write_ratio = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			quantum = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			zipf_theta = strtod(optarg, NULL);
+			break;
+		case 'S':
+			rng_state = strtoull(optarg, NULL, 0) ? : rng_state;
+			break;
+		case 'C':
+			nr_cpus = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			huge_pages = true;
+			break;
+		case 'b':
+			binary = true;
+			break;
+		case 'h':
+		default:
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!footprint || !nr_procs || !nr_cpus || !quantum || write_ratio > 100) {
+		__print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (binary) trace_writer_init(&writer, stdout);
+
+	__emit_access(TRACE_OP_ALLOC, 0, footprint - 1, ACCESS_READ | ACCESS_WRITE |
+			(huge_pages ? ACCESS_HUGE : 0));
+
+	switch (pattern) {
+	case PATTERN_FORKSTORM:
+		__gen_forkstorm();
+		break;
+	case PATTERN_COWSTORM:
+		__gen_cowstorm();
+		break;
+	case PATTERN_TENANTS:
+		__gen_tenants();
+		break;
+	default:
+		if (pattern == PATTERN_ZIPF) __zipf_init();
+		for (unsigned int pid = 1; pid < nr_procs; pid++) {
+			__emit_op(TRACE_OP_SWITCH, pid);
+		}
+		__gen_accesses();
+		break;
+	}
+
+	return fflush(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}